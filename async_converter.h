@@ -0,0 +1,230 @@
+#pragma once
+
+#include <chrono>
+#include <future>
+
+#include "converter.h"
+
+// Rate value that arrives later, e.g. from a remote cache
+using RateFuture = std::shared_future<double>;
+// starts fetching a rate and returns at once; no value - 0
+using AsyncRateFn = std::function<RateFuture()>;
+
+struct AsyncRate
+{
+  CurId       from;
+  CurId       to;
+  AsyncRateFn fetchFn;
+};
+
+// Conversions whose rates come asynchronously: convertAsync() starts
+// fetches of all rates of the path at once and returns a future of the
+// converted amount, so a conversion waits for one round trip instead of one
+// per hop. A fetch of a rate still in flight is joined, not repeated, by
+// every conversion needing that rate, a later one starts a fresh fetch.
+// Paths are the fewest-hop ones of BFSConverter, computed by one inside,
+// and results equal what it gives for the same rate values. Returned
+// futures are deferred: the product is taken in the thread calling get()
+// or wait(), a failed fetch rethrows its exception there. Conversions may
+// run concurrently, init() must not run with them
+template <class PathTable = AutoPathTable>
+class BasicAsyncConverter
+{
+public:
+  // 'curCount' - minimal universe size
+  explicit BasicAsyncConverter(size_t curCount = 0)
+    : mPaths(curCount)
+  {
+  }
+
+  // number of threads computing paths in init(), 0 - one per hardware thread
+  void setThreadCount(unsigned threadCount) { mPaths.setThreadCount(threadCount); }
+
+  void init(const std::vector<AsyncRate>& rates)
+  {
+    std::vector<ConvertRate> topology;
+    topology.reserve(rates.size());
+    for (const auto& rate : rates)
+      topology.push_back({rate.from, rate.to, RateFn()});
+    mPaths.init(topology);
+    std::lock_guard<std::mutex> lock(mMutex);
+    // source 0 is the dummy rate
+    mSources.assign(rates.size() + 1, Source());
+    for (size_t i = 0; i < rates.size(); ++i)
+      mSources[i + 1].fetchFn = rates[i].fetchFn;
+  }
+
+  // 'value' amount of 'from' in 'to', 0 if there is no path
+  std::future<double> convertAsync(double value, CurId from, CurId to)
+  {
+    std::vector<int32_t> path;
+    const bool convertible = findPath(from, to, path);
+    std::vector<RateFuture> fetched = fetch(path);
+    return std::async(std::launch::deferred,
+      [value, convertible, path = std::move(path), fetched = std::move(fetched)]()
+      {
+        const double totalRate = convertible ? pathRate(path, fetched) : 0.0d;
+        // weird compiler behavior, when multiplication result is 0 (seems casts to int)
+        double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+        return finalValue;
+      });
+  }
+
+  // amounts of convertAsync() for all 'count' pairs; rates of the whole
+  // batch are fetched at once, each distinct rate once, so all conversions
+  // of the batch see the same value of a rate
+  std::future<std::vector<double>> convertBatchAsync(const double* values, const CurId* from,
+                                                     const CurId* to, size_t count)
+  {
+    struct Conversion
+    {
+      double value;
+      bool convertible;
+      // hops of the conversion in 'paths'
+      size_t offset;
+      size_t length;
+    };
+    std::vector<Conversion> conversions(count);
+    std::vector<int32_t> paths;
+    std::vector<int32_t> path;
+    for (size_t i = 0; i < count; ++i)
+    {
+      const bool convertible = findPath(from[i], to[i], path);
+      conversions[i] = Conversion{values[i], convertible, paths.size(), path.size()};
+      paths.insert(paths.end(), path.begin(), path.end());
+    }
+    std::vector<RateFuture> fetched = fetch(paths);
+    return std::async(std::launch::deferred,
+      [conversions = std::move(conversions), paths = std::move(paths), fetched = std::move(fetched)]()
+      {
+        std::vector<double> out(conversions.size());
+        for (size_t i = 0; i < conversions.size(); ++i)
+        {
+          const Conversion& conversion = conversions[i];
+          const double totalRate = conversion.convertible
+            ? pathRate(paths.data() + conversion.offset, fetched.data() + conversion.offset, conversion.length)
+            : 0.0d;
+          out[i] = static_cast<long double>(totalRate) * static_cast<long double>(conversion.value);
+        }
+        return out;
+      });
+  }
+
+  // fetches started so far and requests that joined one in flight instead
+  uint64_t fetches() const { return mFetches.load(std::memory_order_relaxed); }
+  uint64_t joinedFetches() const { return mJoinedFetches.load(std::memory_order_relaxed); }
+
+  // bytes taken by path storage
+  size_t tableSize() const { return mPaths.tableSize(); }
+
+private:
+  struct Source
+  {
+    AsyncRateFn fetchFn;
+    // last fetch, joined while not ready
+    RateFuture fetch;
+  };
+
+  // signed rate ids of the path in path order, false if there is no path;
+  // empty path of a convertible pair - x -> x over a self-loop rate
+  bool findPath(CurId from, CurId to, std::vector<int32_t>& path) const
+  {
+    path.clear();
+    const PathTable& paths = mPaths.pathTable();
+    if (from >= paths.size() || to >= paths.size() || !paths.find(from, to))
+      return false;
+    for (CurId cur = from; cur != to;)
+    {
+      const CurId nextCur = paths.find(cur, to)->nextCur;
+      path.push_back(paths.find(cur, nextCur)->rateId);
+      cur = nextCur;
+    }
+    return true;
+  }
+
+  // a future per id of 'path'; a rate is requested once per call, even
+  // when its first fetch is ready before the rate comes again
+  std::vector<RateFuture> fetch(const std::vector<int32_t>& path)
+  {
+    std::vector<RateFuture> fetched;
+    fetched.reserve(path.size());
+    // position in 'fetched' of the first hop over every rate
+    std::unordered_map<int32_t, size_t> firstHops;
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (const int32_t rateId : path)
+    {
+      const int32_t id = rateId < 0 ? -rateId : rateId;
+      const auto firstHop = firstHops.emplace(id, fetched.size());
+      if (!firstHop.second)
+      {
+        fetched.push_back(fetched[firstHop.first->second]);
+        continue;
+      }
+      Source& source = mSources[id];
+      if (source.fetch.valid()
+          && source.fetch.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      {
+        mJoinedFetches.fetch_add(1, std::memory_order_relaxed);
+      }
+      else
+      {
+        source.fetch = source.fetchFn ? source.fetchFn() : readyRate(0.0);
+        mFetches.fetch_add(1, std::memory_order_relaxed);
+      }
+      fetched.push_back(source.fetch);
+    }
+    return fetched;
+  }
+
+  static RateFuture readyRate(double value)
+  {
+    std::promise<double> promise;
+    promise.set_value(value);
+    return promise.get_future().share();
+  }
+
+  // product of rates along the path in path order, as in BFSConverter
+  static double pathRate(const std::vector<int32_t>& path, const std::vector<RateFuture>& fetched)
+  {
+    return pathRate(path.data(), fetched.data(), path.size());
+  }
+  static double pathRate(const int32_t* path, const RateFuture* fetched, size_t length)
+  {
+    double totalRate = 1.0d;
+    for (size_t hop = 0; hop < length; ++hop)
+    {
+      const double rate = fetched[hop].get();
+      if (path[hop] > 0)
+        totalRate *= rate;
+      else
+        totalRate = rate == 0 ? 0.0 : totalRate / rate;
+    }
+    return totalRate;
+  }
+
+  // paths only, its rate values stay 0
+  BasicBFSConverter<PathTable, SlotRates> mPaths;
+  std::mutex mMutex;
+  std::vector<Source> mSources;
+  std::atomic<uint64_t> mFetches{0};
+  std::atomic<uint64_t> mJoinedFetches{0};
+};
+
+using AsyncConverter = BasicAsyncConverter<AutoPathTable>;
+
+// AsyncRate of every rate running its RateFn on a thread of its own per
+// fetch (std::async), so blocking rate functions of a path run at once
+inline std::vector<AsyncRate> asyncRates(const std::vector<ConvertRate>& rates)
+{
+  std::vector<AsyncRate> result;
+  result.reserve(rates.size());
+  for (const auto& rate : rates)
+  {
+    const RateFn rateFn = rate.rateFn;
+    AsyncRateFn fetchFn;
+    if (rateFn)
+      fetchFn = [rateFn]() { return std::async(std::launch::async, rateFn).share(); };
+    result.push_back({rate.from, rate.to, fetchFn});
+  }
+  return result;
+}
@@ -0,0 +1,1717 @@
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <string>
+#include <new>
+#include <thread>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "async_converter.h"
+#include "best_rate_converter.h"
+#include "concurrent_converter.h"
+#include "conversion_pipeline.h"
+#include "converter.h"
+#include "hub_converter.h"
+#include "interning_converter.h"
+#include "mapped_converter.h"
+#include "quote_converter.h"
+#include "shared_converter.h"
+#include "static_converter.h"
+
+// Heap accounting: every allocation carries its size in a header, so we
+// know live bytes at any moment
+namespace
+{
+std::atomic<size_t> gLiveBytes{0};
+std::atomic<size_t> gPeakBytes{0};
+std::atomic<size_t> gAllocations{0};
+const size_t allocHeader = alignof(std::max_align_t);
+}
+
+void* operator new(size_t size)
+{
+  void* p = std::malloc(size + allocHeader);
+  if (!p)
+    throw std::bad_alloc();
+  *static_cast<size_t*>(p) = size;
+  const size_t liveBytes = gLiveBytes += size;
+  size_t peakBytes = gPeakBytes;
+  while (liveBytes > peakBytes && !gPeakBytes.compare_exchange_weak(peakBytes, liveBytes))
+    ;
+  ++gAllocations;
+  return static_cast<char*>(p) + allocHeader;
+}
+
+void operator delete(void* p) noexcept
+{
+  if (!p)
+    return;
+  void* base = static_cast<char*>(p) - allocHeader;
+  gLiveBytes -= *static_cast<size_t*>(base);
+  std::free(base);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+namespace
+{
+
+// Converter as it was before the table became dynamic:
+// fixed Cell[2000][2000] with 64-bit next hop, loops bounded by curCount
+class LegacyConverter
+{
+public:
+  explicit LegacyConverter(size_t curCount)
+    : mCurCount(curCount)
+  {
+  }
+
+  void init(const std::vector<ConvertRate>& _rates)
+  {
+    Cell defaultCell;
+    for (size_t i = 0; i < mCurCount; ++i)
+      for (size_t j = 0; j < mCurCount; ++j)
+        rate_table[i][j] = defaultCell;
+
+    rates.reserve(_rates.size() + 1);
+    rates.push_back([]() { return 0.0; });
+
+    using Distance = uint32_t;
+    std::vector<std::vector<Distance>> distance(mCurCount);
+    const Distance unreachable = std::numeric_limits<Distance>::max();
+    for (size_t i = 0; i < mCurCount; ++i)
+    {
+      distance[i].assign(mCurCount, unreachable);
+      distance[i][i] = 0;
+    }
+    for (const auto& rate : _rates)
+    {
+      const CurId from = rate.from;
+      const CurId to = rate.to;
+      int32_t newRateId = static_cast<int32_t>(rates.size());
+      rates.push_back(rate.rateFn);
+      rate_table[from][to].rateId = newRateId;
+      rate_table[to][from].rateId = -newRateId;
+
+      for (size_t i = 0; i < mCurCount; ++i)
+      {
+        for (size_t j = 0; j < mCurCount; ++j)
+        {
+          if (distance[from][i] != unreachable && distance[to][j] != unreachable)
+          {
+            Distance new_distance = distance[from][i] + distance[to][j] + 1;
+            if (new_distance >= distance[i][j])
+              continue;
+            distance[i][j] = distance[j][i] = new_distance;
+            rate_table[i][j].nextCur = i != from ? rate_table[i][from].nextCur : to;
+            rate_table[j][i].nextCur = j != to ? rate_table[j][to].nextCur : from;
+          }
+        }
+      }
+    }
+  }
+
+private:
+  struct Cell
+  {
+    int32_t rateId;
+    CurId nextCur;
+    Cell()
+      : rateId(0)
+      , nextCur(2000)
+    {}
+  };
+  size_t mCurCount;
+  Cell rate_table[2000][2000];
+  std::vector<RateFn> rates;
+};
+
+// BFSConverter init as it was before CSR adjacency: list adjacency, a
+// list queue per search and unordered_map rows, one thread
+class LegacyBFSConverter
+{
+public:
+  void init(const std::vector<ConvertRate>& rates)
+  {
+    mRates.clear();
+    mPaths.clear();
+    size_t curCount = 0;
+    for (const auto& rate : rates)
+      curCount = std::max<size_t>(curCount, std::max(rate.from, rate.to) + 1);
+    std::vector<std::list<CurId>> connections;
+    mRates.reserve(rates.size() + 1);
+    mRates.push_back([]() { return 0.0; });
+    mPaths.resize(curCount);
+    connections.resize(curCount);
+    for (const auto& rate : rates)
+    {
+      const int32_t newRateId = static_cast<int32_t>(mRates.size());
+      mRates.push_back(rate.rateFn);
+      mPaths[rate.from][rate.to] = Cell(rate.to, newRateId);
+      mPaths[rate.to][rate.from] = Cell(rate.from, -newRateId);
+      connections[rate.from].emplace_back(rate.to);
+      connections[rate.to].emplace_back(rate.from);
+    }
+    std::vector<CurId> visitedNodes(curCount, unvisited);
+    for (CurId from = 0; from < curCount; ++from)
+      searchFrom(from, connections, visitedNodes);
+  }
+
+  // paths found, to check both inits did the same work
+  size_t pathCount() const
+  {
+    size_t count = 0;
+    for (const auto& row : mPaths)
+      count += row.size();
+    return count;
+  }
+
+private:
+  static const CurId unvisited{std::numeric_limits<CurId>::max()};
+
+  struct Cell
+  {
+    int32_t rateId{0};
+    CurId nextCur{unvisited};
+    Cell() {}
+    Cell(CurId _nextCur, int32_t _rateId) : rateId(_rateId), nextCur(_nextCur) {}
+  };
+
+  void searchFrom(CurId from, const std::vector<std::list<CurId>>& connections,
+                  std::vector<CurId>& visitedNodes)
+  {
+    visitedNodes[from] = from;
+    using NextCur = std::pair<CurId, CurId>;
+    std::list<NextCur> nextToVisitCurs;
+    for (const auto& nextCur : connections[from])
+    {
+      nextToVisitCurs.push_back(NextCur(nextCur, nextCur));
+      visitedNodes[nextCur] = from;
+    }
+    auto nextIt = nextToVisitCurs.begin();
+    while (nextIt != nextToVisitCurs.end())
+    {
+      const CurId visitingId = nextIt->first;
+      visitedNodes[visitingId] = from;
+      for (const auto& nextCur : connections[visitingId])
+      {
+        if (visitedNodes[nextCur] != from)
+        {
+          visitedNodes[nextCur] = from;
+          nextToVisitCurs.emplace_back(nextCur, nextIt->second);
+          mPaths[from][nextCur] = Cell(nextIt->second, 0);
+        }
+      }
+      ++nextIt;
+      nextToVisitCurs.pop_front();
+    }
+  }
+
+  std::vector<std::unordered_map<CurId, Cell>> mPaths;
+  std::vector<RateFn> mRates;
+};
+
+// Rate graph generators, all rates are 1.5
+
+// 0 - 1 - 2 - ... - N-1, longest possible paths
+std::vector<ConvertRate> chainRates(size_t curCount)
+{
+  std::vector<ConvertRate> rates;
+  for (CurId i = 1; i < curCount; ++i)
+    rates.push_back({i - 1, i, [](){ return 1.5; }});
+  return rates;
+}
+
+// every currency is quoted against currency 0
+std::vector<ConvertRate> starRates(size_t curCount)
+{
+  std::vector<ConvertRate> rates;
+  for (CurId i = 1; i < curCount; ++i)
+    rates.push_back({0, i, [](){ return 2.0; }});
+  return rates;
+}
+
+// spanning random tree plus random extra rates, 'rateCount' rates in total
+std::vector<ConvertRate> randomRates(size_t curCount, size_t rateCount, unsigned seed)
+{
+  std::srand(seed);
+  std::vector<ConvertRate> rates;
+  for (CurId i = 1; i < curCount; ++i)
+    rates.push_back({std::rand() % i, i, [](){ return 1.5; }});
+  while (rates.size() < rateCount)
+  {
+    const CurId from = std::rand() % curCount;
+    const CurId to = std::rand() % curCount;
+    if (from != to)
+      rates.push_back({from, to, [](){ return 1.5; }});
+  }
+  return rates;
+}
+
+// every pair has a direct rate
+std::vector<ConvertRate> denseRates(size_t curCount)
+{
+  std::vector<ConvertRate> rates;
+  for (CurId from = 0; from < curCount; ++from)
+    for (CurId to = from + 1; to < curCount; ++to)
+      rates.push_back({from, to, [](){ return 1.5; }});
+  return rates;
+}
+
+// ISO 4217 shaped market: 'curCount' currencies (about 180 exist) all
+// quoted against USD (0), ten majors (USD, EUR, JPY, ...) crossed with each
+// other, every third minor also quoted against EUR (1)
+std::vector<ConvertRate> isoRates(size_t curCount)
+{
+  const CurId majorCount = std::min<CurId>(10, curCount);
+  std::vector<ConvertRate> rates;
+  for (CurId cur = 1; cur < curCount; ++cur)
+    rates.push_back({0, cur, [](){ return 1.5; }});
+  for (CurId from = 1; from < majorCount; ++from)
+    for (CurId to = from + 1; to < majorCount; ++to)
+      rates.push_back({from, to, [](){ return 1.5; }});
+  for (CurId cur = majorCount; cur < curCount; cur += 3)
+    rates.push_back({1, cur, [](){ return 1.5; }});
+  return rates;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+template <class MakeFn>
+void measureStartup(const char* name, size_t curCount, MakeFn make)
+{
+  const auto rates = starRates(curCount);
+  const size_t bytesBefore = gLiveBytes;
+  const auto start = Clock::now();
+  auto cvt = make();
+  cvt->init(rates);
+  const double ms = elapsedMs(start);
+  const double mb = static_cast<double>(gLiveBytes - bytesBefore) / (1 << 20);
+  std::printf("%-8s N=%-5zu startup %9.3f ms  heap %9.3f MB\n", name, curCount, ms, mb);
+}
+
+void runStartupBench()
+{
+  std::printf("Converter startup (construct + init, star graph)\n");
+  for (size_t curCount : {5, 30, 100, 300, 1000})
+  {
+    measureStartup("legacy", curCount, [curCount]() { return std::make_unique<LegacyConverter>(curCount); });
+    measureStartup("compact", curCount, []() { return std::make_unique<Converter>(); });
+  }
+}
+
+// 'pairCount' random pairs over a connected chain, amounts in runs
+void runBatchBench()
+{
+  const size_t curCount = 50;
+  const size_t pairCount = 300;
+  const size_t amountCount = 2000000;
+  std::vector<ConvertRate> rates;
+  for (CurId i = 0; i + 1 < curCount; ++i)
+    rates.push_back({i, i + 1, [](){ return 1.001; }});
+
+  std::srand(42);
+  std::vector<std::pair<CurId, CurId>> pairs(pairCount);
+  for (auto& pair : pairs)
+    pair = {std::rand() % curCount, std::rand() % curCount};
+  std::vector<double> values(amountCount);
+  std::vector<CurId> from(amountCount), to(amountCount);
+  for (size_t i = 0; i < amountCount; ++i)
+  {
+    const auto& pair = pairs[std::rand() % pairCount];
+    values[i] = std::rand() % 10000;
+    from[i] = pair.first;
+    to[i] = pair.second;
+  }
+  std::vector<double> out(amountCount);
+
+  std::printf("Batch conversion (%zu amounts, %zu pairs, N=%zu chain)\n", amountCount, pairCount, curCount);
+  ConverterFactory factory;
+  for (auto type : {ConverterFactory::Type::INCREMENTAL, ConverterFactory::Type::BFS})
+  {
+    factory.setType(type);
+    auto cvt = factory.create();
+    cvt->init(rates);
+    const char* name = type == ConverterFactory::Type::BFS ? "bfs" : "incremental";
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < amountCount; ++i)
+      out[i] = cvt->convert(values[i], from[i], to[i]);
+    const double singleMs = elapsedMs(start);
+
+    start = Clock::now();
+    cvt->convertBatch(values.data(), from.data(), to.data(), out.data(), amountCount);
+    const double batchMs = elapsedMs(start);
+    std::printf("%-12s convert %9.3f ms  convertBatch %9.3f ms\n", name, singleMs, batchMs);
+  }
+}
+
+// live path walk vs cached pair rates, all pairs of a chain
+void runSnapshotBench()
+{
+  const size_t curCount = 50;
+  const size_t rounds = 2000;
+  std::vector<ConvertRate> rates;
+  for (CurId i = 0; i + 1 < curCount; ++i)
+    rates.push_back({i, i + 1, [](){ return 1.001; }});
+
+  std::printf("Snapshot conversion (%zu rounds over all pairs, N=%zu chain)\n", rounds, curCount);
+  ConverterFactory factory;
+  for (auto type : {ConverterFactory::Type::INCREMENTAL, ConverterFactory::Type::BFS})
+  {
+    factory.setType(type);
+    auto cvt = factory.create();
+    cvt->init(rates);
+    const char* name = type == ConverterFactory::Type::BFS ? "bfs" : "incremental";
+
+    double sink = 0;
+    auto start = Clock::now();
+    for (size_t round = 0; round < rounds; ++round)
+      for (CurId from = 0; from < curCount; ++from)
+        for (CurId to = 0; to < curCount; ++to)
+          sink += cvt->convert(1.0, from, to);
+    const double liveMs = elapsedMs(start);
+
+    start = Clock::now();
+    cvt->refreshRates();
+    const double refreshMs = elapsedMs(start);
+    start = Clock::now();
+    for (size_t round = 0; round < rounds; ++round)
+      for (CurId from = 0; from < curCount; ++from)
+        for (CurId to = 0; to < curCount; ++to)
+          sink += cvt->convert(1.0, from, to);
+    const double snapshotMs = elapsedMs(start);
+    std::printf("%-12s live %9.3f ms  refresh %7.3f ms  snapshot %9.3f ms  (%g)\n",
+                name, liveMs, refreshMs, snapshotMs, sink);
+  }
+}
+
+// reader threads price continuously while one writer refreshes rates
+// and periodically rebuilds the graph; every generation must be consistent
+void runConcurrentBench()
+{
+  const size_t curCount = 10;
+  const auto duration = std::chrono::milliseconds(500);
+  const unsigned readerCount = std::max(3u, std::thread::hardware_concurrency());
+  std::atomic<double> tick{1.0};
+  std::vector<ConvertRate> rates;
+  for (CurId i = 0; i + 1 < curCount; ++i)
+    rates.push_back({i, i + 1, [&](){ return tick.load(); }});
+
+  std::printf("Concurrent readers/writer (%u readers, N=%zu chain, %lld ms)\n",
+              readerCount, curCount, static_cast<long long>(duration.count()));
+  ConverterFactory factory;
+  for (auto type : {ConverterFactory::Type::INCREMENTAL, ConverterFactory::Type::BFS})
+  {
+    factory.setType(type);
+    const char* name = type == ConverterFactory::Type::BFS ? "bfs" : "incremental";
+    ConcurrentConverter cvt(factory);
+    cvt.init(rates);
+
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> torn{0};
+    std::vector<std::thread> readers;
+    for (unsigned r = 0; r < readerCount; ++r)
+      readers.emplace_back([&]()
+      {
+        const double values[]{1.0, 1.0};
+        const CurId from[]{0, 0};
+        const CurId to[]{1, curCount - 1};
+        double out[2];
+        uint64_t localReads = 0;
+        while (!done.load(std::memory_order_relaxed))
+        {
+          cvt.convertBatch(values, from, to, out, 2);
+          if (out[1] != std::pow(out[0], curCount - 1))
+            ++torn;
+          ++localReads;
+        }
+        reads += localReads;
+      });
+
+    uint64_t refreshes = 0;
+    uint64_t rebuilds = 0;
+    const auto start = Clock::now();
+    while (Clock::now() - start < duration)
+    {
+      tick = 1.0 + (refreshes % 7);
+      if (refreshes % 100 == 0)
+      {
+        cvt.init(rates);
+        ++rebuilds;
+      }
+      else
+      {
+        cvt.refreshRates();
+      }
+      ++refreshes;
+    }
+    done = true;
+    for (auto& reader : readers)
+      reader.join();
+    const double seconds = elapsedMs(start) / 1000;
+    std::printf("%-12s reads %10.0f/s  publishes %8.0f/s  rebuilds %llu  torn %llu\n",
+                name, reads / seconds, refreshes / seconds,
+                static_cast<unsigned long long>(rebuilds),
+                static_cast<unsigned long long>(torn.load()));
+  }
+}
+
+// one rate listed/delisted intraday: full init vs incremental update
+void runIncrementalBench()
+{
+  std::printf("Incremental update (random graph, R = 3N)\n");
+  for (size_t curCount : {100, 300, 1000})
+  {
+    auto rates = randomRates(curCount, 3 * curCount, 7);
+    const ConvertRate extra{0, curCount - 1, [](){ return 1.5; }};
+    Converter cvt;
+    auto start = Clock::now();
+    cvt.init(rates);
+    const double initMs = elapsedMs(start);
+
+    const size_t updates = 20;
+    start = Clock::now();
+    for (size_t i = 0; i < updates; ++i)
+    {
+      cvt.addRate(extra);
+      cvt.removeRate(extra.from, extra.to);
+    }
+    const double updateMs = elapsedMs(start) / (2 * updates);
+
+    start = Clock::now();
+    for (size_t i = 0; i < updates; ++i)
+    {
+      const auto& rate = rates[std::rand() % rates.size()];
+      cvt.removeRate(rate.from, rate.to);
+      cvt.addRate(rate);
+    }
+    const double churnMs = elapsedMs(start) / (2 * updates);
+    std::printf("N=%-5zu init %10.3f ms  add/remove new rate %8.3f ms  remove/re-add existing %8.3f ms\n",
+                curCount, initMs, updateMs, churnMs);
+  }
+}
+
+// BFSConverter::init time and heap allocations,
+// scaling over threads 1..max(4, hardware threads)
+void runParallelBFSBench()
+{
+  const size_t curCount = 2000;
+  const size_t rateCount = 40000;
+  const auto rates = randomRates(curCount, rateCount, 11);
+  const unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+  std::printf("BFS parallel init (N=%zu, R=%zu, %u hardware threads)\n",
+              curCount, rateCount, std::thread::hardware_concurrency());
+  {
+    LegacyBFSConverter legacy;
+    const size_t allocationsBefore = gAllocations;
+    const auto start = Clock::now();
+    legacy.init(rates);
+    const double ms = elapsedMs(start);
+    std::printf("legacy 1   init %10.3f ms  list adjacency and queue  allocations %zu  (%zu paths)\n",
+                ms, gAllocations - allocationsBefore, legacy.pathCount());
+  }
+  double singleMs = 0;
+  for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    BFSConverter cvt;
+    cvt.setThreadCount(threads);
+    const size_t allocationsBefore = gAllocations;
+    const auto start = Clock::now();
+    cvt.init(rates);
+    const double ms = elapsedMs(start);
+    const size_t allocations = gAllocations - allocationsBefore;
+    if (threads == 1)
+      singleMs = ms;
+    std::printf("threads %-3u init %10.3f ms  speedup %5.2fx  allocations %zu\n",
+                threads, ms, singleMs / ms, allocations);
+  }
+}
+
+// 'rates' split into 'clusterCount' disjoint copies over curCount currencies
+std::vector<ConvertRate> clusteredRates(size_t curCount, size_t clusterCount, unsigned seed)
+{
+  const size_t clusterSize = curCount / clusterCount;
+  std::vector<ConvertRate> rates;
+  for (size_t cluster = 0; cluster < clusterCount; ++cluster)
+    for (auto& rate : randomRates(clusterSize, 3 * clusterSize, seed))
+      rates.push_back({rate.from + cluster * clusterSize, rate.to + cluster * clusterSize, rate.rateFn});
+  return rates;
+}
+
+template <class Engine, class SetupFn>
+void measureEngine(const char* name, const char* graph, size_t curCount,
+                   const std::vector<ConvertRate>& rates, SetupFn setup)
+{
+  Engine cvt;
+  setup(cvt);
+  auto start = Clock::now();
+  cvt.init(rates);
+  const double initMs = elapsedMs(start);
+
+  const size_t conversions = 1000000;
+  std::srand(5);
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % curCount;
+    to[i] = std::rand() % curCount;
+  }
+  double sink = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += cvt.convert(1.0, from[i], to[i]);
+  const double convertNs = elapsedMs(start) * 1e6 / conversions;
+  std::printf("%-7s %-12s init %9.3f ms  convert %8.1f ns  paths %8.3f MB  (%g)\n", name, graph,
+              initMs, convertNs, static_cast<double>(cvt.tableSize()) / (1 << 20), sink);
+}
+
+template <class Engine>
+void measureEngine(const char* name, const char* graph, size_t curCount,
+                   const std::vector<ConvertRate>& rates)
+{
+  measureEngine<Engine>(name, graph, curCount, rates, [](Engine&) {});
+}
+
+// BFSConverter path storage policies on connected and clustered graphs
+void runPathStorageBench()
+{
+  const size_t curCount = 2000;
+  std::printf("BFS path storage (N=%zu, 1M random convert() calls)\n", curCount);
+  const auto sparse = randomRates(curCount, 2 * curCount, 11);
+  const auto dense = randomRates(curCount, 20 * curCount, 11);
+  const auto clustered = clusteredRates(curCount, 40, 11);
+  measureEngine<DenseBFSConverter>("dense", "R=2N", curCount, sparse);
+  measureEngine<SparseBFSConverter>("sparse", "R=2N", curCount, sparse);
+  measureEngine<DenseBFSConverter>("dense", "R=20N", curCount, dense);
+  measureEngine<SparseBFSConverter>("sparse", "R=20N", curCount, dense);
+  measureEngine<DenseBFSConverter>("dense", "40 clusters", curCount, clustered);
+  measureEngine<SparseBFSConverter>("sparse", "40 clusters", curCount, clustered);
+  measureEngine<ComponentBFSConverter>("comps", "R=2N", curCount, sparse);
+  measureEngine<ComponentBFSConverter>("comps", "40 clusters", curCount, clustered);
+  measureEngine<BFSConverter>("auto", "40 clusters", curCount, clustered);
+}
+
+// std::function rates vs pushed rate slots
+void runRateSourceBench()
+{
+  const size_t curCount = 300;
+  std::printf("Rate sources (N=%zu, 1M random convert() calls)\n", curCount);
+  const auto rates = randomRates(curCount, 3 * curCount, 11);
+  measureEngine<Converter>("fn", "incremental", curCount, rates);
+  measureEngine<SlotConverter>("slot", "incremental", curCount, rates);
+  measureEngine<BFSConverter>("fn", "bfs", curCount, rates);
+  measureEngine<SlotBFSConverter>("slot", "bfs", curCount, rates);
+}
+
+// dense engine ids vs sparse external ids vs pre-interned handles
+void runInterningBench()
+{
+  const size_t curCount = 180;
+  const size_t conversions = 2000000;
+  auto rates = isoRates(curCount);
+  BFSConverter dense;
+  dense.init(rates);
+  // spread ids like a symbol master would
+  for (auto& rate : rates)
+  {
+    rate.from = rate.from * 1000003 + 840000000000;
+    rate.to = rate.to * 1000003 + 840000000000;
+  }
+  InterningConverter<BFSConverter> interning;
+  interning.init(rates);
+
+  std::srand(5);
+  std::vector<CurId> from(conversions), to(conversions);
+  std::vector<CurHandle> fromHandles(conversions), toHandles(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % curCount;
+    to[i] = std::rand() % curCount;
+  }
+  double sink = 0;
+  auto start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += dense.convert(1.0, from[i], to[i]);
+  const double denseNs = elapsedMs(start) * 1e6 / conversions;
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = from[i] * 1000003 + 840000000000;
+    to[i] = to[i] * 1000003 + 840000000000;
+    fromHandles[i] = interning.handle(from[i]);
+    toHandles[i] = interning.handle(to[i]);
+  }
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += interning.convert(1.0, from[i], to[i]);
+  const double idsNs = elapsedMs(start) * 1e6 / conversions;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += interning.convert(1.0, fromHandles[i], toHandles[i]);
+  const double handlesNs = elapsedMs(start) * 1e6 / conversions;
+  std::printf("Interning (N=%zu iso4217, BFS)\n"
+              "dense ids %6.1f ns  sparse ids %6.1f ns  handles %6.1f ns  (%g)\n",
+              curCount, denseNs, idsNs, handlesNs, sink);
+}
+
+// L1 data and last level cache read misses of the calling thread via
+// perf_event_open; not available where the kernel or the VM has no PMU
+class CacheMissCounters
+{
+public:
+  CacheMissCounters()
+    : mL1(open(PERF_COUNT_HW_CACHE_L1D))
+    , mLLC(open(PERF_COUNT_HW_CACHE_LL))
+  {
+  }
+  ~CacheMissCounters()
+  {
+    for (const int fd : {mL1, mLLC})
+      if (fd >= 0)
+        close(fd);
+  }
+
+  bool available() const { return mL1 >= 0 && mLLC >= 0; }
+  void start()
+  {
+    for (const int fd : {mL1, mLLC})
+    {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  // misses since start()
+  void stop(uint64_t& l1, uint64_t& llc)
+  {
+    l1 = llc = 0;
+    for (const int fd : {mL1, mLLC})
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(mL1, &l1, sizeof(l1)) != sizeof(l1) || read(mLLC, &llc, sizeof(llc)) != sizeof(llc))
+      l1 = llc = 0;
+  }
+
+private:
+  static int open(uint64_t cache)
+  {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+  const int mL1;
+  const int mLLC;
+};
+
+// handle orders of InterningConverter on a hub-and-spoke graph whose
+// external ids are shuffled, so ID order scatters the hubs
+void runCurOrderBench()
+{
+  const size_t curCount = 2000;
+  const size_t conversions = 2000000;
+  auto rates = isoRates(curCount);
+  std::vector<CurId> external(curCount);
+  for (CurId cur = 0; cur < curCount; ++cur)
+    external[cur] = cur * 1000003 + 840000000000;
+  std::srand(31);
+  for (size_t i = curCount - 1; i > 0; --i)
+    std::swap(external[i], external[std::rand() % (i + 1)]);
+  for (auto& rate : rates)
+  {
+    rate.from = external[rate.from];
+    rate.to = external[rate.to];
+  }
+  // uniform pairs and a skewed flow: 95% of pairs among the 64 most
+  // quoted currencies, the rest uniform
+  std::vector<size_t> degree(curCount, 0);
+  for (const auto& rate : isoRates(curCount))
+  {
+    ++degree[rate.from];
+    ++degree[rate.to];
+  }
+  std::vector<CurId> byDegree(curCount);
+  for (CurId cur = 0; cur < curCount; ++cur)
+    byDegree[cur] = cur;
+  std::stable_sort(byDegree.begin(), byDegree.end(),
+                   [&degree](CurId a, CurId b) { return degree[a] > degree[b]; });
+  std::vector<CurId> uniformFrom(conversions), uniformTo(conversions);
+  std::vector<CurId> skewedFrom(conversions), skewedTo(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    uniformFrom[i] = external[std::rand() % curCount];
+    uniformTo[i] = external[std::rand() % curCount];
+    const bool hot = std::rand() % 100 < 95;
+    skewedFrom[i] = external[hot ? byDegree[std::rand() % 64] : std::rand() % curCount];
+    skewedTo[i] = external[hot ? byDegree[std::rand() % 64] : std::rand() % curCount];
+  }
+  CacheMissCounters counters;
+  std::printf("Currency order (iso4217 hub and spoke, N=%zu shuffled ids, %zu conversions by handle)%s\n",
+              curCount, conversions, counters.available() ? "" : ", no cache miss counters here");
+  auto measureFlow = [&](const char* name, auto& cvt, const std::vector<CurId>& from,
+                         const std::vector<CurId>& to)
+  {
+    std::vector<CurHandle> fromHandles(conversions), toHandles(conversions);
+    for (size_t i = 0; i < conversions; ++i)
+    {
+      fromHandles[i] = cvt.handle(from[i]);
+      toHandles[i] = cvt.handle(to[i]);
+    }
+    double sink = 0;
+    if (counters.available())
+      counters.start();
+    const auto start = Clock::now();
+    for (size_t i = 0; i < conversions; ++i)
+      sink += cvt.convert(1.0, fromHandles[i], toHandles[i]);
+    const double ns = elapsedMs(start) * 1e6 / conversions;
+    uint64_t l1 = 0, llc = 0;
+    if (counters.available())
+      counters.stop(l1, llc);
+    std::printf("%-31s convert %6.1f ns", name, ns);
+    if (counters.available())
+      std::printf("  L1D misses %6.2f  LLC misses %6.2f per conversion", double(l1) / conversions,
+                  double(llc) / conversions);
+    std::printf("  (%g)\n", sink);
+  };
+  auto measure = [&](const std::string& name, auto& cvt, CurOrder order)
+  {
+    cvt.setOrder(order);
+    cvt.init(rates);
+    for (const bool skewed : {false, true})
+      measureFlow((name + (skewed ? ", skewed" : ", uniform")).c_str(), cvt,
+                  skewed ? skewedFrom : uniformFrom, skewed ? skewedTo : uniformTo);
+  };
+  for (const auto& order : {std::make_pair(CurOrder::ID, "id"), std::make_pair(CurOrder::HUB_FIRST, "hub first"),
+                            std::make_pair(CurOrder::RCM, "rcm")})
+  {
+    InterningConverter<SlotBFSConverter> bfs;
+    measure(std::string("bfs, ") + order.second, bfs, order.first);
+    InterningConverter<SlotConverter> incremental;
+    measure(std::string("incremental, ") + order.second, incremental, order.first);
+  }
+}
+
+// hop by hop table walk vs flattened path lists
+void runFlatPathsBench()
+{
+  std::printf("Flat paths (1M random convert() calls)\n");
+  auto flat = [](auto& cvt) { cvt.setFlatPaths(true); };
+  const auto chain = chainRates(300);
+  const auto random = randomRates(500, 1500, 3);
+  measureEngine<Converter>("walk", "inc chain", 300, chain);
+  measureEngine<Converter>("flat", "inc chain", 300, chain, flat);
+  measureEngine<BFSConverter>("walk", "bfs chain", 300, chain);
+  measureEngine<BFSConverter>("flat", "bfs chain", 300, chain, flat);
+  measureEngine<Converter>("walk", "inc random", 500, random);
+  measureEngine<Converter>("flat", "inc random", 500, random, flat);
+  measureEngine<BFSConverter>("walk", "bfs random", 500, random);
+  measureEngine<BFSConverter>("flat", "bfs random", 500, random, flat);
+  const auto big = randomRates(2000, 4000, 3);
+  measureEngine<SlotBFSConverter>("walk", "slot 2000", 2000, big);
+  measureEngine<SlotBFSConverter>("flat", "slot 2000", 2000, big, flat);
+}
+
+// randomRates() topology quoted without arbitrage: currency 'cur' is worth
+// 1 + cur % 97 units, so all paths agree up to rounding
+std::vector<ConvertRate> consistentRates(size_t curCount, size_t rateCount, unsigned seed)
+{
+  auto rates = randomRates(curCount, rateCount, seed);
+  for (auto& rate : rates)
+  {
+    const double ratio = (1.0 + rate.from % 97) / (1.0 + rate.to % 97);
+    rate.rateFn = [ratio](){ return ratio; };
+  }
+  return rates;
+}
+
+// BestRateConverter path selection at 2000 currencies, refreshRates() re-runs
+// it; randomRates() quotes are full of arbitrage: detection plus fallback
+template <class Engine>
+void setRate(Engine&, size_t, size_t) {}
+// SlotRates feed pushing one price every 'setEvery' conversions
+void setRate(SlotBFSConverter& cvt, size_t setEvery, size_t i)
+{
+  if (setEvery && i % setEvery == 0)
+    cvt.rateSource().set(i / setEvery % 1500, 1.0 + static_cast<double>(i % 7) / 8);
+}
+
+// Skewed flow: 20 hot pairs take 95% of calls
+template <class Engine>
+void measureCache(const char* name, size_t curCount, const std::vector<ConvertRate>& rates,
+                  size_t cacheSize, size_t setEvery = 0)
+{
+  Engine cvt;
+  cvt.setCacheSize(cacheSize);
+  cvt.init(rates);
+  const size_t conversions = 1000000;
+  std::srand(9);
+  CurId hotFrom[20], hotTo[20];
+  for (size_t i = 0; i < 20; ++i)
+  {
+    hotFrom[i] = std::rand() % curCount;
+    hotTo[i] = std::rand() % curCount;
+  }
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    const bool hot = std::rand() % 100 < 95;
+    const size_t pair = std::rand() % 20;
+    from[i] = hot ? hotFrom[pair] : std::rand() % curCount;
+    to[i] = hot ? hotTo[pair] : std::rand() % curCount;
+  }
+  double sink = 0;
+  const auto start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    setRate(cvt, setEvery, i);
+    sink += cvt.convert(1.0, from[i], to[i]);
+  }
+  const double convertNs = elapsedMs(start) * 1e6 / conversions;
+  std::printf("%-22s cache %4zu  convert %6.1f ns  hit rate %5.1f%%  (%g)\n", name, cacheSize, convertNs,
+              cvt.cacheStats().hitRate() * 100, sink);
+}
+
+void runCacheBench()
+{
+  std::printf("Conversion cache (N=500, R=1500, 1M convert() calls, 95%% on 20 pairs)\n");
+  const auto rates = randomRates(500, 1500, 3);
+  for (size_t cacheSize : {0, 256})
+  {
+    measureCache<SlotConverter>("slot incremental", 500, rates, cacheSize);
+    measureCache<SlotBFSConverter>("slot bfs", 500, rates, cacheSize);
+    measureCache<SlotBFSConverter>("slot bfs, set()/1000", 500, rates, cacheSize, 1000);
+    measureCache<SlotBFSConverter>("slot bfs, set()/10", 500, rates, cacheSize, 10);
+  }
+}
+
+// Overhead of ConverterStats and what it reports
+void runStatsBench()
+{
+  std::printf("Stats (N=500, R=1500, 1M random convert() calls)\n");
+  const auto rates = randomRates(500, 1500, 3);
+  measureEngine<BFSConverter>("off", "bfs random", 500, rates);
+  measureEngine<StatsBFSConverter>("on", "bfs random", 500, rates);
+  measureEngine<Converter>("off", "inc random", 500, rates);
+  measureEngine<StatsConverter>("on", "inc random", 500, rates);
+  StatsBFSConverter cvt;
+  cvt.init(rates);
+  std::srand(5);
+  for (size_t i = 0; i < 1000000; ++i)
+    cvt.convert(1.0, std::rand() % 500, std::rand() % 500);
+  const ConverterStatsSnapshot stats = cvt.stats().snapshot();
+  std::printf("convert ns p50 %llu p99 %llu p99.9 %llu max %llu  hops mean %.2f max %llu  unreachable %llu\n"
+              "init phases ns graph %llu paths %llu flat %llu\n",
+              static_cast<unsigned long long>(stats.convertNanos.percentile(0.5)),
+              static_cast<unsigned long long>(stats.convertNanos.percentile(0.99)),
+              static_cast<unsigned long long>(stats.convertNanos.percentile(0.999)),
+              static_cast<unsigned long long>(stats.convertNanos.max()),
+              stats.hops.mean(), static_cast<unsigned long long>(stats.hops.max()),
+              static_cast<unsigned long long>(stats.unreachable),
+              static_cast<unsigned long long>(stats.lastInitPhaseNanos[0]),
+              static_cast<unsigned long long>(stats.lastInitPhaseNanos[1]),
+              static_cast<unsigned long long>(stats.lastInitPhaseNanos[2]));
+}
+
+void runBestRateBench()
+{
+  const size_t curCount = 2000;
+  const size_t rateCount = 40000;
+  const unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+  std::printf("Best rate paths (N=%zu, R=%zu, %u hardware threads)\n",
+              curCount, rateCount, std::thread::hardware_concurrency());
+  const auto consistent = consistentRates(curCount, rateCount, 11);
+  const auto arbitrage = randomRates(curCount, rateCount, 11);
+  for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    BestRateConverter cvt;
+    cvt.setThreadCount(threads);
+    auto start = Clock::now();
+    cvt.init(consistent);
+    const double initMs = elapsedMs(start);
+    start = Clock::now();
+    cvt.refreshRates();
+    const double refreshMs = elapsedMs(start);
+    const bool consistentArbitrage = cvt.hasArbitrage();
+    start = Clock::now();
+    cvt.init(arbitrage);
+    const double arbitrageMs = elapsedMs(start);
+    std::printf("threads %-3u init %9.3f ms  refresh %9.3f ms  arbitrage init %9.3f ms"
+                "  (cycles %d/%zu)\n", threads, initMs, refreshMs, arbitrageMs,
+                consistentArbitrage, cvt.arbitrageCycle().size());
+  }
+  measureEngine<BFSConverter>("bfs", "consistent", curCount, consistent);
+  measureEngine<BestRateConverter>("best", "consistent", curCount, consistent);
+}
+
+// BFS vs blocked Floyd-Warshall init on dense graphs (R = N^2 / 2), then
+// convert() walking paths and after refreshRates() from the snapshot
+template <class Engine>
+void measureDenseEngine(const char* name, size_t curCount, const std::vector<ConvertRate>& rates)
+{
+  Engine cvt;
+  auto start = Clock::now();
+  cvt.init(rates);
+  const double initMs = elapsedMs(start);
+  const size_t conversions = 1000000;
+  std::srand(5);
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % curCount;
+    to[i] = std::rand() % curCount;
+  }
+  double sink = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += cvt.convert(1.0, from[i], to[i]);
+  const double walkNs = elapsedMs(start) * 1e6 / conversions;
+  start = Clock::now();
+  cvt.refreshRates();
+  const double refreshMs = elapsedMs(start);
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += cvt.convert(1.0, from[i], to[i]);
+  const double snapshotNs = elapsedMs(start) * 1e6 / conversions;
+  std::printf("%-9s N=%-5zu init %10.3f ms  refresh %8.3f ms  convert walk %6.1f ns"
+              "  snapshot %6.1f ns  (%g)\n",
+              name, curCount, initMs, refreshMs, walkNs, snapshotNs, sink);
+}
+
+void runAllPairsBench()
+{
+  std::printf("Dense graphs (R = N^2 / 2, 1M random convert() calls)\n");
+  for (size_t curCount : {500, 1000, 2000})
+  {
+    const auto rates = denseRates(curCount);
+    measureDenseEngine<BFSConverter>("bfs", curCount, rates);
+    measureDenseEngine<AllPairsConverter>("all_pairs", curCount, rates);
+  }
+}
+
+// heap allocations and latency of repeated init() with the same rate set
+// (slot rates, so copying rate functions doesn't count)
+template <class Engine>
+void measureReinit(const char* name, const std::vector<ConvertRate>& rates)
+{
+  Engine cvt;
+  size_t allocationsBefore = gAllocations;
+  cvt.init(rates);
+  const size_t firstAllocations = gAllocations - allocationsBefore;
+  const int reinits = 20;
+  double totalMs = 0;
+  double maxMs = 0;
+  allocationsBefore = gAllocations;
+  for (int i = 0; i < reinits; ++i)
+  {
+    const auto start = Clock::now();
+    cvt.init(rates);
+    const double ms = elapsedMs(start);
+    totalMs += ms;
+    maxMs = std::max(maxMs, ms);
+  }
+  const size_t allocations = gAllocations - allocationsBefore;
+  std::printf("%-13s first init %7zu allocations  re-init %7.1f allocations  %8.3f ms avg  %8.3f ms max\n",
+              name, firstAllocations, static_cast<double>(allocations) / reinits, totalMs / reinits, maxMs);
+}
+
+void runReinitBench()
+{
+  const size_t curCount = 500;
+  std::printf("Re-init (N=%zu, R=%zu, 20 re-inits)\n", curCount, 3 * curCount);
+  const auto rates = randomRates(curCount, 3 * curCount, 7);
+  measureReinit<SlotConverter>("incremental", rates);
+  measureReinit<BasicBFSConverter<DensePathTable, SlotRates>>("bfs dense", rates);
+  measureReinit<BasicBFSConverter<SparsePathTable, SlotRates>>("bfs sparse", rates);
+  measureReinit<BasicAllPairsConverter<SlotRates>>("all pairs", rates);
+  measureReinit<BasicBestRateConverter<SlotRates>>("best rate", rates);
+}
+
+// startup by BFS init() vs mapping a path file saved by an earlier process
+// Startup of a deployment converting out of two base currencies only
+void runLazyBench()
+{
+  const size_t curCount = 2000;
+  const size_t rateCount = 40000;
+  const auto rates = randomRates(curCount, rateCount, 11);
+  std::printf("Lazy BFS (N=%zu, R=%zu, 1M convert() calls from 2 sources)\n", curCount, rateCount);
+  const size_t conversions = 1000000;
+  std::srand(5);
+  std::vector<CurId> to(conversions);
+  for (auto& cur : to)
+    cur = std::rand() % curCount;
+  for (bool lazy : {false, true})
+  {
+    BFSConverter cvt;
+    cvt.setLazy(lazy);
+    auto start = Clock::now();
+    cvt.init(rates);
+    const double initMs = elapsedMs(start);
+    start = Clock::now();
+    cvt.warmup({0, 1});
+    const double warmupMs = elapsedMs(start);
+    double sink = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < conversions; ++i)
+      sink += cvt.convert(1.0, i % 2, to[i]);
+    const double convertNs = elapsedMs(start) * 1e6 / conversions;
+    std::printf("%-6s init %9.3f ms  warmup %7.3f ms  convert %6.1f ns  rows searched %4zu  (%g)\n",
+                lazy ? "lazy" : "eager", initMs, warmupMs, convertNs, cvt.searchedRows(), sink);
+  }
+}
+
+// ConversionPipeline from memory to a discarding sink, input bytes per second
+void runPipelineBench()
+{
+  const size_t curCount = 180;
+  const auto rates = isoRates(curCount);
+  BFSConverter engine;
+  engine.init(rates);
+  engine.refreshRates();
+  const size_t recordCount = 8 << 20;
+  std::printf("Pipeline (iso4217 N=%zu, %zu binary records, 1M csv records)\n", curCount, recordCount);
+  std::srand(5);
+  std::vector<BinaryRecord> records(recordCount);
+  for (auto& record : records)
+    record = {static_cast<double>(std::rand() % 10000) / 100,
+              static_cast<uint32_t>(std::rand() % curCount), static_cast<uint32_t>(std::rand() % curCount)};
+  std::string csv;
+  for (size_t i = 0; i < (1 << 20); ++i)
+    csv += std::to_string(records[i].amount) + "," + std::to_string(records[i].from) + ","
+         + std::to_string(records[i].to) + "\n";
+  double sink = 0;
+  auto discard = [&sink](const char* data, size_t size) { sink += size ? data[size - 1] : 0; };
+  for (unsigned threads : {1u, 2u, 4u})
+  {
+    ConversionPipeline binary(engine, RecordFormat::BINARY, threads);
+    const char* data = reinterpret_cast<const char*>(records.data());
+    const size_t bytes = records.size() * sizeof(BinaryRecord);
+    binary.run(data, bytes, true, discard);
+    auto start = Clock::now();
+    binary.run(data, bytes, true, discard);
+    const double binaryMs = elapsedMs(start);
+    ConversionPipeline text(engine, RecordFormat::CSV, threads);
+    start = Clock::now();
+    text.run(csv.data(), csv.size(), true, discard);
+    const double csvMs = elapsedMs(start);
+    std::printf("threads %u  binary %7.3f GB/s %6.1f M records/s  csv %7.3f GB/s %6.1f M records/s\n", threads,
+                bytes / binaryMs / 1e6, recordCount / binaryMs / 1e3,
+                csv.size() / csvMs / 1e6, (1 << 20) / csvMs / 1e3);
+  }
+  std::printf("(%g)\n", sink);
+}
+
+// 20 currencies quoted against USD (0), EUR (1) crosses of the first 10
+constexpr StaticRate benchDeskRates[] = {
+  {1,0}, {2,0}, {3,0}, {4,0}, {5,0}, {6,0}, {7,0}, {8,0}, {9,0}, {10,0},
+  {11,0}, {12,0}, {13,0}, {14,0}, {15,0}, {16,0}, {17,0}, {18,0}, {19,0},
+  {2,1}, {3,1}, {4,1}, {5,1}, {6,1}, {7,1}, {8,1}, {9,1}
+};
+constexpr StaticTopology<20, 27> benchDeskLoose(benchDeskRates);
+constexpr StaticTopology<20, 27, benchDeskLoose.maxHops()> benchDesk(benchDeskRates);
+
+void runStaticBench()
+{
+  std::printf("Static converter (20 currencies, 27 rates, 10M random convert() calls)\n");
+  std::vector<ConvertRate> rates;
+  for (size_t i = 0; i < 27; ++i)
+  {
+    const double value = 1.0 + 0.01 * i;
+    rates.push_back({benchDeskRates[i].from, benchDeskRates[i].to, [value]() { return value; }});
+  }
+  const size_t conversions = 10000000;
+  std::srand(5);
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % 20;
+    to[i] = std::rand() % 20;
+  }
+  auto measure = [&](const char* name, auto& cvt)
+  {
+    cvt.init(rates);
+    double sink = 0;
+    const auto start = Clock::now();
+    for (size_t i = 0; i < conversions; ++i)
+      sink += cvt.convert(1.0, from[i], to[i]);
+    std::printf("%-22s convert %6.2f ns  (%g)\n", name, elapsedMs(start) * 1e6 / conversions, sink);
+  };
+  BFSConverter bfs;
+  measure("bfs", bfs);
+  SlotBFSConverter slots;
+  measure("slot bfs", slots);
+  StaticConverter<20, 27> loose(benchDeskLoose);
+  measure("static, MaxHops 19", loose);
+  StaticConverter<20, 27, benchDeskLoose.maxHops()> tight(benchDesk);
+  measure("static, MaxHops 2", tight);
+}
+
+void runPricerBench()
+{
+  const size_t curCount = 180;
+  const size_t conversions = 10000000;
+  std::printf("Pricer vs IConverter (iso4217, %zu currencies, 10M random convert() calls)\n", curCount);
+  const auto rates = isoRates(curCount);
+  std::srand(11);
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % curCount;
+    to[i] = std::rand() % curCount;
+  }
+  auto loop = [&](auto& cvt)
+  {
+    double sink = 0;
+    const auto start = Clock::now();
+    for (size_t i = 0; i < conversions; ++i)
+      sink += cvt.convert(1.0, from[i], to[i]);
+    return std::make_pair(elapsedMs(start) * 1e6 / conversions, sink);
+  };
+  const std::pair<ConverterFactory::Type, const char*> types[] = {
+    {ConverterFactory::Type::INCREMENTAL, "incremental"},
+    {ConverterFactory::Type::BFS, "bfs"},
+    {ConverterFactory::Type::ALL_PAIRS, "all pairs"}
+  };
+  ConverterFactory factory;
+  for (const auto& type : types)
+  {
+    factory.setType(type.first);
+    for (const bool snapshot : {false, true})
+    {
+      auto virtualCvt = factory.create();
+      virtualCvt->init(rates);
+      if (snapshot)
+        virtualCvt->refreshRates();
+      const auto virtualTime = loop(*virtualCvt);
+      factory.withPricer([&](auto& pricer)
+      {
+        pricer.init(rates);
+        if (snapshot)
+          pricer.refreshRates();
+        const auto pricerTime = loop(pricer);
+        std::printf("%-12s %-8s IConverter %6.2f ns  Pricer %6.2f ns  (%g %g)\n", type.second,
+                    snapshot ? "snapshot" : "walk", virtualTime.first, pricerTime.first,
+                    virtualTime.second, pricerTime.second);
+      });
+    }
+  }
+}
+
+void runQuoteBench()
+{
+  const size_t curCount = 1000;
+  const size_t conversions = 2000000;
+  std::printf("Quotes: one QuoteConverter vs bid/ask/mid SlotBFSConverters "
+              "(random_sparse, %zu currencies, %zu conversions)\n", curCount, conversions);
+  const auto mids = randomRates(curCount, 3 * curCount, 3);
+  std::vector<ConvertRate> bids, asks;
+  std::vector<QuoteRate> quotes;
+  for (const auto& rate : mids)
+  {
+    const double mid = rate.rateFn();
+    bids.push_back({rate.from, rate.to, [mid]() { return mid * 0.999; }});
+    asks.push_back({rate.from, rate.to, [mid]() { return mid * 1.001; }});
+    quotes.push_back({rate.from, rate.to, [mid]() { return Quote{mid * 0.999, mid * 1.001, mid}; }});
+  }
+  std::srand(13);
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % curCount;
+    to[i] = std::rand() % curCount;
+  }
+
+  auto start = Clock::now();
+  SlotBFSConverter bid, ask, mid;
+  bid.init(bids);
+  ask.init(asks);
+  mid.init(mids);
+  const double threeInit = elapsedMs(start);
+  double sink = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += bid.convert(1.0, from[i], to[i]) + ask.convert(1.0, from[i], to[i])
+            + mid.convert(1.0, from[i], to[i]);
+  const double threeConvert = elapsedMs(start) * 1e6 / conversions;
+  std::printf("3 engines        init %7.1f ms  table %6zu KB  quote %6.1f ns  (%g)\n", threeInit,
+              (bid.tableSize() + ask.tableSize() + mid.tableSize()) / 1024, threeConvert, sink);
+
+  start = Clock::now();
+  QuoteConverter cvt;
+  cvt.init(quotes);
+  const double quoteInit = elapsedMs(start);
+  sink = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    const Quote quote = cvt.convert(1.0, from[i], to[i]);
+    sink += quote.bid + quote.ask + quote.mid;
+  }
+  std::printf("QuoteConverter   init %7.1f ms  table %6zu KB  quote %6.1f ns  (%g)\n", quoteInit,
+              cvt.tableSize() / 1024, elapsedMs(start) * 1e6 / conversions, sink);
+}
+
+void runDeltaBench()
+{
+  std::printf("Delta updates: refreshRates() vs updateRates() of one changed rate\n");
+  struct DeltaGraph
+  {
+    const char* name;
+    size_t curCount;
+    std::vector<ConvertRate> rates;
+  };
+  const DeltaGraph graphs[] = {
+    {"star", 1000, starRates(1000)},
+    {"random_sparse", 1000, randomRates(1000, 3000, 3)},
+    {"dense", 120, denseRates(120)},
+    {"iso4217", 180, isoRates(180)}
+  };
+  for (const auto& graph : graphs)
+  {
+    const size_t ticks = 2000;
+    SlotBFSConverter cvt;
+    auto start = Clock::now();
+    cvt.init(graph.rates);
+    const double plainInitMs = elapsedMs(start);
+    const size_t plainSize = cvt.tableSize();
+    cvt.setDeltaUpdates(true);
+    start = Clock::now();
+    cvt.init(graph.rates);
+    const double initMs = elapsedMs(start);
+    cvt.refreshRates();
+    start = Clock::now();
+    for (size_t i = 0; i < 20; ++i)
+      cvt.refreshRates();
+    const double refreshMs = elapsedMs(start) / 20;
+    std::srand(29);
+    start = Clock::now();
+    for (size_t i = 0; i < ticks; ++i)
+    {
+      const size_t index = std::rand() % graph.rates.size();
+      cvt.rateSource().set(index, 1.0 + 0.001 * (i % 100));
+      cvt.updateRates({index});
+    }
+    const double updateUs = elapsedMs(start) * 1e3 / ticks;
+    std::printf("%-14s N=%4zu  init %6.1f -> %6.1f ms  index %6zu KB  refresh %8.1f us  update %7.2f us\n",
+                graph.name, graph.curCount, plainInitMs, initMs, (cvt.tableSize() - plainSize) / 1024,
+                refreshMs * 1e3, updateUs);
+  }
+}
+
+// 'cvt' against BFS paths over all pairs: pairs BFS converts that 'cvt'
+// doesn't and mean hops over the pairs both convert
+template <class PathTable>
+void measureStretch(const HubConverter& cvt, const PathTable& paths, size_t curCount)
+{
+  size_t bfsPairs = 0, dropped = 0;
+  double bfsHops = 0, hubHops = 0;
+  for (CurId from = 0; from < curCount; ++from)
+    for (CurId to = 0; to < curCount; ++to)
+    {
+      if (from == to || !paths.find(from, to))
+        continue;
+      ++bfsPairs;
+      const size_t hops = cvt.hops(from, to);
+      if (!hops)
+      {
+        ++dropped;
+        continue;
+      }
+      size_t bfs = 0;
+      for (CurId cur = from; cur != to; cur = paths.find(cur, to)->nextCur)
+        ++bfs;
+      bfsHops += bfs;
+      hubHops += hops;
+    }
+  const size_t both = bfsPairs - dropped;
+  std::printf("        dropped %5.2f%% of pairs, mean hops %4.2f vs %4.2f fewest\n",
+              100.0 * dropped / bfsPairs, hubHops / both, bfsHops / both);
+}
+
+void runHubBench()
+{
+  std::printf("Hub routing: 4 hubs by degree, max hops 8 (1M random convert() calls)\n");
+  const size_t curCount = 2000;
+  const auto iso = isoRates(curCount);
+  const auto random = randomRates(curCount, 3 * curCount, 3);
+  measureEngine<BFSConverter>("bfs", "iso4217", curCount, iso);
+  measureEngine<HubConverter>("hub", "iso4217", curCount, iso);
+  {
+    BFSConverter bfs;
+    bfs.init(iso);
+    HubConverter hub;
+    hub.init(iso);
+    measureStretch(hub, bfs.pathTable(), curCount);
+  }
+  measureEngine<BFSConverter>("bfs", "random", curCount, random);
+  measureEngine<HubConverter>("hub", "random", curCount, random);
+  {
+    BFSConverter bfs;
+    bfs.init(random);
+    HubConverter hub;
+    hub.init(random);
+    measureStretch(hub, bfs.pathTable(), curCount);
+  }
+  const size_t bigCount = 200000;
+  measureEngine<HubConverter>("hub", "iso 200k", bigCount, isoRates(bigCount));
+  measureEngine<HubConverter>("hub", "random 200k", bigCount, randomRates(bigCount, 3 * bigCount, 3));
+  {
+    HubConverter hub;
+    hub.init(isoRates(bigCount));
+    const auto start = Clock::now();
+    hub.refreshRates();
+    const double refreshMs = elapsedMs(start);
+    std::srand(3);
+    double sink = 0;
+    const size_t conversions = 1000000;
+    const auto convertStart = Clock::now();
+    for (size_t i = 0; i < conversions; ++i)
+      sink += hub.convert(1.0, std::rand() % bigCount, std::rand() % bigCount);
+    std::printf("hub     iso 200k     refreshRates %7.3f ms  convert %8.1f ns  paths %8.3f MB  (%g)\n",
+                refreshMs, elapsedMs(convertStart) * 1e6 / conversions, hub.tableSize() / 1048576.0, sink);
+  }
+}
+
+void runAsyncBench()
+{
+  const size_t curCount = 200;
+  const size_t conversions = 200;
+  const auto rtt = std::chrono::milliseconds(1);
+  std::printf("Async rate fetching: every rate fetch waits 1 ms (N=%zu, %zu random conversions)\n",
+              curCount, conversions);
+  std::vector<ConvertRate> rates = isoRates(curCount);
+  for (auto& rate : rates)
+  {
+    const RateFn rateFn = rate.rateFn;
+    rate.rateFn = [rateFn, rtt]() { std::this_thread::sleep_for(rtt); return rateFn(); };
+  }
+  std::srand(17);
+  std::vector<double> values(conversions, 1.0);
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % curCount;
+    to[i] = std::rand() % curCount;
+  }
+  BFSConverter bfs;
+  bfs.init(rates);
+  AsyncConverter async;
+  async.init(asyncRates(rates));
+  double sink = 0;
+  auto start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += bfs.convert(values[i], from[i], to[i]);
+  std::printf("  %-26s %8.3f ms/conversion\n", "bfs, hop after hop", elapsedMs(start) / conversions);
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += async.convertAsync(values[i], from[i], to[i]).get();
+  std::printf("  %-26s %8.3f ms/conversion  %llu fetches\n", "async, path at once",
+              elapsedMs(start) / conversions, static_cast<unsigned long long>(async.fetches()));
+  const uint64_t fetchesBefore = async.fetches();
+  start = Clock::now();
+  const auto batch = async.convertBatchAsync(values.data(), from.data(), to.data(), conversions).get();
+  sink += batch.back();
+  std::printf("  %-26s %8.3f ms/batch         %llu fetches, %llu joined\n", "async batch",
+              elapsedMs(start), static_cast<unsigned long long>(async.fetches() - fetchesBefore),
+              static_cast<unsigned long long>(async.joinedFetches()));
+  std::printf("  (sink %g)\n", sink);
+}
+
+void runPathFileBench()
+{
+  const size_t curCount = 2000;
+  const size_t rateCount = 40000;
+  const char* fileName = "bench_paths.bin";
+  const auto rates = randomRates(curCount, rateCount, 11);
+  std::printf("Path file startup (N=%zu, R=%zu, 1M random convert() calls)\n", curCount, rateCount);
+  BFSConverter bfs;
+  auto start = Clock::now();
+  bfs.init(rates);
+  const double initMs = elapsedMs(start);
+  start = Clock::now();
+  bfs.savePaths(fileName);
+  const double saveMs = elapsedMs(start);
+  start = Clock::now();
+  MappedConverter mapped(fileName);
+  mapped.init(rates);
+  const double openMs = elapsedMs(start);
+
+  const size_t conversions = 1000000;
+  std::srand(5);
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % curCount;
+    to[i] = std::rand() % curCount;
+  }
+  double sink = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += bfs.convert(1.0, from[i], to[i]);
+  const double bfsNs = elapsedMs(start) * 1e6 / conversions;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink -= mapped.convert(1.0, from[i], to[i]);
+  const double mappedNs = elapsedMs(start) * 1e6 / conversions;
+  std::printf("bfs init %9.3f ms  save %8.3f ms  file %7.3f MB  convert %6.1f ns\n"
+              "mapped open + init %8.3f ms  convert %6.1f ns  (%g)\n",
+              initMs, saveMs, static_cast<double>(mapped.tableSize()) / (1 << 20), bfsNs,
+              openMs, mappedNs, sink);
+  std::remove(fileName);
+}
+
+// convert() of an attached reader, alone and with a writer publishing all
+// rates back to back
+void runSharedBench()
+{
+  const size_t curCount = 2000;
+  const size_t rateCount = 40000;
+  const auto rates = randomRates(curCount, rateCount, 11);
+  std::printf("Shared tables (N=%zu, R=%zu, 1M random convert() calls)\n", curCount, rateCount);
+  BFSConverter bfs;
+  bfs.init(rates);
+  auto start = Clock::now();
+  // a crashed run may have left its segments
+  SharedConverterPublisher publisher("/rate_converter_bench", bfs, rates,
+                                     SharedConverterPublisher::Existing::REPLACE);
+  const double createMs = elapsedMs(start);
+  start = Clock::now();
+  SharedConverter shared("/rate_converter_bench");
+  shared.init(rates);
+  const double attachMs = elapsedMs(start);
+  start = Clock::now();
+  for (int i = 0; i < 10; ++i)
+    publisher.publish();
+  const double publishMs = elapsedMs(start) / 10;
+
+  const size_t conversions = 1000000;
+  std::srand(5);
+  std::vector<CurId> from(conversions), to(conversions);
+  for (size_t i = 0; i < conversions; ++i)
+  {
+    from[i] = std::rand() % curCount;
+    to[i] = std::rand() % curCount;
+  }
+  double sink = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink += bfs.convert(1.0, from[i], to[i]);
+  const double bfsNs = elapsedMs(start) * 1e6 / conversions;
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink -= shared.convert(1.0, from[i], to[i]);
+  const double sharedNs = elapsedMs(start) * 1e6 / conversions;
+  std::atomic<bool> done{false};
+  std::thread writer([&]()
+  {
+    while (!done)
+      publisher.publish();
+  });
+  const uint64_t before = shared.publications();
+  start = Clock::now();
+  for (size_t i = 0; i < conversions; ++i)
+    sink -= shared.convert(1.0, from[i], to[i]);
+  const double contendedNs = elapsedMs(start) * 1e6 / conversions;
+  const uint64_t published = shared.publications() - before;
+  done = true;
+  writer.join();
+  std::printf("publisher create %8.3f ms  publish %7.3f ms  reader attach + init %7.3f ms\n"
+              "convert: bfs %6.1f ns  shared %6.1f ns  shared under writer %6.1f ns (%llu publications) (%g)\n",
+              createMs, publishMs, attachMs, bfsNs, sharedNs, contendedNs,
+              static_cast<unsigned long long>(published), sink);
+}
+
+struct Graph
+{
+  const char* name;
+  size_t curCount;
+  std::vector<ConvertRate> rates;
+};
+
+// Default graph sizes keep INCREMENTAL init (O(R * N^2)) within seconds;
+// 'curCount' overrides them when not 0
+std::vector<Graph> benchGraphs(size_t curCount)
+{
+  auto size = [curCount](size_t defaultCount) { return curCount ? curCount : defaultCount; };
+  std::vector<Graph> graphs;
+  graphs.push_back({"chain", size(300), chainRates(size(300))});
+  graphs.push_back({"star", size(1000), starRates(size(1000))});
+  graphs.push_back({"random_sparse", size(500), randomRates(size(500), 3 * size(500), 3)});
+  graphs.push_back({"dense", size(120), denseRates(size(120))});
+  graphs.push_back({"iso4217", size(180), isoRates(size(180))});
+  return graphs;
+}
+
+double percentile(const std::vector<double>& sorted, double fraction)
+{
+  return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+}
+
+// One JSON object per (graph, engine): init time, per-call convert()
+// latency percentiles (including ~20 ns of clock reads), tight loop
+// throughput and heap peak of construction + init
+void runEngineBench(size_t curCount, const char* graphFilter)
+{
+  const size_t samples = 200000;
+  const size_t loopConversions = 2000000;
+  std::printf("{\n  \"benchmark\": \"engines\",\n  \"results\": [");
+  const char* separator = "\n";
+  for (const auto& graph : benchGraphs(curCount))
+  {
+    if (graphFilter && std::strcmp(graphFilter, graph.name) != 0)
+      continue;
+    std::srand(17);
+    std::vector<CurId> from(samples), to(samples);
+    for (size_t i = 0; i < samples; ++i)
+    {
+      from[i] = std::rand() % graph.curCount;
+      to[i] = std::rand() % graph.curCount;
+    }
+
+    ConverterFactory factory;
+    for (auto type : {ConverterFactory::Type::INCREMENTAL, ConverterFactory::Type::BFS})
+    {
+      factory.setType(type);
+      const char* engine = type == ConverterFactory::Type::BFS ? "bfs" : "incremental";
+
+      const size_t bytesBefore = gLiveBytes;
+      gPeakBytes = bytesBefore;
+      auto start = Clock::now();
+      auto cvt = factory.create();
+      cvt->init(graph.rates);
+      const double initMs = elapsedMs(start);
+      const size_t peakBytes = gPeakBytes - bytesBefore;
+
+      std::vector<double> latencies(samples);
+      double sink = 0;
+      for (size_t i = 0; i < samples; ++i)
+      {
+        const auto callStart = Clock::now();
+        sink += cvt->convert(1.0, from[i], to[i]);
+        latencies[i] = std::chrono::duration<double, std::nano>(Clock::now() - callStart).count();
+      }
+      std::sort(latencies.begin(), latencies.end());
+
+      start = Clock::now();
+      for (size_t i = 0; i < loopConversions; ++i)
+        sink += cvt->convert(1.0, from[i % samples], to[i % samples]);
+      const double throughput = loopConversions / (elapsedMs(start) / 1000);
+
+      std::printf("%s    {\"graph\": \"%s\", \"currencies\": %zu, \"rates\": %zu, \"engine\": \"%s\", "
+                  "\"init_ms\": %.3f, \"convert_ns\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+                  "\"p999\": %.1f, \"max\": %.1f}, \"throughput_per_s\": %.0f, \"peak_heap_bytes\": %zu, "
+                  "\"checksum\": %g}",
+                  separator, graph.name, graph.curCount, graph.rates.size(), engine, initMs,
+                  percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99),
+                  percentile(latencies, 0.999), latencies.back(), throughput, peakBytes, sink);
+      separator = ",\n";
+      std::fflush(stdout);
+    }
+  }
+  std::printf("\n  ]\n}\n");
+}
+
+struct Section
+{
+  const char* name;
+  void (*run)();
+};
+
+const Section sections[] = {
+  {"startup", runStartupBench},
+  {"batch", runBatchBench},
+  {"snapshot", runSnapshotBench},
+  {"concurrent", runConcurrentBench},
+  {"incremental", runIncrementalBench},
+  {"parallel_bfs", runParallelBFSBench},
+  {"path_storage", runPathStorageBench},
+  {"rate_sources", runRateSourceBench},
+  {"interning", runInterningBench},
+  {"cur_order", runCurOrderBench},
+  {"flat_paths", runFlatPathsBench},
+  {"cache", runCacheBench},
+  {"stats", runStatsBench},
+  {"best_rate", runBestRateBench},
+  {"all_pairs", runAllPairsBench},
+  {"reinit", runReinitBench},
+  {"lazy", runLazyBench},
+  {"path_file", runPathFileBench},
+  {"pipeline", runPipelineBench},
+  {"static", runStaticBench},
+  {"pricer", runPricerBench},
+  {"quote", runQuoteBench},
+  {"delta", runDeltaBench},
+  {"hub", runHubBench},
+  {"async", runAsyncBench},
+  {"shared", runSharedBench},
+};
+
+void usage()
+{
+  std::fprintf(stderr,
+    "usage: converter_bench [--size=N] [--graph=NAME]  engine comparison as JSON\n"
+    "       converter_bench all|SECTION...              human readable sections\n"
+    "graphs: chain star random_sparse dense iso4217\nsections:");
+  for (const auto& section : sections)
+    std::fprintf(stderr, " %s", section.name);
+  std::fprintf(stderr, "\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  size_t curCount = 0;
+  const char* graphFilter = nullptr;
+  std::vector<const Section*> selected;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (arg.compare(0, 7, "--size=") == 0)
+    {
+      curCount = std::strtoul(arg.c_str() + 7, nullptr, 10);
+      continue;
+    }
+    if (arg.compare(0, 8, "--graph=") == 0)
+    {
+      graphFilter = argv[i] + 8;
+      continue;
+    }
+    const size_t sizeBefore = selected.size();
+    for (const auto& section : sections)
+      if (arg == "all" || arg == section.name)
+        selected.push_back(&section);
+    if (selected.size() == sizeBefore)
+    {
+      usage();
+      return 1;
+    }
+  }
+  if (selected.empty())
+    runEngineBench(curCount, graphFilter);
+  for (const auto* section : selected)
+    section->run();
+  return 0;
+}
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <cmath>
+#include <mutex>
+
+#include "converter.h"
+
+// Picks for every pair the path giving the most, not the one with fewest
+// hops. Rate r from 'a' to 'b' is edge a -> b with weight -log(r) and edge
+// b -> a with weight log(r), so the best path is the shortest weighted one
+// and a negative cycle is an arbitrage loop.
+// Paths are chosen from rate values at init() and at every refreshRates(),
+// by SPFA (queue based Bellman-Ford) towards each destination over incoming
+// edges: O(k * R) per destination, k is small on market graphs, and
+// destinations are spread over threads. If some cycle multiplies to more
+// than 1 (beyond rounding) best paths aren't defined: the engine falls back
+// to fewest-hop paths and reports the cycle.
+template <class RateSource = FunctionRates>
+class BasicBestRateConverter : public IConverter
+{
+public:
+  // 'curCount' - minimal universe size, at most 65535
+  explicit BasicBestRateConverter(size_t curCount = 0)
+    : mMinCurCount(curCount)
+  {
+  }
+
+  // number of threads computing paths, 0 - one per hardware thread
+  void setThreadCount(unsigned threadCount) { mThreadCount = threadCount; }
+
+  void init(const std::vector<ConvertRate>& _rates)
+  {
+    size_t curCount = mMinCurCount;
+    for (const auto& rate : _rates)
+      curCount = std::max<size_t>(curCount, std::max(rate.from, rate.to) + 1);
+    if (curCount > Cell::nocur)
+      throw std::out_of_range("BestRateConverter: currency id doesn't fit into 16-bit table index");
+    mCurCount = curCount;
+    mUseSnapshot = false;
+    mArena.reset();
+    mTopology = topologyHash(_rates);
+
+    rates.clear();
+    rates.reserve(_rates.size() + 1);
+    rates.push_back([]() { return 0.0; }); // add dummy fn
+    // incoming edges of every currency as compressed sparse row
+    mOffsets.assign(curCount + 1, 0);
+    for (const auto& rate : _rates)
+    {
+      rates.push_back(rate.rateFn);
+      ++mOffsets[rate.from + 1];
+      ++mOffsets[rate.to + 1];
+    }
+    for (size_t cur = 0; cur < curCount; ++cur)
+      mOffsets[cur + 1] += mOffsets[cur];
+    mIncoming.resize(mOffsets[curCount]);
+    ArenaVector<size_t> filled(mOffsets.begin(), mOffsets.end() - 1, ArenaAllocator<size_t>(mArena));
+    int32_t rateId = 0;
+    for (const auto& rate : _rates)
+    {
+      ++rateId;
+      // edge from -> to arrives at 'to', its inverse arrives at 'from'
+      mIncoming[filled[rate.to]++] = Edge{static_cast<uint16_t>(rate.from), rateId};
+      mIncoming[filled[rate.from]++] = Edge{static_cast<uint16_t>(rate.to), -rateId};
+    }
+    ArenaVector<double> edgeRates(rates.size(), ArenaAllocator<double>(mArena));
+    evaluateRates(edgeRates);
+    computePaths(edgeRates.data());
+  }
+
+  double convert(double value, CurId from, CurId to)
+  {
+    const double totalRate = mUseSnapshot ? mSnapshot.rate(from, to) : pathRate(from, to);
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+    return finalValue;
+  }
+
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    if (mUseSnapshot)
+      return convertSnapshot(mSnapshot, values, from, to, out, count);
+    convertGrouped(values, from, to, out, count,
+                   [this](CurId f, CurId t) { return pathRate(f, t); });
+  }
+
+  // evaluates rates once, re-selects best paths for them and caches
+  // composite rates, O(N * k * R + N^2)
+  uint64_t refreshRates()
+  {
+    std::vector<double> edgeRates(rates.size());
+    evaluateRates(edgeRates);
+    mArena.reset();
+    computePaths(edgeRates.data());
+    composeRates(mSnapshot, mCurCount, edgeRates,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+    mUseSnapshot = true;
+    return ++mSnapshot.epoch;
+  }
+
+  const RateSnapshot& snapshot() const { return mSnapshot; }
+
+  // whether last path computation found an arbitrage loop,
+  // paths are fewest-hop ones then
+  bool hasArbitrage() const { return !mArbitrageCycle.empty(); }
+  // currencies of the loop, each converts to the next one and the last
+  // one back to the first with total product of rates above 1
+  const std::vector<CurId>& arbitrageCycle() const { return mArbitrageCycle; }
+
+  // bytes taken by the path table
+  size_t tableSize() const { return mTable.size() * sizeof(Cell); }
+  // writes computed paths for MappedConverter (see PathFileHeader),
+  // rate functions aren't part of the file
+  void savePaths(const std::string& fileName)
+  {
+    saveToFile(fileName, [this](std::ostream& out) { savePaths(out); });
+  }
+  void savePaths(std::ostream& out)
+  {
+    writePathFile(out, mCurCount, rates.size() ? rates.size() - 1 : 0, mTopology,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+  }
+  // scratch memory kept between path computations
+  const InitArena& initArena() const { return mArena; }
+  // rate values, e.g. slots to push prices into for SlotRates
+  RateSource& rateSource() { return rates; }
+
+private:
+  // hop of currency towards some destination: next currency and the rate
+  // used, so the walk needs one load per hop
+  struct Cell
+  {
+    int32_t rateId;
+    static const int32_t norate{0};
+    uint16_t nextCur;
+    static const uint16_t nocur{std::numeric_limits<uint16_t>::max()};
+    Cell()
+      : rateId(norate)
+      , nextCur(nocur)
+    {}
+  };
+  struct Edge
+  {
+    uint16_t from;
+    int32_t rateId;
+  };
+  // log-weight improvements below this are rounding noise,
+  // so consistent cross rates don't look like arbitrage
+  static constexpr double epsilon = 1e-12;
+
+  // 'edgeRates' is sized for all rate ids
+  template <class Vector>
+  void evaluateRates(Vector& edgeRates)
+  {
+    for (size_t id = 1; id < rates.size(); ++id)
+      edgeRates[id] = rates.get(id);
+  }
+
+  // destination-major: hops of all currencies towards 'to' are one row
+  Cell& cell(size_t from, size_t to) { return mTable[to * mCurCount + from]; }
+
+  bool hop(CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+  {
+    const Cell& hopCell = cell(from, to);
+    if (hopCell.nextCur == Cell::nocur)
+      return false;
+    nextCur = hopCell.nextCur;
+    rateId = hopCell.rateId;
+    return true;
+  }
+
+  // scratch comes from mArena
+  void computePaths(const double* edgeRates)
+  {
+    // weight of every incoming edge, infinite if rate is unavailable
+    ArenaVector<double> weights(mIncoming.size(), ArenaAllocator<double>(mArena));
+    for (size_t e = 0; e < mIncoming.size(); ++e)
+    {
+      const double rate = edgeRates[std::abs(mIncoming[e].rateId)];
+      const bool usable = rate > 0 && std::isfinite(rate);
+      const double weight = mIncoming[e].rateId > 0 ? -std::log(rate) : std::log(rate);
+      weights[e] = usable ? weight : std::numeric_limits<double>::infinity();
+    }
+    mTable.assign(mCurCount * mCurCount, Cell());
+    mArbitrageCycle.clear();
+    if (!searchAll(weights))
+    {
+      // no best paths under arbitrage: same search, every usable edge weighs 1
+      for (auto& weight : weights)
+        if (weight != std::numeric_limits<double>::infinity())
+          weight = 1.0;
+      mTable.assign(mCurCount * mCurCount, Cell());
+      searchAll(weights);
+    }
+  }
+
+  // runs search towards every destination across threads,
+  // false if an arbitrage loop was found
+  bool searchAll(const ArenaVector<double>& weights)
+  {
+    unsigned threadCount = mThreadCount ? mThreadCount : std::thread::hardware_concurrency();
+    threadCount = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadCount, mCurCount)));
+    std::atomic<size_t> nextDest{0};
+    std::atomic<bool> arbitrage{false};
+    std::mutex cycleMutex;
+    // arena isn't thread-safe, per thread scratch is taken upfront
+    ArenaVector<Search> searches{ArenaAllocator<Search>(mArena)};
+    searches.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i)
+      searches.emplace_back(mCurCount, mArena);
+    auto searchDestinations = [&](unsigned thread)
+    {
+      Search& search = searches[thread];
+      for (size_t dest = nextDest++; dest < mCurCount && !arbitrage; dest = nextDest++)
+      {
+        if (searchTo(static_cast<uint16_t>(dest), weights, search))
+          continue;
+        std::lock_guard<std::mutex> lock(cycleMutex);
+        if (!arbitrage.exchange(true))
+          mArbitrageCycle.assign(search.cycle.begin(), search.cycle.end());
+      }
+    };
+    ArenaVector<std::thread> threads{ArenaAllocator<std::thread>(mArena)};
+    threads.reserve(threadCount);
+    for (unsigned i = 1; i < threadCount; ++i)
+      threads.emplace_back(searchDestinations, i);
+    searchDestinations(0);
+    for (auto& thread : threads)
+      thread.join();
+    return !arbitrage;
+  }
+
+  // per thread scratch of searchTo()
+  struct Search
+  {
+    Search(size_t curCount, InitArena& arena)
+      : distance(curCount, ArenaAllocator<double>(arena))
+      , relaxations(curCount, ArenaAllocator<uint32_t>(arena))
+      , queued(curCount, ArenaAllocator<uint8_t>(arena))
+      , queue(curCount + 1, ArenaAllocator<uint16_t>(arena))
+      , cycle(ArenaAllocator<CurId>(arena))
+    {}
+    ArenaVector<double> distance;
+    ArenaVector<uint32_t> relaxations;
+    ArenaVector<uint8_t> queued;
+    // ring buffer, every currency is queued at most once at a time
+    ArenaVector<uint16_t> queue;
+    ArenaVector<CurId> cycle;
+  };
+
+  // SPFA towards 'dest' filling its table row, false on negative cycle
+  bool searchTo(uint16_t dest, const ArenaVector<double>& weights, Search& search)
+  {
+    const size_t curCount = mCurCount;
+    std::fill(search.distance.begin(), search.distance.end(), std::numeric_limits<double>::infinity());
+    std::fill(search.relaxations.begin(), search.relaxations.end(), 0);
+    std::fill(search.queued.begin(), search.queued.end(), 0);
+    Cell* row = &mTable[dest * curCount];
+    search.distance[dest] = 0;
+    size_t head = 0;
+    size_t tail = 0;
+    search.queue[tail++] = dest;
+    search.queued[dest] = 1;
+    while (head != tail)
+    {
+      const uint16_t cur = search.queue[head];
+      head = head + 1 == search.queue.size() ? 0 : head + 1;
+      search.queued[cur] = 0;
+      const double curDistance = search.distance[cur];
+      for (size_t e = mOffsets[cur]; e < mOffsets[cur + 1]; ++e)
+      {
+        const uint16_t prev = mIncoming[e].from;
+        const double newDistance = curDistance + weights[e];
+        if (prev == dest || !(newDistance < search.distance[prev] - epsilon))
+          continue;
+        search.distance[prev] = newDistance;
+        row[prev].nextCur = cur;
+        row[prev].rateId = mIncoming[e].rateId;
+        // shortest path has at most N - 1 edges
+        if (++search.relaxations[prev] >= curCount)
+        {
+          extractCycle(row, prev, search.cycle);
+          return false;
+        }
+        if (!search.queued[prev])
+        {
+          search.queued[prev] = 1;
+          search.queue[tail] = prev;
+          tail = tail + 1 == search.queue.size() ? 0 : tail + 1;
+        }
+      }
+    }
+    return true;
+  }
+
+  // cur is relaxed too often, so it's on a negative cycle or leads to one:
+  // following hops N times surely ends up inside the cycle
+  void extractCycle(const Cell* row, uint16_t cur, ArenaVector<CurId>& cycle)
+  {
+    for (size_t i = 0; i < mCurCount && row[cur].nextCur != Cell::nocur; ++i)
+      cur = row[cur].nextCur;
+    cycle.clear();
+    const uint16_t start = cur;
+    do
+    {
+      cycle.push_back(cur);
+      cur = row[cur].nextCur;
+    } while (cur != start && cur != Cell::nocur && cycle.size() <= mCurCount);
+  }
+
+  // product of rates along the path, 0 if there is no path
+  double pathRate(CurId from, CurId to)
+  {
+    if (from >= mCurCount || to >= mCurCount || cell(from, to).nextCur == Cell::nocur)
+      return 0.0d;
+    double totalRate = 1.0d;
+    for (CurId cur = from; cur != to; )
+    {
+      const Cell& hopCell = cell(cur, to);
+      const int32_t rateId = hopCell.rateId;
+      if (rateId > 0)
+      {
+        totalRate *= rates.get(rateId);
+      }
+      else
+      {
+        double rate = rates.get(-rateId);
+        if (rate == 0)
+          totalRate = 0;
+        else
+          totalRate /= rate;
+      }
+      cur = hopCell.nextCur;
+    }
+    return totalRate;
+  }
+
+  size_t mCurCount{0};
+  const size_t mMinCurCount;
+  unsigned mThreadCount{1};
+  std::vector<Cell> mTable;
+  std::vector<size_t> mOffsets;
+  std::vector<Edge> mIncoming;
+  std::vector<CurId> mArbitrageCycle;
+  RateSource rates;
+  uint64_t mTopology{emptyTopology};
+  // scratch of path computation
+  InitArena mArena;
+  RateSnapshot mSnapshot;
+  bool mUseSnapshot{false};
+};
+
+using BestRateConverter = BasicBestRateConverter<FunctionRates>;
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "converter.h"
+
+// Thread-safe front end over an IConverter engine.
+// Readers convert against an immutable generation (composite rate snapshot
+// of one engine) and never block: they only retry if a writer flips
+// generations between picking a slot and pinning it.
+// Writers (init/refreshRates) are serialized, build the next generation
+// aside while readers keep using the current one, and free a generation
+// only after its last reader unpinned it.
+class ConcurrentConverter
+{
+public:
+  explicit ConcurrentConverter(const ConverterFactory& factory)
+    : mFactory(factory)
+  {
+    mSlots[0].generation = std::make_unique<RateSnapshot>();
+  }
+
+  // builds an engine for new rate graph and publishes its first snapshot,
+  // path computation runs outside of writer lock
+  uint64_t init(const std::vector<ConvertRate>& rates)
+  {
+    std::unique_ptr<IConverter> engine = mFactory.create();
+    engine->init(rates);
+    engine->refreshRates();
+    std::lock_guard<std::mutex> lock(mWriterMutex);
+    mEngine = std::move(engine);
+    return publish();
+  }
+
+  // evaluates rates of current graph once and publishes them
+  uint64_t refreshRates()
+  {
+    std::lock_guard<std::mutex> lock(mWriterMutex);
+    if (!mEngine)
+      return 0;
+    mEngine->refreshRates();
+    return publish();
+  }
+
+  // lock-free, 'epoch' receives epoch of generation the value was priced against
+  double convert(double value, CurId from, CurId to, uint64_t& epoch) const
+  {
+    return read([&](const RateSnapshot& generation)
+    {
+      epoch = generation.epoch;
+      return value * generation.rate(from, to);
+    });
+  }
+
+  double convert(double value, CurId from, CurId to) const
+  {
+    uint64_t epoch;
+    return convert(value, from, to, epoch);
+  }
+
+  // whole batch is priced against one generation, returns its epoch
+  uint64_t convertBatch(const double* values, const CurId* from, const CurId* to,
+                        double* out, size_t count) const
+  {
+    return read([&](const RateSnapshot& generation)
+    {
+      for (size_t i = 0; i < count; ++i)
+        out[i] = values[i] * generation.rate(from[i], to[i]);
+      return generation.epoch;
+    });
+  }
+
+  // epoch of currently published generation, 0 before first init()
+  uint64_t epoch() const
+  {
+    return read([](const RateSnapshot& generation) { return generation.epoch; });
+  }
+
+private:
+  struct alignas(64) Slot
+  {
+    std::atomic<uint32_t> readers{0};
+    std::unique_ptr<RateSnapshot> generation;
+  };
+
+  // pins current slot for the duration of 'fn'
+  template <class ReadFn>
+  auto read(ReadFn fn) const -> decltype(fn(std::declval<const RateSnapshot&>()))
+  {
+    for (;;)
+    {
+      const uint32_t current = mCurrent.load();
+      Slot& slot = mSlots[current];
+      slot.readers.fetch_add(1);
+      // slot could have become spare before we pinned it, writer may be
+      // replacing its generation right now
+      if (mCurrent.load() != current)
+      {
+        slot.readers.fetch_sub(1);
+        continue;
+      }
+      struct Unpin
+      {
+        Slot& slot;
+        ~Unpin() { slot.readers.fetch_sub(1); }
+      } unpin{slot};
+      return fn(*slot.generation);
+    }
+  }
+
+  // copies engine snapshot into spare slot and makes it current,
+  // must be called under mWriterMutex
+  uint64_t publish()
+  {
+    auto next = std::make_unique<RateSnapshot>(mEngine->snapshot());
+    next->epoch = ++mEpoch;
+    const uint32_t spare = mCurrent.load() ^ 1;
+    // readers still pinning the generation being replaced finish quickly
+    while (mSlots[spare].readers.load() != 0)
+      std::this_thread::yield();
+    mSlots[spare].generation = std::move(next);
+    mCurrent.store(spare);
+    return mEpoch;
+  }
+
+  const ConverterFactory mFactory;
+  mutable Slot mSlots[2];
+  std::atomic<uint32_t> mCurrent{0};
+  std::mutex mWriterMutex;
+  std::unique_ptr<IConverter> mEngine;
+  uint64_t mEpoch{0};
+};
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "converter.h"
+
+// Record formats of ConversionPipeline:
+// CSV - "amount,from,to" lines in, one converted amount per line out,
+// blank lines are skipped, ids are any 64-bit ones;
+// BINARY - BinaryRecord in, one double per record out, host byte order
+enum class RecordFormat { CSV, BINARY };
+
+struct BinaryRecord
+{
+  double amount;
+  uint32_t from;
+  uint32_t to;
+};
+static_assert(sizeof(BinaryRecord) == 16, "binary records are 16 bytes without padding");
+
+// Converts blocks of records with a pool of threads. A block is split into
+// chunks, workers parse a chunk into arrays of a buffer slot and convert
+// it with one convertBatch() call, the calling thread writes finished
+// chunks in input order. Slot buffers are kept between blocks, so after
+// warm-up there is no allocation per record or per chunk.
+// convertBatch() of the engine runs in several threads at once, so the
+// engine must not change while run() works, e.g. after refreshRates()
+class ConversionPipeline
+{
+public:
+  using WriteFn = std::function<void(const char* data, size_t size)>;
+
+  // 'threadCount' 0 - one worker per hardware thread; 'chunkRecords' -
+  // records per chunk, CSV chunks are cut at about 16 bytes per record
+  ConversionPipeline(IConverter& engine, RecordFormat format, unsigned threadCount = 0,
+                     size_t chunkRecords = 1 << 16)
+    : mEngine(engine)
+    , mFormat(format)
+    , mThreadCount(threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency()))
+    , mChunkBytes(std::max<size_t>(1, chunkRecords) * sizeof(BinaryRecord))
+    , mSlots(2 * mThreadCount)
+  {
+  }
+
+  // converts records of 'data' passing output to 'write', returns bytes
+  // consumed: unless 'last', a trailing partial record or line is left for
+  // the next block, which must start with it. Throws std::runtime_error on
+  // a malformed record, output written before it is valid
+  size_t run(const char* data, size_t size, bool last, WriteFn write)
+  {
+    size_t end = size;
+    if (mFormat == RecordFormat::BINARY)
+    {
+      end = size / sizeof(BinaryRecord) * sizeof(BinaryRecord);
+      if (last && end != size)
+        throw std::runtime_error("ConversionPipeline: truncated binary record at the end");
+    }
+    else if (!last)
+    {
+      while (end && data[end - 1] != '\n')
+        --end;
+    }
+    const size_t chunkCount = (end + mChunkBytes - 1) / mChunkBytes;
+    if (chunkCount == 0)
+      return end;
+
+    for (size_t i = 0; i < mSlots.size(); ++i)
+    {
+      mSlots[i].ready = nochunk;
+      mSlots[i].free = i;
+    }
+    mFailed = false;
+    mError = nullptr;
+    std::atomic<size_t> nextChunk{0};
+    auto work = [&]()
+    {
+      for (;;)
+      {
+        const size_t chunk = nextChunk.fetch_add(1);
+        if (chunk >= chunkCount)
+          return;
+        Slot& slot = mSlots[chunk % mSlots.size()];
+        {
+          std::unique_lock<std::mutex> lock(mMutex);
+          mChanged.wait(lock, [&]() { return slot.free == chunk || mFailed; });
+          if (mFailed)
+            return;
+        }
+        try
+        {
+          convertChunk(data, boundary(data, end, chunk), boundary(data, end, chunk + 1), slot);
+        }
+        catch (...)
+        {
+          fail(std::current_exception());
+          return;
+        }
+        {
+          std::lock_guard<std::mutex> lock(mMutex);
+          slot.ready = chunk;
+        }
+        mChanged.notify_all();
+      }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(mThreadCount);
+    for (unsigned i = 0; i < mThreadCount; ++i)
+      workers.emplace_back(work);
+
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+      Slot& slot = mSlots[chunk % mSlots.size()];
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mChanged.wait(lock, [&]() { return slot.ready == chunk || mFailed; });
+        if (mFailed)
+          break;
+      }
+      try
+      {
+        if (mFormat == RecordFormat::BINARY)
+          write(reinterpret_cast<const char*>(slot.out.data()), slot.out.size() * sizeof(double));
+        else
+          write(slot.text.data(), slot.text.size());
+        mRecords += slot.out.size();
+      }
+      catch (...)
+      {
+        fail(std::current_exception());
+        break;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        slot.ready = nochunk;
+        slot.free = chunk + mSlots.size();
+      }
+      mChanged.notify_all();
+    }
+    for (auto& worker : workers)
+      worker.join();
+    if (mError)
+      std::rethrow_exception(mError);
+    return end;
+  }
+
+  // records written so far
+  uint64_t records() const { return mRecords; }
+
+private:
+  static const size_t nochunk{std::numeric_limits<size_t>::max()};
+
+  // parsed chunk and its output
+  struct Slot
+  {
+    std::vector<double> values;
+    std::vector<CurId> from;
+    std::vector<CurId> to;
+    std::vector<double> out;
+    std::vector<char> text;
+    // chunk whose output is ready to write
+    size_t ready{nochunk};
+    // chunk allowed to take the slot, previous one is written
+    size_t free{0};
+  };
+
+  void fail(std::exception_ptr error)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (!mError)
+        mError = error;
+      mFailed = true;
+    }
+    mChanged.notify_all();
+  }
+
+  // start of chunk 'chunk': binary chunks are fixed, CSV chunk starts after
+  // the first line end at or past its nominal offset
+  size_t boundary(const char* data, size_t end, size_t chunk) const
+  {
+    const size_t offset = std::min(end, chunk * mChunkBytes);
+    if (mFormat == RecordFormat::BINARY || offset == 0 || offset == end)
+      return offset;
+    const void* newline = std::memchr(data + offset - 1, '\n', end - offset + 1);
+    return newline ? static_cast<const char*>(newline) - data + 1 : end;
+  }
+
+  void convertChunk(const char* data, size_t begin, size_t end, Slot& slot)
+  {
+    slot.values.clear();
+    slot.from.clear();
+    slot.to.clear();
+    if (mFormat == RecordFormat::BINARY)
+    {
+      for (size_t offset = begin; offset < end; offset += sizeof(BinaryRecord))
+      {
+        BinaryRecord record;
+        std::memcpy(&record, data + offset, sizeof(record));
+        slot.values.push_back(record.amount);
+        slot.from.push_back(record.from);
+        slot.to.push_back(record.to);
+      }
+    }
+    else
+    {
+      parseLines(data, begin, end, slot);
+    }
+    slot.out.resize(slot.values.size());
+    mEngine.convertBatch(slot.values.data(), slot.from.data(), slot.to.data(), slot.out.data(),
+                         slot.out.size());
+    if (mFormat == RecordFormat::CSV)
+    {
+      slot.text.clear();
+      for (const double value : slot.out)
+      {
+        const size_t used = slot.text.size();
+        slot.text.resize(used + maxValueText);
+        const int length = std::snprintf(&slot.text[used], maxValueText, "%.17g\n", value);
+        slot.text.resize(used + static_cast<size_t>(length));
+      }
+    }
+  }
+
+  // "%.17g\n" of any double with the terminating 0
+  static const size_t maxValueText{32};
+
+  static void parseLines(const char* data, size_t begin, size_t end, Slot& slot)
+  {
+    const char* p = data + begin;
+    const char* const stop = data + end;
+    while (p != stop)
+    {
+      const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', stop - p));
+      const char* next = lineEnd ? lineEnd + 1 : stop;
+      if (!lineEnd)
+        lineEnd = stop;
+      if (lineEnd != p && lineEnd[-1] == '\r')
+        --lineEnd;
+      if (lineEnd != p)
+      {
+        const char* field = p;
+        double amount;
+        CurId from, to;
+        if (!parseAmount(field, lineEnd, amount) || !parseId(field, lineEnd, from)
+            || !parseId(field, lineEnd, to) || field != lineEnd)
+          throw std::runtime_error("ConversionPipeline: bad record at byte " + std::to_string(p - data));
+        slot.values.push_back(amount);
+        slot.from.push_back(from);
+        slot.to.push_back(to);
+      }
+      p = next;
+    }
+  }
+
+  // amount up to ',', via strtod on a terminated copy: mapped input has
+  // no terminator of its own
+  static bool parseAmount(const char*& p, const char* end, double& amount)
+  {
+    const char* comma = static_cast<const char*>(std::memchr(p, ',', end - p));
+    if (!comma || comma == p || comma - p >= 64)
+      return false;
+    char text[64];
+    std::memcpy(text, p, comma - p);
+    text[comma - p] = 0;
+    char* parsed;
+    amount = std::strtod(text, &parsed);
+    p = comma;
+    return parsed != text && *parsed == 0;
+  }
+
+  // ',' then a decimal id below 2^32
+  static bool parseId(const char*& p, const char* end, CurId& id)
+  {
+    if (p == end || *p != ',')
+      return false;
+    ++p;
+    const char* digits = p;
+    id = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p)
+    {
+      const CurId digit = static_cast<CurId>(*p - '0');
+      if (id > (std::numeric_limits<CurId>::max() - digit) / 10)
+        return false;
+      id = id * 10 + digit;
+    }
+    return p != digits;
+  }
+
+  IConverter& mEngine;
+  const RecordFormat mFormat;
+  const unsigned mThreadCount;
+  const size_t mChunkBytes;
+  std::vector<Slot> mSlots;
+  std::mutex mMutex;
+  std::condition_variable mChanged;
+  bool mFailed{false};
+  std::exception_ptr mError;
+  uint64_t mRecords{0};
+};
+
+// Rates file of the converter CLI: "from,to,rate" lines with numeric
+// currency ids, any 64-bit ones, '#' starts a comment line. Rates are
+// constants
+inline std::vector<ConvertRate> loadRates(const std::string& fileName)
+{
+  std::ifstream in(fileName);
+  if (!in)
+    throw std::runtime_error("loadRates: can't open " + fileName);
+  std::vector<ConvertRate> rates;
+  std::string line;
+  for (size_t lineNumber = 1; std::getline(in, line); ++lineNumber)
+  {
+    if (line.empty() || line[0] == '#' || line == "\r")
+      continue;
+    std::istringstream fields(line);
+    unsigned long long from, to;
+    double value;
+    char comma1, comma2;
+    if (!(fields >> from >> comma1 >> to >> comma2 >> value) || comma1 != ',' || comma2 != ',')
+      throw std::runtime_error("loadRates: " + fileName + ":" + std::to_string(lineNumber) + ": bad rate");
+    rates.push_back({static_cast<CurId>(from), static_cast<CurId>(to), [value]() { return value; }});
+  }
+  return rates;
+}
+
+// writes all of 'data' to 'fd', throws std::system_error
+inline void writeAll(int fd, const char* data, size_t size)
+{
+  while (size)
+  {
+    const ssize_t written = ::write(fd, data, size);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      throw std::system_error(errno, std::generic_category(), "can't write output");
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
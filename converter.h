@@ -0,0 +1,2240 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "converter_stats.h"
+
+// 0..N-1, where universe size N is max CurId in the rate set + 1 or
+// currency count given to engine constructor, whichever is bigger
+using CurId = uint64_t;
+using RateFn = std::function<double()>; // Return 0 if rate is not available;
+
+struct ConvertRate
+{
+  CurId  from;
+  CurId  to;
+  RateFn rateFn;
+};
+
+// Composite conversion rates of all currency pairs taken at one moment
+struct RateSnapshot
+{
+  // number of refreshRates() calls that produced this snapshot, 0 - none yet
+  uint64_t epoch{0};
+  size_t curCount{0};
+  // row-major curCount x curCount, 0 if pair can't be converted
+  std::vector<double> rates;
+
+  double rate(CurId from, CurId to) const
+  {
+    if (from >= curCount || to >= curCount)
+      return 0.0;
+    return rates[from * curCount + to];
+  }
+};
+
+// Monotonic buffer for data living through one path computation: allocation
+// is a pointer bump, deallocation does nothing. reset() makes all chunks
+// reusable for the next init(), they are never given back, so repeated
+// inits of similar graphs stop hitting the heap after the first one
+class InitArena
+{
+public:
+  void* allocate(size_t bytes, size_t alignment)
+  {
+    for (;; ++mChunk, mOffset = 0)
+    {
+      if (mChunk == mChunks.size())
+      {
+        const size_t last = mChunks.empty() ? 0 : mChunks.back().size;
+        const size_t size = std::max({bytes + alignment, 2 * last, minChunkSize});
+        mChunks.push_back(Chunk{std::unique_ptr<char[]>(new char[size]), size});
+      }
+      const Chunk& chunk = mChunks[mChunk];
+      const uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data.get());
+      const size_t offset = ((base + mOffset + alignment - 1) & ~(alignment - 1)) - base;
+      if (offset + bytes <= chunk.size)
+      {
+        mOffset = offset + bytes;
+        return chunk.data.get() + offset;
+      }
+    }
+  }
+
+  // everything allocated so far must be dead by now
+  void reset()
+  {
+    mChunk = 0;
+    mOffset = 0;
+  }
+
+  // bytes held, used or not
+  size_t capacity() const
+  {
+    size_t bytes = 0;
+    for (const auto& chunk : mChunks)
+      bytes += chunk.size;
+    return bytes;
+  }
+
+private:
+  struct Chunk
+  {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+  static const size_t minChunkSize = 64 * 1024;
+  std::vector<Chunk> mChunks;
+  size_t mChunk{0};
+  size_t mOffset{0};
+};
+
+// STL allocator drawing from InitArena
+template <class T>
+class ArenaAllocator
+{
+public:
+  using value_type = T;
+  explicit ArenaAllocator(InitArena& arena) : mArena(&arena) {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : mArena(other.arena()) {}
+
+  T* allocate(size_t count) { return static_cast<T*>(mArena->allocate(count * sizeof(T), alignof(T))); }
+  void deallocate(T*, size_t) {}
+  InitArena* arena() const { return mArena; }
+
+  template <class U>
+  bool operator==(const ArenaAllocator<U>& other) const { return mArena == other.arena(); }
+  template <class U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return mArena != other.arena(); }
+
+private:
+  InitArena* mArena;
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Path of every convertible pair as a run of signed rate ids (negative -
+// inverse rate) in one arena, so conversion is a linear scan instead of
+// hop by hop table walk. Takes O(N^2) spans plus total length of all paths
+class FlatPaths
+{
+public:
+  // hop(from, to, nextCur, rateId) as for IConverter::composeRates
+  template <class HopFn>
+  void build(size_t curCount, HopFn hop)
+  {
+    mCurCount = curCount;
+    mSpans.assign(curCount * curCount, Span{nopath, 0});
+    mRateIds.clear();
+    for (CurId from = 0; from < curCount; ++from)
+    {
+      for (CurId to = 0; to < curCount; ++to)
+      {
+        CurId nextCur;
+        int32_t rateId;
+        if (!hop(from, to, nextCur, rateId))
+          continue;
+        const size_t offset = mRateIds.size();
+        for (CurId cur = from; cur != to; cur = nextCur)
+        {
+          hop(cur, to, nextCur, rateId);
+          mRateIds.push_back(rateId);
+        }
+        if (mRateIds.size() >= nopath)
+          throw std::length_error("FlatPaths: paths don't fit into 32-bit offsets");
+        mSpans[from * curCount + to] = Span{static_cast<uint32_t>(offset),
+                                            static_cast<uint32_t>(mRateIds.size() - offset)};
+      }
+    }
+  }
+
+  // releases memory too
+  void clear()
+  {
+    mCurCount = 0;
+    std::vector<Span>().swap(mSpans);
+    std::vector<int32_t>().swap(mRateIds);
+  }
+
+  // product of rates along the path, 0 if there is no path
+  template <class RateSource>
+  double rate(CurId from, CurId to, const RateSource& rates) const
+  {
+    NoStats stats;
+    return rate(from, to, rates, stats);
+  }
+  template <class RateSource, class Stats>
+  double rate(CurId from, CurId to, const RateSource& rates, Stats& stats) const
+  {
+    if (from >= mCurCount || to >= mCurCount)
+    {
+      stats.recordUnreachable();
+      return 0.0;
+    }
+    const Span span = mSpans[from * mCurCount + to];
+    if (span.offset == nopath)
+    {
+      stats.recordUnreachable();
+      return 0.0;
+    }
+    bool zeroRate = false;
+    double totalRate = 1.0;
+    const int32_t* rateId = mRateIds.data() + span.offset;
+    for (const int32_t* end = rateId + span.length; rateId != end; ++rateId)
+    {
+      if (*rateId > 0)
+      {
+        totalRate *= rates.get(*rateId);
+      }
+      else
+      {
+        double rate = rates.get(-*rateId);
+        if (rate == 0)
+        {
+          totalRate = 0;
+          zeroRate = true;
+        }
+        else
+          totalRate /= rate;
+      }
+    }
+    stats.recordPath(span.length, zeroRate);
+    return totalRate;
+  }
+
+  size_t memoryUsage() const
+  {
+    return mSpans.capacity() * sizeof(Span) + mRateIds.capacity() * sizeof(int32_t);
+  }
+
+private:
+  struct Span
+  {
+    uint32_t offset;
+    uint32_t length;
+  };
+  static const uint32_t nopath{std::numeric_limits<uint32_t>::max()};
+  size_t mCurCount{0};
+  std::vector<Span> mSpans;
+  std::vector<int32_t> mRateIds;
+};
+
+// Reverse index from rates to composite rates of a RateSnapshot that use
+// them, for recomposing only those pairs after a rate changes. Paths of all
+// pairs (x, to) form a tree of first hops rooted at 'to'; each tree is kept
+// in preorder, so a subtree is a range of positions. Rate 'id' lists tree
+// positions whose link to the parent is that rate: when it changes, pairs
+// of the subtrees below those links are recomposed from their parents in
+// O(1) each. Takes 12 bytes per convertible pair
+class RateDependents
+{
+public:
+  // hop(from, to, nextCur, rateId) as for IConverter::composeRates,
+  // rate ids are below 'rateCount' + 1
+  template <class HopFn>
+  void build(size_t curCount, size_t rateCount, HopFn hop)
+  {
+    if (curCount && curCount > std::numeric_limits<uint32_t>::max() / curCount)
+      throw std::length_error("RateDependents: pairs don't fit into 32-bit positions");
+    mCurCount = curCount;
+    mBuilt = true;
+    mOrder.assign(curCount * curCount, 0);
+    mSubtreeSize.assign(curCount * curCount, 0);
+    mLinkOffsets.assign(rateCount + 2, 0);
+    // rate id of the parent link at every tree position, 0 - none
+    std::vector<uint32_t> linkIds(curCount * curCount, 0);
+    std::vector<CurId> parent(curCount);
+    // rate id of the link to the parent
+    std::vector<uint32_t> parentRate(curCount);
+    std::vector<uint32_t> childOffsets(curCount + 1);
+    std::vector<uint32_t> filledChildren(curCount);
+    std::vector<uint32_t> children(curCount);
+    std::vector<uint32_t> position(curCount);
+    std::vector<uint32_t> stack;
+    stack.reserve(curCount);
+    for (CurId to = 0; to < curCount; ++to)
+    {
+      // children of every currency in the tree of 'to'
+      std::fill(childOffsets.begin(), childOffsets.end(), 0);
+      for (CurId from = 0; from < curCount; ++from)
+      {
+        CurId nextCur = curCount;
+        int32_t rateId = 0;
+        parent[from] = from != to && hop(from, to, nextCur, rateId) ? nextCur : curCount;
+        parentRate[from] = static_cast<uint32_t>(rateId < 0 ? -rateId : rateId);
+        if (parent[from] != curCount)
+          ++childOffsets[parent[from] + 1];
+      }
+      for (CurId cur = 0; cur < curCount; ++cur)
+        childOffsets[cur + 1] += childOffsets[cur];
+      std::copy(childOffsets.begin(), childOffsets.end() - 1, filledChildren.begin());
+      for (CurId from = 0; from < curCount; ++from)
+        if (parent[from] != curCount)
+          children[filledChildren[parent[from]]++] = static_cast<uint32_t>(from);
+
+      // preorder from the root, a currency whose hops never reach 'to'
+      // isn't visited and keeps its composite rate
+      uint32_t* order = mOrder.data() + to * curCount;
+      uint32_t* subtreeSize = mSubtreeSize.data() + to * curCount;
+      uint32_t* links = linkIds.data() + to * curCount;
+      uint32_t visited = 0;
+      stack.push_back(static_cast<uint32_t>(to));
+      while (!stack.empty())
+      {
+        const uint32_t cur = stack.back();
+        stack.pop_back();
+        position[cur] = visited;
+        order[visited] = cur;
+        subtreeSize[visited] = 1;
+        if (cur != to)
+        {
+          links[visited] = parentRate[cur];
+          ++mLinkOffsets[links[visited] + 1];
+        }
+        ++visited;
+        for (uint32_t i = childOffsets[cur]; i < childOffsets[cur + 1]; ++i)
+          stack.push_back(children[i]);
+      }
+      // every position after the root adds its subtree to the parent's
+      for (uint32_t i = visited; i-- > 1;)
+        subtreeSize[position[parent[order[i]]]] += subtreeSize[i];
+    }
+
+    for (size_t id = 0; id + 1 < mLinkOffsets.size(); ++id)
+      mLinkOffsets[id + 1] += mLinkOffsets[id];
+    mLinks.resize(mLinkOffsets.back());
+    std::vector<uint32_t> filled(mLinkOffsets.begin(), mLinkOffsets.end() - 1);
+    for (size_t cell = 0; cell < linkIds.size(); ++cell)
+      if (linkIds[cell])
+        mLinks[filled[linkIds[cell]]++] = static_cast<uint32_t>(cell);
+  }
+
+  // releases memory too
+  void clear()
+  {
+    mCurCount = 0;
+    mBuilt = false;
+    std::vector<uint32_t>().swap(mOrder);
+    std::vector<uint32_t>().swap(mSubtreeSize);
+    std::vector<uint32_t>().swap(mLinkOffsets);
+    std::vector<uint32_t>().swap(mLinks);
+  }
+
+  bool built() const { return mBuilt; }
+
+  // recomposes composite rates of 'snapshot' depending on rates 'ids',
+  // whose new values are already in 'edgeRates', exactly as composeRates
+  // would; returns pairs recomposed
+  template <class HopFn>
+  size_t update(RateSnapshot& snapshot, const std::vector<double>& edgeRates,
+                const std::vector<int32_t>& ids, HopFn hop) const
+  {
+    size_t recomposed = 0;
+    for (const int32_t id : ids)
+    {
+      for (uint32_t link = mLinkOffsets[id]; link < mLinkOffsets[id + 1]; ++link)
+      {
+        const CurId to = mLinks[link] / mCurCount;
+        const uint32_t first = mLinks[link] % mCurCount;
+        const uint32_t* order = mOrder.data() + to * mCurCount;
+        const uint32_t last = first + mSubtreeSize[to * mCurCount + first];
+        // parents come first in preorder, so they are recomposed already
+        for (uint32_t i = first; i < last; ++i)
+        {
+          const CurId cur = order[i];
+          CurId nextCur = to;
+          int32_t rateId = 0;
+          // a tree position always has its hop, keep the rate otherwise
+          if (!hop(cur, to, nextCur, rateId))
+            continue;
+          const double nextRate = nextCur == to ? 1.0 : snapshot.rates[nextCur * mCurCount + to];
+          double rate;
+          if (rateId > 0)
+          {
+            rate = nextRate * edgeRates[rateId];
+          }
+          else
+          {
+            const double edgeRate = edgeRates[-rateId];
+            rate = edgeRate == 0 ? 0.0 : nextRate / edgeRate;
+          }
+          snapshot.rates[cur * mCurCount + to] = rate;
+        }
+        recomposed += last - first;
+      }
+    }
+    return recomposed;
+  }
+
+  size_t memoryUsage() const
+  {
+    return (mOrder.capacity() + mSubtreeSize.capacity() + mLinkOffsets.capacity() + mLinks.capacity())
+           * sizeof(uint32_t);
+  }
+
+private:
+  size_t mCurCount{0};
+  bool mBuilt{false};
+  // row 'to': currencies of the tree of 'to' in preorder, root first
+  std::vector<uint32_t> mOrder;
+  // row 'to': size of the subtree at each position
+  std::vector<uint32_t> mSubtreeSize;
+  // links of rate 'id' are mLinks[mLinkOffsets[id]] .. mLinks[mLinkOffsets[id + 1] - 1],
+  // each is to * curCount + position
+  std::vector<uint32_t> mLinkOffsets;
+  std::vector<uint32_t> mLinks;
+};
+
+// Computed paths as written by savePaths() of the engines and mapped as is
+// by MappedConverter: this header, padding up to 'cellsOffset', then
+// curCount x curCount row-major cells. Host byte order; 'signature' reads
+// differently on a host of other endianness
+struct PathFileHeader
+{
+  static const uint64_t expectedSignature{0x5348544150435221ull}; // "!RCPATHS"
+  static const uint32_t currentVersion{1};
+  uint64_t signature;
+  uint32_t version;
+  uint32_t cellSize;
+  uint64_t curCount;
+  // ids 1..rateCount are rates given to init() in order
+  uint64_t rateCount;
+  // topologyHash() of those rates
+  uint64_t topology;
+  uint64_t cellsOffset;
+};
+
+// first hop of the path and its rate id, negative - inverse rate
+struct PathFileCell
+{
+  int32_t rateId;
+  uint16_t nextCur;
+  static const uint16_t nocur{std::numeric_limits<uint16_t>::max()};
+  uint16_t reserved;
+};
+
+// FNV-1a of rate endpoints in id order, identifies the rate graph paths
+// were computed for
+const uint64_t emptyTopology = 0xCBF29CE484222325ull;
+
+// 'hash' extended by one more rate
+inline uint64_t topologyHash(uint64_t hash, const ConvertRate& rate)
+{
+  for (const uint64_t id : {uint64_t(rate.from), uint64_t(rate.to)})
+    for (int byte = 0; byte < 8; ++byte)
+      hash = (hash ^ ((id >> (8 * byte)) & 0xFF)) * 0x100000001B3ull;
+  return hash;
+}
+
+inline uint64_t topologyHash(const std::vector<ConvertRate>& rates)
+{
+  uint64_t hash = emptyTopology;
+  for (const auto& rate : rates)
+    hash = topologyHash(hash, rate);
+  return hash;
+}
+
+class IConverter
+{
+public:
+  // precomputes all optimal pathes to calculate conversion rate between
+  // any currency pair, if such conversion possible
+  virtual void init(const std::vector<ConvertRate>& _rates) =0;
+  virtual double convert(double value, CurId from, CurId to) =0;
+  // out[i] = convert(values[i], from[i], to[i]) for i in [0, count);
+  // 'out' may alias 'values'
+  virtual void convertBatch(const double* values, const CurId* from, const CurId* to,
+                            double* out, size_t count)
+  {
+    for (size_t i = 0; i < count; ++i)
+      out[i] = convert(values[i], from[i], to[i]);
+  }
+  // evaluates every rate function once and caches composite rates of all pairs,
+  // convert() and convertBatch() are served from that cache until next
+  // refreshRates() or init(); returns epoch of the new snapshot
+  virtual uint64_t refreshRates() =0;
+  // last snapshot taken by refreshRates()
+  virtual const RateSnapshot& snapshot() const =0;
+  virtual ~IConverter() {}
+
+protected:
+  // Writes path file (see PathFileHeader) of 'curCount' currencies given
+  // next-hop function hop() as for composeRates. 'rateCount' and
+  // 'topology' describe rates the paths were computed for
+  template <class HopFn>
+  static void writePathFile(std::ostream& out, size_t curCount, size_t rateCount,
+                            uint64_t topology, HopFn hop)
+  {
+    if (curCount > PathFileCell::nocur)
+      throw std::length_error("savePaths: currency id doesn't fit into 16-bit path file index");
+    PathFileHeader header{};
+    header.signature = PathFileHeader::expectedSignature;
+    header.version = PathFileHeader::currentVersion;
+    header.cellSize = sizeof(PathFileCell);
+    header.curCount = curCount;
+    header.rateCount = rateCount;
+    header.topology = topology;
+    // cells start at a cache line, so rows of a mapping are aligned too
+    header.cellsOffset = (sizeof(header) + 63) / 64 * 64;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const char padding[64]{};
+    out.write(padding, header.cellsOffset - sizeof(header));
+    std::vector<PathFileCell> row(curCount);
+    for (CurId from = 0; from < curCount; ++from)
+    {
+      for (CurId to = 0; to < curCount; ++to)
+      {
+        CurId nextCur;
+        int32_t rateId;
+        const bool reachable = hop(from, to, nextCur, rateId);
+        row[to] = reachable ? PathFileCell{rateId, static_cast<uint16_t>(nextCur), 0}
+                            : PathFileCell{0, PathFileCell::nocur, 0};
+      }
+      out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(PathFileCell));
+    }
+  }
+
+  // runs save(std::ostream&) into file 'fileName'
+  template <class SaveFn>
+  static void saveToFile(const std::string& fileName, SaveFn save)
+  {
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    if (!file)
+      throw std::runtime_error("savePaths: can't open " + fileName);
+    save(file);
+    file.close();
+    if (!file)
+      throw std::runtime_error("savePaths: can't write " + fileName);
+  }
+
+  // Batch conversion for engines that can compute total path rate:
+  // each distinct (from, to) pair is resolved once via 'pathRate',
+  // then amounts are scaled in a single branchless pass
+  template <class PathRateFn>
+  static void convertGrouped(const double* values, const CurId* from, const CurId* to,
+                             double* out, size_t count, PathRateFn pathRate)
+  {
+    using CurPair = std::pair<CurId, CurId>;
+    struct CurPairHash
+    {
+      size_t operator()(const CurPair& pair) const
+      {
+        return std::hash<CurId>()(pair.first * 0x9E3779B97F4A7C15ull ^ pair.second);
+      }
+    };
+    std::unordered_map<CurPair, double, CurPairHash> pairRates;
+    std::vector<double> totalRates(count);
+    CurPair lastPair;
+    double lastRate = 0.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      const CurPair pair(from[i], to[i]);
+      // amounts usually come in runs of the same pair
+      if (i == 0 || pair != lastPair)
+      {
+        auto it = pairRates.find(pair);
+        if (it == pairRates.end())
+          it = pairRates.emplace(pair, pathRate(pair.first, pair.second)).first;
+        lastPair = pair;
+        lastRate = it->second;
+      }
+      totalRates[i] = lastRate;
+    }
+    const double* rates = totalRates.data();
+    for (size_t i = 0; i < count; ++i)
+      out[i] = values[i] * rates[i];
+  }
+
+  static void convertSnapshot(const RateSnapshot& snapshot, const double* values,
+                              const CurId* from, const CurId* to, double* out, size_t count)
+  {
+    for (size_t i = 0; i < count; ++i)
+      out[i] = values[i] * snapshot.rate(from[i], to[i]);
+  }
+
+  // Fills 'snapshot' with composite rates of all pairs given next-hop
+  // function hop(from, to, nextCur, rateId), which returns false if 'to'
+  // is unreachable from 'from'. edgeRates[id] is the value of rate 'id'.
+  // Path from 'from' to 'to' is the first hop plus path from 'nextCur' to 'to',
+  // so every path suffix is computed once: O(N^2) total
+  template <class HopFn>
+  static void composeRates(RateSnapshot& snapshot, size_t curCount,
+                           const std::vector<double>& edgeRates, HopFn hop)
+  {
+    snapshot.curCount = curCount;
+    snapshot.rates.assign(curCount * curCount, 0.0);
+    std::vector<double> suffixRate(curCount);
+    std::vector<uint64_t> knownFor(curCount, std::numeric_limits<uint64_t>::max());
+    struct Hop
+    {
+      CurId cur;
+      CurId nextCur;
+      int32_t rateId;
+    };
+    std::vector<Hop> pending;
+    for (CurId to = 0; to < curCount; ++to)
+    {
+      knownFor[to] = to;
+      suffixRate[to] = 1.0;
+      for (CurId from = 0; from < curCount; ++from)
+      {
+        CurId cur = from;
+        CurId nextCur;
+        int32_t rateId;
+        if (!hop(cur, to, nextCur, rateId))
+          continue;
+        if (from == to)
+        {
+          snapshot.rates[from * curCount + to] = 1.0;
+          continue;
+        }
+        while (knownFor[cur] != to)
+        {
+          pending.push_back({cur, nextCur, rateId});
+          cur = nextCur;
+          if (knownFor[cur] != to && !hop(cur, to, nextCur, rateId))
+          {
+            // broken path, treat its tail as not convertible
+            knownFor[cur] = to;
+            suffixRate[cur] = 0.0;
+          }
+        }
+        for (auto it = pending.rbegin(); it != pending.rend(); ++it)
+        {
+          const double nextRate = suffixRate[it->nextCur];
+          double rate;
+          if (it->rateId > 0)
+          {
+            rate = nextRate * edgeRates[it->rateId];
+          }
+          else
+          {
+            const double edgeRate = edgeRates[-it->rateId];
+            rate = edgeRate == 0 ? 0.0 : nextRate / edgeRate;
+          }
+          knownFor[it->cur] = to;
+          suffixRate[it->cur] = rate;
+        }
+        pending.clear();
+        snapshot.rates[from * curCount + to] = suffixRate[from];
+      }
+    }
+  }
+};
+
+// Rate source policies for engines: where value of rate 'id' comes from.
+// Id 0 is reserved for dummy rate, ids of rates passed to init() follow
+// in the same order, addRate() appends
+
+// calls RateFn of the rate on every read
+class FunctionRates
+{
+public:
+  void clear() { mFns.clear(); }
+  void reserve(size_t count) { mFns.reserve(count); }
+  void push_back(const RateFn& fn) { mFns.push_back(fn); }
+  void retire(size_t id) { mFns[id] = []() { return 0.0; }; }
+  double get(size_t id) const { return mFns[id](); }
+  size_t size() const { return mFns.size(); }
+  // values change without notice, so epoch() never moves and engines
+  // can't cache path rates over these (see ConversionCache)
+  static const bool reportsChanges{false};
+  uint64_t epoch() const { return 0; }
+
+private:
+  std::vector<RateFn> mFns;
+};
+
+// Contiguous array of rate values, producers push prices with set() and
+// conversions just load them. RateFn of a rate, if any, only gives its
+// initial value. Slots are independent relaxed atomics: a conversion may
+// see some hops before and others after concurrent set() calls.
+// init()/addRate() must not run concurrently with set(). Every set()
+// moves epoch() forward, stores through slot() don't
+class SlotRates
+{
+public:
+  void clear() { mSlots.clear(); }
+  void reserve(size_t count) { mSlots.reserve(count); }
+  void push_back(const RateFn& fn) { mSlots.emplace_back(fn ? fn() : 0.0); }
+  void retire(size_t id) { set(id, 0.0); }
+  double get(size_t id) const { return mSlots[id].value.load(std::memory_order_relaxed); }
+  size_t size() const { return mSlots.size(); }
+
+  // 'rateIndex' - position of the rate among init() rates and addRate() calls
+  void set(size_t rateIndex, double value)
+  {
+    mSlots[rateIndex + 1].value.store(value, std::memory_order_relaxed);
+    mEpoch.fetch_add(1, std::memory_order_release);
+  }
+  std::atomic<double>& slot(size_t rateIndex) { return mSlots[rateIndex + 1].value; }
+  // number of set() calls so far: values read after epoch() returned E
+  // are at least as new as set() number E
+  static const bool reportsChanges{true};
+  uint64_t epoch() const { return mEpoch.load(std::memory_order_acquire); }
+
+private:
+  struct alignas(sizeof(double)) Slot
+  {
+    std::atomic<double> value;
+    explicit Slot(double _value) : value(_value) {}
+    Slot(const Slot& other) : value(other.value.load(std::memory_order_relaxed)) {}
+  };
+  std::vector<Slot> mSlots;
+  std::atomic<uint64_t> mEpoch{0};
+};
+
+// Direct-mapped cache of path rates for skewed flows where a few pairs
+// take most calls. Entry is tagged with the rate epoch it was computed
+// at: engine's rate source epoch plus a generation the engine bumps on
+// topology changes, any other epoch is a miss. 32-byte entries, two per
+// cache line. Not thread-safe, like convert() of engines
+class ConversionCache
+{
+public:
+  struct Stats
+  {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    double hitRate() const { return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0; }
+  };
+
+  // 'entries' is rounded up to a power of two, 0 turns cache off
+  void resize(size_t entries)
+  {
+    size_t capacity = entries ? 1 : 0;
+    while (capacity < entries)
+      capacity *= 2;
+    mStorage.reset(capacity ? new char[capacity * sizeof(Entry) + lineSize] : nullptr);
+    void* data = mStorage.get();
+    size_t space = capacity * sizeof(Entry) + lineSize;
+    mEntries = capacity ? static_cast<Entry*>(std::align(lineSize, capacity * sizeof(Entry), data, space))
+                        : nullptr;
+    std::uninitialized_fill_n(mEntries, capacity, Entry{});
+    mMask = capacity ? capacity - 1 : 0;
+    mShift = 64;
+    for (size_t bits = capacity; bits > 1; bits /= 2)
+      --mShift;
+    mGeneration = 1;
+  }
+
+  bool enabled() const { return mEntries != nullptr; }
+  size_t size() const { return mEntries ? mMask + 1 : 0; }
+
+  // drops all entries in O(1)
+  void invalidate() { ++mGeneration; }
+
+  // rate of 'from' -> 'to' at 'rateEpoch', 'pathRate' computes it on a miss
+  template <class PathRateFn>
+  double rate(CurId from, CurId to, uint64_t rateEpoch, PathRateFn pathRate)
+  {
+    if (!mEntries)
+      return pathRate(from, to);
+    const uint64_t tag = rateEpoch + mGeneration;
+    Entry& entry = mEntries[slot(from, to)];
+    if (entry.tag == tag && entry.from == from && entry.to == to)
+    {
+      ++mStats.hits;
+      return entry.rate;
+    }
+    ++mStats.misses;
+    entry.rate = pathRate(from, to);
+    entry.tag = tag;
+    entry.from = from;
+    entry.to = to;
+    return entry.rate;
+  }
+
+  const Stats& stats() const { return mStats; }
+  void resetStats() { mStats = Stats(); }
+
+private:
+  static const size_t lineSize{64};
+
+  // tag 0 never matches, generation starts at 1
+  struct Entry
+  {
+    uint64_t tag{0};
+    CurId from{0};
+    CurId to{0};
+    double rate{0.0};
+  };
+  static_assert(lineSize % sizeof(Entry) == 0, "cache entries must not straddle cache lines");
+
+  // Fibonacci hashing, neighbouring pairs land in different lines
+  size_t slot(CurId from, CurId to) const
+  {
+    return mShift == 64 ? 0 : ((from << 32 ^ to) * 0x9E3779B97F4A7C15ull) >> mShift;
+  }
+
+  std::unique_ptr<char[]> mStorage;
+  Entry* mEntries{nullptr};
+  size_t mMask{0};
+  unsigned mShift{64};
+  uint64_t mGeneration{1};
+  Stats mStats;
+};
+
+// This implementation is faster on sparse graphs
+template <class RateSource = FunctionRates, class Stats = NoStats>
+class BasicConverter : public IConverter
+{
+public:
+  // 'curCount' - minimal universe size, e.g. to let addRate() bring new
+  // currencies without re-laying the table out; at most 65535
+  explicit BasicConverter(size_t curCount = 0)
+    : mMinCurCount(curCount)
+  {
+  }
+
+  // Takes O(R * N^2) time and O(N^2) memory, where N - number of currencies
+  // and R - number of currency rates
+  // In worst case R = N^2, so overall complexity O(N^4)
+  // N is taken from the rate set (max CurId + 1), so the table is only as
+  // big as the currencies actually used
+  void init(const std::vector<ConvertRate>& _rates)
+  {
+    const auto initTimer = mStats.start();
+    size_t curCount = mMinCurCount;
+    for (const auto& rate : _rates)
+      curCount = std::max<size_t>(curCount, std::max(rate.from, rate.to) + 1);
+    reset(curCount);
+    rates.reserve(_rates.size() + 1);
+    mStats.recordInitPhase(InitPhase::GRAPH, initTimer);
+    const auto pathsTimer = mStats.start();
+    for (const auto& rate : _rates)
+      addEdge(rate);
+    mTopology = topologyHash(_rates);
+    mStats.recordInitPhase(InitPhase::PATHS, pathsTimer);
+    const auto flatTimer = mStats.start();
+    updateFlatPaths();
+    mStats.recordInitPhase(InitPhase::FLAT_PATHS, flatTimer);
+    mStats.recordInit(initTimer);
+  }
+
+  // whether init() also materializes flat path lists (see FlatPaths):
+  // faster convert() for more memory, addRate()/removeRate() rebuild them
+  void setFlatPaths(bool enable) { mUseFlatPaths = enable; }
+
+  // adds one rate to already computed paths in O(N^2),
+  // the table grows if the rate brings new currencies
+  void addRate(const ConvertRate& rate)
+  {
+    const size_t curCount = std::max(rate.from, rate.to) + 1;
+    if (curCount > mCurCount)
+      resize(curCount);
+    addEdge(rate);
+    mTopology = topologyHash(mTopology, rate);
+    updateFlatPaths();
+    mUseSnapshot = false;
+    mCache.invalidate();
+  }
+
+  // Removes rate between 'from' and 'to' (given in either direction).
+  // Only paths towards currencies whose shortest-path tree contains this
+  // rate are recomputed, by BFS in O(N + R) each.
+  // Returns false if there is no such rate
+  bool removeRate(CurId from, CurId to)
+  {
+    if (from >= mCurCount || to >= mCurCount || from == to)
+      return false;
+    const int32_t rateId = cell(from, to).rateId;
+    if (rateId == Cell::norate)
+      return false;
+
+    std::vector<uint16_t> affected;
+    for (size_t dest = 0; dest < mCurCount; ++dest)
+      if (cell(from, dest).nextCur == to || cell(to, dest).nextCur == from)
+        affected.push_back(static_cast<uint16_t>(dest));
+
+    cell(from, to).rateId = Cell::norate;
+    cell(to, from).rateId = Cell::norate;
+    rates.retire(std::abs(rateId));
+    eraseNeighbour(from, to);
+    eraseNeighbour(to, from);
+    for (const uint16_t dest : affected)
+      rebuildPathsTo(dest);
+    updateFlatPaths();
+    mUseSnapshot = false;
+    mCache.invalidate();
+    return true;
+  }
+
+  // bytes taken by the path table
+  size_t tableSize() const
+  {
+    return rate_table.size() * sizeof(Cell) + mFlatPaths.memoryUsage();
+  }
+  // writes computed paths for MappedConverter (see PathFileHeader), rate
+  // functions aren't part of the file. Its rates are those of init()
+  // followed by addRate() ones, removed rates keep their ids
+  void savePaths(const std::string& fileName)
+  {
+    saveToFile(fileName, [this](std::ostream& out) { savePaths(out); });
+  }
+  void savePaths(std::ostream& out)
+  {
+    writePathFile(out, mCurCount, rates.size() ? rates.size() - 1 : 0, mTopology,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+  }
+  // rate values, e.g. slots to push prices into for SlotRates
+  RateSource& rateSource() { return rates; }
+
+  // optional ConversionCache of path rates in front of convert(), 'entries'
+  // rounded up to a power of two, 0 (default) turns it off. Snapshot
+  // conversions bypass it. Only for rate sources whose epoch() moves with
+  // every change: with FunctionRates cached products would outlive new
+  // RateFn values, use SlotRates
+  void setCacheSize(size_t entries)
+  {
+    static_assert(RateSource::reportsChanges, "conversion cache needs a rate source reporting changes");
+    mCache.resize(entries);
+  }
+  // drops cached rates when values changed without moving rate source
+  // epoch: stores through SlotRates::slot()
+  void advanceRateEpoch() { mCache.invalidate(); }
+  const ConversionCache::Stats& cacheStats() const { return mCache.stats(); }
+  void resetCacheStats() { mCache.resetStats(); }
+
+  // exchanges 'value' amount of currency 'from' to currency 'to' in O(N) time,
+  // where N is minimal possible number of intermediate conversions
+  double convert(double value, CurId from, CurId to)
+  {
+    const auto timer = mStats.start();
+    const double totalRate = mUseSnapshot ? mSnapshot.rate(from, to) : cachedPathRate(from, to);
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+    mStats.recordConvert(timer);
+    return finalValue;
+  }
+
+  // walks each distinct pair once, O(count + P * N) for P distinct pairs
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    mStats.recordBatch(count);
+    if (mUseSnapshot)
+      return convertSnapshot(mSnapshot, values, from, to, out, count);
+    convertGrouped(values, from, to, out, count,
+                   [this](CurId f, CurId t) { return cachedPathRate(f, t); });
+  }
+
+  // O(R + N^2)
+  uint64_t refreshRates()
+  {
+    std::vector<double> edgeRates(rates.size());
+    for (size_t id = 1; id < rates.size(); ++id)
+      edgeRates[id] = rates.get(id);
+    mStats.recordRateCalls(edgeRates.size() ? edgeRates.size() - 1 : 0);
+    composeRates(mSnapshot, mCurCount, edgeRates,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+    mUseSnapshot = true;
+    return ++mSnapshot.epoch;
+  }
+
+  const RateSnapshot& snapshot() const { return mSnapshot; }
+
+  // collected counters, empty calls with NoStats
+  Stats& stats() { return mStats; }
+
+private:
+  using Distance = uint16_t;
+  // max distance meaning that two currencies can't be converted
+  static const Distance unreachable{std::numeric_limits<Distance>::max()};
+
+  void reset(size_t curCount)
+  {
+    if (curCount > Cell::nocur)
+      throw std::out_of_range("Converter: currency id doesn't fit into 16-bit table index");
+    mCurCount = curCount;
+    rate_table.assign(mCurCount * mCurCount, Cell());
+    distance.assign(mCurCount * mCurCount, Distance(unreachable));
+    for (size_t i = 0; i < mCurCount; ++i)
+      dist(i, i) = 0;
+    neighbours.assign(mCurCount, {});
+    mUseSnapshot = false;
+    mCache.invalidate();
+
+    rates.clear();
+    rates.push_back([]() { return 0.0; }); // add dummy fn
+  }
+
+  // re-lays tables out for bigger N keeping computed paths
+  void resize(size_t curCount)
+  {
+    if (curCount > Cell::nocur)
+      throw std::out_of_range("Converter: currency id doesn't fit into 16-bit table index");
+    std::vector<Cell> newTable(curCount * curCount);
+    std::vector<Distance> newDistance(curCount * curCount, Distance(unreachable));
+    for (size_t i = 0; i < mCurCount; ++i)
+    {
+      std::copy_n(&cell(i, 0), mCurCount, &newTable[i * curCount]);
+      std::copy_n(&dist(i, 0), mCurCount, &newDistance[i * curCount]);
+    }
+    for (size_t i = mCurCount; i < curCount; ++i)
+      newDistance[i * curCount + i] = 0;
+    rate_table.swap(newTable);
+    distance.swap(newDistance);
+    neighbours.resize(curCount);
+    mCurCount = curCount;
+  }
+
+  // Takes O(N^2): every pair (i, j) may get shorter via new rate as
+  // i -> ... -> from -> to -> ... -> j
+  void addEdge(const ConvertRate& rate)
+  {
+    const CurId from = rate.from;
+    const CurId to = rate.to;
+    int32_t newRateId = static_cast<int32_t>(rates.size());
+    rates.push_back(rate.rateFn);
+    if (cell(from, to).rateId == Cell::norate && from != to)
+    {
+      neighbours[from].push_back(static_cast<uint16_t>(to));
+      neighbours[to].push_back(static_cast<uint16_t>(from));
+    }
+    cell(from, to).rateId = newRateId;
+    cell(to, from).rateId = -newRateId;
+
+    for (size_t i = 0; i < mCurCount; ++i)
+    {
+      for (size_t j = 0; j < mCurCount; ++j)
+      {
+        if (dist(from, i) != unreachable && dist(to, j) != unreachable)
+        {
+          uint32_t new_distance = uint32_t(dist(from, i)) + dist(to, j) + 1;
+          if (new_distance >= dist(i, j))
+            continue;
+          dist(i, j) = dist(j, i) = static_cast<Distance>(new_distance);
+          cell(i, j).nextCur = i != from ? cell(i, from).nextCur : static_cast<uint16_t>(to);
+          cell(j, i).nextCur = j != to ? cell(j, to).nextCur : static_cast<uint16_t>(from);
+        }
+      }
+    }
+  }
+
+  void eraseNeighbour(CurId cur, CurId neighbour)
+  {
+    auto& curNeighbours = neighbours[cur];
+    auto it = std::find(curNeighbours.begin(), curNeighbours.end(), neighbour);
+    if (it == curNeighbours.end())
+      return;
+    *it = curNeighbours.back();
+    curNeighbours.pop_back();
+  }
+
+  // recomputes shortest-path tree towards 'dest' by BFS, O(N + R)
+  void rebuildPathsTo(uint16_t dest)
+  {
+    for (size_t cur = 0; cur < mCurCount; ++cur)
+    {
+      if (cur == dest)
+        continue;
+      cell(cur, dest).nextCur = Cell::nocur;
+      dist(cur, dest) = dist(dest, cur) = unreachable;
+    }
+    std::vector<uint16_t> queue{dest};
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+      const uint16_t cur = queue[head];
+      for (const uint16_t next : neighbours[cur])
+      {
+        if (next == dest || dist(next, dest) != unreachable)
+          continue;
+        dist(next, dest) = dist(dest, next) = dist(cur, dest) + 1;
+        cell(next, dest).nextCur = cur;
+        queue.push_back(next);
+      }
+    }
+  }
+
+  // first hop from 'from' to 'to', false if there is no path
+  bool hop(CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+  {
+    nextCur = cell(from, to).nextCur;
+    if (nextCur == Cell::nocur)
+      return false;
+    rateId = cell(from, nextCur).rateId;
+    return true;
+  }
+
+  void updateFlatPaths()
+  {
+    if (!mUseFlatPaths)
+      return mFlatPaths.clear();
+    mFlatPaths.build(mCurCount, [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+    {
+      return hop(from, to, nextCur, rateId);
+    });
+  }
+
+  double cachedPathRate(CurId from, CurId to)
+  {
+    return mCache.rate(from, to, rates.epoch(), [this](CurId f, CurId t) { return pathRate(f, t); });
+  }
+
+  // product of rates along the path, 0 if there is no path
+  double pathRate(CurId from, CurId to)
+  {
+    if (mUseFlatPaths)
+      return mFlatPaths.rate(from, to, rates, mStats);
+    if (from >= mCurCount || to >= mCurCount || cell(from, to).nextCur == Cell::nocur)
+    {
+      mStats.recordUnreachable();
+      return 0.0d;
+    }
+    size_t hops = 0;
+    bool zeroRate = false;
+    double totalRate = 1.0d;
+    CurId prevCur = from;
+    CurId nextCur = from;
+    do
+    {
+      nextCur = cell(prevCur, to).nextCur;
+      int32_t rateId = cell(prevCur, nextCur).rateId;
+      if (rateId > 0)
+      {
+        totalRate *= rates.get(rateId);
+      }
+      else
+      {
+        double rate = rates.get(-rateId);
+        if (rate == 0)
+        {
+          totalRate = 0;
+          zeroRate = true;
+        }
+        else
+          totalRate /= rate;
+      }
+      prevCur = nextCur;
+      ++hops;
+    } while (nextCur != to);
+    mStats.recordPath(hops, zeroRate);
+    return totalRate;
+  }
+
+  // 8 bytes instead of 16: next hop is a 16-bit index, so it packs
+  // next to the rate id without padding to CurId
+  struct Cell
+  {
+    int32_t rateId;
+    static const int32_t norate{0};
+    uint16_t nextCur;
+    static const uint16_t nocur{std::numeric_limits<uint16_t>::max()};
+    Cell()
+      : rateId(norate)
+      , nextCur(nocur)
+    {}
+  };
+  Cell& cell(size_t from, size_t to) { return rate_table[from * mCurCount + to]; }
+  Distance& dist(size_t from, size_t to) { return distance[from * mCurCount + to]; }
+
+  // row-major mCurCount x mCurCount tables
+  std::vector<Cell> rate_table;
+  // minimal conversion distance between two currencies, kept for addRate
+  std::vector<Distance> distance;
+  // direct rates of each currency, kept for removeRate
+  std::vector<std::vector<uint16_t>> neighbours;
+  size_t mCurCount{0};
+  const size_t mMinCurCount;
+  RateSource rates;
+  uint64_t mTopology{emptyTopology};
+  bool mUseFlatPaths{false};
+  FlatPaths mFlatPaths;
+  RateSnapshot mSnapshot;
+  bool mUseSnapshot{false};
+  ConversionCache mCache;
+  Stats mStats;
+};
+
+using Converter = BasicConverter<FunctionRates>;
+using SlotConverter = BasicConverter<SlotRates>;
+using StatsConverter = BasicConverter<FunctionRates, ConverterStats>;
+
+// Next hop on the way from one currency to another,
+// rate id is set if the hop is a direct rate between them
+struct PathCell
+{
+  int32_t rateId;
+  static const int32_t norate{0};
+  CurId nextCur;
+  static const CurId nocur{std::numeric_limits<CurId>::max()};
+  PathCell()
+    : rateId(norate)
+    , nextCur(nocur)
+  {}
+  PathCell(CurId _nextCur, int32_t _rateId)
+    : rateId(_rateId)
+    , nextCur(_nextCur)
+  {}
+};
+
+// Path storage policies for BasicBFSConverter. set() may be called
+// concurrently for different 'from', rows are finished once per init().
+// reset() may take temporary memory from 'scratch'
+
+// N x N matrix, one load per lookup; best when most pairs are convertible
+class DensePathTable
+{
+public:
+  void reset(size_t curCount, const std::vector<ConvertRate>&, InitArena&)
+  {
+    mCurCount = curCount;
+    mCells.assign(curCount * curCount, PathCell());
+  }
+  void set(CurId from, CurId to, PathCell cell) { mCells[from * mCurCount + to] = cell; }
+  void finishRow(CurId) {}
+  const PathCell* find(CurId from, CurId to) const
+  {
+    const PathCell& cell = mCells[from * mCurCount + to];
+    return cell.nextCur == PathCell::nocur ? nullptr : &cell;
+  }
+  size_t size() const { return mCurCount; }
+  size_t memoryUsage() const { return mCells.capacity() * sizeof(PathCell); }
+
+private:
+  size_t mCurCount{0};
+  std::vector<PathCell> mCells;
+};
+
+// sorted flat row per currency holding only convertible pairs,
+// O(log N) lookup; best for many small disjoint rate graphs
+class SparsePathTable
+{
+public:
+  void reset(size_t curCount, const std::vector<ConvertRate>&, InitArena&)
+  {
+    // rows keep their capacity for the next init
+    for (auto& row : mRows)
+      row.clear();
+    mRows.resize(curCount);
+  }
+  void set(CurId from, CurId to, PathCell cell) { mRows[from].emplace_back(to, cell); }
+  void finishRow(CurId from)
+  {
+    auto& row = mRows[from];
+    // only direct rates can repeat a pair, a later one has bigger id;
+    // std::sort unlike std::stable_sort needs no temporary buffer
+    std::sort(row.begin(), row.end(), [](const Entry& a, const Entry& b)
+    {
+      return a.first != b.first ? a.first < b.first
+                                : std::abs(a.second.rateId) < std::abs(b.second.rateId);
+    });
+    // repeated rate between same currencies overrides previous one
+    auto out = row.begin();
+    for (auto it = row.begin(); it != row.end(); ++it)
+      if (it + 1 == row.end() || (it + 1)->first != it->first)
+        *out++ = *it;
+    row.erase(out, row.end());
+  }
+  const PathCell* find(CurId from, CurId to) const
+  {
+    const auto& row = mRows[from];
+    auto it = std::lower_bound(row.begin(), row.end(), to,
+                               [](const Entry& entry, CurId id) { return entry.first < id; });
+    return it == row.end() || it->first != to ? nullptr : &it->second;
+  }
+  size_t size() const { return mRows.size(); }
+  size_t memoryUsage() const
+  {
+    size_t bytes = mRows.capacity() * sizeof(Row);
+    for (const auto& row : mRows)
+      bytes += row.capacity() * sizeof(Entry);
+    return bytes;
+  }
+
+private:
+  using Entry = std::pair<CurId, PathCell>;
+  using Row = std::vector<Entry>;
+  std::vector<Row> mRows;
+};
+
+// connected component of every currency as the id of its root currency,
+// by union-find over the rates, O(R); rates past 'curCount' are ignored
+inline ArenaVector<CurId> rateComponents(size_t curCount, const std::vector<ConvertRate>& rates,
+                                         InitArena& scratch)
+{
+  ArenaVector<CurId> parent(curCount, ArenaAllocator<CurId>(scratch));
+  for (CurId cur = 0; cur < curCount; ++cur)
+    parent[cur] = cur;
+  auto root = [&parent](CurId cur)
+  {
+    while (parent[cur] != cur)
+      cur = parent[cur] = parent[parent[cur]];
+    return cur;
+  };
+  for (const auto& rate : rates)
+    if (rate.from < curCount && rate.to < curCount)
+      parent[root(rate.from)] = root(rate.to);
+  for (CurId cur = 0; cur < curCount; ++cur)
+    parent[cur] = root(cur);
+  return parent;
+}
+
+// dense table of its own per connected component of the rate graph,
+// indexed by currency positions inside the component: one load for a pair
+// of one component, a compare of component ids for any other pair. Takes
+// the sum of squared component sizes instead of N^2. Rows of different
+// currencies don't overlap, so searches of several threads fill
+// components at once
+class ComponentPathTable
+{
+public:
+  void reset(size_t curCount, const std::vector<ConvertRate>& rates, InitArena& scratch)
+  {
+    if (curCount > std::numeric_limits<uint32_t>::max())
+      throw std::length_error("ComponentPathTable: currency id doesn't fit into 32-bit index");
+    const ArenaVector<CurId> root = rateComponents(curCount, rates, scratch);
+    // components are numbered in order of their lowest currency
+    ArenaVector<uint32_t> component(curCount, uint32_t(nocomponent), ArenaAllocator<uint32_t>(scratch));
+    mPlaces.resize(curCount);
+    mComponents.clear();
+    for (CurId cur = 0; cur < curCount; ++cur)
+    {
+      uint32_t& id = component[root[cur]];
+      if (id == nocomponent)
+      {
+        id = static_cast<uint32_t>(mComponents.size());
+        mComponents.push_back(Component{0, 0});
+      }
+      mPlaces[cur] = Place{id, mComponents[id].size++};
+    }
+    size_t cells = 0;
+    for (auto& part : mComponents)
+    {
+      part.offset = cells;
+      cells += size_t(part.size) * part.size;
+    }
+    mCells.assign(cells, PathCell());
+  }
+  void set(CurId from, CurId to, PathCell cell) { mCells[index(mPlaces[from], mPlaces[to])] = cell; }
+  void finishRow(CurId) {}
+  const PathCell* find(CurId from, CurId to) const
+  {
+    const Place fromPlace = mPlaces[from];
+    const Place toPlace = mPlaces[to];
+    if (fromPlace.component != toPlace.component)
+      return nullptr;
+    const PathCell& cell = mCells[index(fromPlace, toPlace)];
+    return cell.nextCur == PathCell::nocur ? nullptr : &cell;
+  }
+  size_t size() const { return mPlaces.size(); }
+  size_t memoryUsage() const
+  {
+    return mCells.capacity() * sizeof(PathCell) + mPlaces.capacity() * sizeof(Place)
+           + mComponents.capacity() * sizeof(Component);
+  }
+  size_t componentCount() const { return mComponents.size(); }
+  // component of currency 'cur', components are numbered in order of
+  // their lowest currency
+  size_t component(CurId cur) const { return mPlaces[cur].component; }
+
+private:
+  static const uint32_t nocomponent{std::numeric_limits<uint32_t>::max()};
+  struct Place
+  {
+    uint32_t component;
+    // position of the currency inside its component
+    uint32_t local;
+  };
+  struct Component
+  {
+    size_t offset;
+    uint32_t size;
+  };
+  // same component is assumed
+  size_t index(Place from, Place to) const
+  {
+    const Component& part = mComponents[from.component];
+    return part.offset + size_t(from.local) * part.size + to.local;
+  }
+  std::vector<Place> mPlaces;
+  std::vector<Component> mComponents;
+  std::vector<PathCell> mCells;
+};
+
+// Picks dense table if at least a quarter of all pairs is convertible,
+// a table per component otherwise. Convertible pairs are counted from connected
+// components of the rate graph (union-find, O(R))
+class AutoPathTable
+{
+public:
+  void reset(size_t curCount, const std::vector<ConvertRate>& rates, InitArena& scratch)
+  {
+    const ArenaVector<CurId> root = rateComponents(curCount, rates, scratch);
+    ArenaVector<size_t> componentSize(curCount, 0, ArenaAllocator<size_t>(scratch));
+    for (CurId cur = 0; cur < curCount; ++cur)
+      ++componentSize[root[cur]];
+    size_t convertiblePairs = 0;
+    for (const size_t size : componentSize)
+      convertiblePairs += size * size;
+
+    mDense = convertiblePairs >= curCount * curCount / 4;
+    mDenseTable.reset(mDense ? curCount : 0, rates, scratch);
+    mComponentTable.reset(mDense ? 0 : curCount, rates, scratch);
+  }
+  void set(CurId from, CurId to, PathCell cell)
+  {
+    mDense ? mDenseTable.set(from, to, cell) : mComponentTable.set(from, to, cell);
+  }
+  void finishRow(CurId from)
+  {
+    mDense ? mDenseTable.finishRow(from) : mComponentTable.finishRow(from);
+  }
+  const PathCell* find(CurId from, CurId to) const
+  {
+    return mDense ? mDenseTable.find(from, to) : mComponentTable.find(from, to);
+  }
+  size_t size() const { return mDense ? mDenseTable.size() : mComponentTable.size(); }
+  size_t memoryUsage() const { return mDenseTable.memoryUsage() + mComponentTable.memoryUsage(); }
+  bool isDense() const { return mDense; }
+
+private:
+  bool mDense{true};
+  DensePathTable mDenseTable;
+  ComponentPathTable mComponentTable;
+};
+
+template <class PathTable, class RateSource = FunctionRates, class Stats = NoStats>
+class BasicBFSConverter : public IConverter
+{
+public:
+  // 'curCount' - minimal universe size
+  explicit BasicBFSConverter(size_t curCount = 0)
+    : mMinCurCount(curCount)
+  {
+  }
+
+  // number of threads running per-source BFS in init(),
+  // 0 - one per hardware thread
+  void setThreadCount(unsigned threadCount) { mThreadCount = threadCount; }
+
+  // whether init() postpones per-source searches: it builds only the
+  // rate graph in O(R) and the BFS of a row runs on first conversion
+  // through it, or on warmup(). Rows are searched once even if several
+  // threads convert concurrently (with ConversionCache off). Flat paths
+  // aren't built in this mode
+  void setLazy(bool enable) { mLazy = enable; }
+
+  // searches rows of 'sources' now instead of on first conversion,
+  // does nothing for rows already there or if not lazy
+  void warmup(const std::vector<CurId>& sources)
+  {
+    for (const CurId from : sources)
+      if (from < mPaths.size())
+        ensureRow(from);
+  }
+
+  // rows searched so far, all of them if not lazy
+  size_t searchedRows() const { return mLazyRows.searched.load(std::memory_order_relaxed); }
+
+  // temporary structures come from an arena kept between calls
+  void init(const std::vector<ConvertRate>& rates)
+  {
+    mRates.clear();
+    mUseSnapshot = false;
+    mCache.invalidate();
+    // everything below lived in the arena
+    mConnections.release();
+    mLazyRows.release();
+    mArena.reset();
+    mDependents.clear();
+    const auto initTimer = mStats.start();
+    mTopology = topologyHash(rates);
+    size_t curCount = mMinCurCount;
+    for (const auto& rate : rates)
+      curCount = std::max<size_t>(curCount, std::max(rate.from, rate.to) + 1);
+    mPaths.reset(curCount, rates, mArena);
+    // add to mPaths all direct convert rates
+    // and init mRates
+    // complexity is O(R), worst case O(N^2)
+    mRates.reserve(rates.size() + 1);
+    mRates.push_back([]() { return 0.0; }); // add dummy fn
+    Connections& connections = mConnections; // sparce matrix, kept for lazy searches
+    connections.offsets.assign(curCount + 1, 0);
+    for (const auto& rate : rates)
+    {
+      int32_t newRateId = static_cast<int32_t>(mRates.size());
+      mRates.push_back(rate.rateFn);
+
+      const CurId from = rate.from;
+      const CurId to = rate.to;
+      mPaths.set(from, to, Cell(to, newRateId));
+      mPaths.set(to, from, Cell(from, -newRateId));
+      ++connections.offsets[from + 1];
+      ++connections.offsets[to + 1];
+    }
+    for (size_t cur = 0; cur < curCount; ++cur)
+      connections.offsets[cur + 1] += connections.offsets[cur];
+    connections.neighbours.resize(connections.offsets[curCount]);
+    {
+      ArenaVector<size_t> filled(connections.offsets.begin(), connections.offsets.end() - 1,
+                                 ArenaAllocator<size_t>(mArena));
+      for (const auto& rate : rates)
+      {
+        connections.neighbours[filled[rate.from]++] = rate.to;
+        connections.neighbours[filled[rate.to]++] = rate.from;
+      }
+    }
+
+    mStats.recordInitPhase(InitPhase::GRAPH, initTimer);
+    if (mLazy)
+    {
+      mFlatPaths.clear();
+      mLazyRows.start(curCount);
+      return mStats.recordInit(initTimer);
+    }
+
+    const auto pathsTimer = mStats.start();
+    // Do BFS from each node to find all shortest paths
+    // thus complexity is O(N(N + R)) = O(N^3)
+    // Searches only write mPaths row of their own source, so sources
+    // are handed out to threads in chunks, each thread has own visitedNodes
+    unsigned threadCount = mThreadCount ? mThreadCount : std::thread::hardware_concurrency();
+    threadCount = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadCount, curCount)));
+    const CurId chunkSize = 16;
+    std::atomic<CurId> nextChunk{0};
+    // arena isn't thread-safe, per thread scratch is taken upfront
+    ArenaVector<CurId> visitedNodes(threadCount * curCount, CurId(unvisited),
+                                    ArenaAllocator<CurId>(mArena));
+    ArenaVector<NextCur> nextToVisitCurs(threadCount * curCount, NextCur(),
+                                         ArenaAllocator<NextCur>(mArena));
+    auto searchChunks = [&](unsigned thread)
+    {
+      CurId* visited = visitedNodes.data() + thread * curCount;
+      NextCur* queue = nextToVisitCurs.data() + thread * curCount;
+      for (;;)
+      {
+        const CurId first = nextChunk.fetch_add(chunkSize);
+        if (first >= curCount)
+          break;
+        const CurId last = std::min<CurId>(first + chunkSize, curCount);
+        for (CurId from = first; from < last; ++from)
+          searchFrom(from, connections, visited, queue);
+      }
+    };
+    ArenaVector<std::thread> threads{ArenaAllocator<std::thread>(mArena)};
+    threads.reserve(threadCount);
+    for (unsigned i = 1; i < threadCount; ++i)
+      threads.emplace_back(searchChunks, i);
+    searchChunks(0);
+    for (auto& thread : threads)
+      thread.join();
+    mLazyRows.searched.store(curCount, std::memory_order_relaxed);
+    mStats.recordInitPhase(InitPhase::PATHS, pathsTimer);
+
+    const auto flatTimer = mStats.start();
+    if (!mUseFlatPaths)
+      mFlatPaths.clear();
+    else
+      mFlatPaths.build(curCount, [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+    mStats.recordInitPhase(InitPhase::FLAT_PATHS, flatTimer);
+    ensureDependents();
+    mStats.recordInit(initTimer);
+  }
+
+  // whether init() also materializes flat path lists (see FlatPaths):
+  // faster convert() for more memory
+  void setFlatPaths(bool enable) { mUseFlatPaths = enable; }
+
+  // optional ConversionCache of path rates in front of convert(), 'entries'
+  // rounded up to a power of two, 0 (default) turns it off. Snapshot
+  // conversions bypass it. Only for rate sources whose epoch() moves with
+  // every change: with FunctionRates cached products would outlive new
+  // RateFn values, use SlotRates
+  void setCacheSize(size_t entries)
+  {
+    static_assert(RateSource::reportsChanges, "conversion cache needs a rate source reporting changes");
+    mCache.resize(entries);
+  }
+  // drops cached rates when values changed without moving rate source
+  // epoch: stores through SlotRates::slot()
+  void advanceRateEpoch() { mCache.invalidate(); }
+  const ConversionCache::Stats& cacheStats() const { return mCache.stats(); }
+  void resetCacheStats() { mCache.resetStats(); }
+
+  // exchanges 'value' amount of currency 'from' to currency 'to' in O(N) time,
+  // where N is minimal possible number of intermediate conversions
+  double convert(double value, CurId from, CurId to)
+  {
+    const auto timer = mStats.start();
+    const double totalRate = mUseSnapshot ? mSnapshot.rate(from, to) : cachedPathRate(from, to);
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+    mStats.recordConvert(timer);
+    return finalValue;
+  }
+
+  // walks each distinct pair once, O(count + P * N) for P distinct pairs
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    mStats.recordBatch(count);
+    if (mUseSnapshot)
+      return convertSnapshot(mSnapshot, values, from, to, out, count);
+    convertGrouped(values, from, to, out, count,
+                   [this](CurId f, CurId t) { return cachedPathRate(f, t); });
+  }
+
+  // O(R + N^2), searches remaining rows first if lazy
+  uint64_t refreshRates()
+  {
+    ensureAllRows();
+    ensureDependents();
+    mEdgeRates.assign(mRates.size(), 0.0);
+    for (size_t id = 1; id < mRates.size(); ++id)
+      mEdgeRates[id] = mRates.get(id);
+    mStats.recordRateCalls(mEdgeRates.size() ? mEdgeRates.size() - 1 : 0);
+    composeRates(mSnapshot, mPaths.size(), mEdgeRates,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+    mUseSnapshot = true;
+    return ++mSnapshot.epoch;
+  }
+
+  // whether init() also builds a reverse index of pairs on the rates their
+  // paths use (see RateDependents) for updateRates(); 12 more bytes per
+  // convertible pair, built on first refreshRates() if lazy
+  void setDeltaUpdates(bool enable) { mDeltaUpdates = enable; }
+
+  // takes new values of rates 'rateIndexes' (positions among init() rates)
+  // into the snapshot and recomposes only pairs whose paths use them,
+  // equal to what refreshRates() would give if no other rate changed.
+  // Full refreshRates() if there is no snapshot or delta updates are off.
+  // Returns epoch of the updated snapshot
+  uint64_t updateRates(const std::vector<size_t>& rateIndexes)
+  {
+    if (!mUseSnapshot || !mDependents.built())
+      return refreshRates();
+    std::vector<int32_t> ids;
+    ids.reserve(rateIndexes.size());
+    for (const size_t index : rateIndexes)
+    {
+      if (index + 1 >= mRates.size())
+        throw std::out_of_range("updateRates: no rate at index " + std::to_string(index));
+      ids.push_back(static_cast<int32_t>(index + 1));
+      mEdgeRates[index + 1] = mRates.get(index + 1);
+    }
+    mStats.recordRateCalls(ids.size());
+    mDependents.update(mSnapshot, mEdgeRates, ids,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+    return ++mSnapshot.epoch;
+  }
+
+  const RateSnapshot& snapshot() const { return mSnapshot; }
+
+  // collected counters, empty calls with NoStats
+  Stats& stats() { return mStats; }
+
+  // bytes taken by path storage
+  size_t tableSize() const
+  {
+    return mPaths.memoryUsage() + mFlatPaths.memoryUsage() + mDependents.memoryUsage();
+  }
+  // writes computed paths for MappedConverter (see PathFileHeader),
+  // rate functions aren't part of the file; searches remaining rows
+  // first if lazy
+  void savePaths(const std::string& fileName)
+  {
+    saveToFile(fileName, [this](std::ostream& out) { savePaths(out); });
+  }
+  void savePaths(std::ostream& out)
+  {
+    ensureAllRows();
+    writePathFile(out, mPaths.size(), mRates.size() ? mRates.size() - 1 : 0, mTopology,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+  }
+  // rows not searched yet by lazy mode hold only direct rates
+  const PathTable& pathTable() const { return mPaths; }
+  // scratch memory kept between inits
+  const InitArena& initArena() const { return mArena; }
+  // rate values, e.g. slots to push prices into for SlotRates
+  RateSource& rateSource() { return mRates; }
+
+private:
+  using Cell = PathCell;
+  static const CurId unvisited{std::numeric_limits<CurId>::max()};
+
+  // rate graph as compressed sparse row: neighbours of 'cur' are
+  // neighbours[offsets[cur]] .. neighbours[offsets[cur + 1] - 1]
+  struct Connections
+  {
+    explicit Connections(InitArena& arena)
+      : offsets(ArenaAllocator<size_t>(arena))
+      , neighbours(ArenaAllocator<CurId>(arena))
+    {}
+    ArenaVector<size_t> offsets;
+    ArenaVector<CurId> neighbours;
+    const CurId* begin(CurId cur) const { return neighbours.data() + offsets[cur]; }
+    const CurId* end(CurId cur) const { return neighbours.data() + offsets[cur + 1]; }
+    // gives storage back before the arena is reset
+    void release()
+    {
+      ArenaVector<size_t>(offsets.get_allocator()).swap(offsets);
+      ArenaVector<CurId>(neighbours.get_allocator()).swap(neighbours);
+    }
+  };
+  // currency to visit and first hop on the way to it
+  using NextCur = std::pair<CurId, CurId>;
+
+  // State of lazy mode: which rows are searched and scratch of searches,
+  // which run one at a time under 'mutex'
+  struct LazyRows
+  {
+    explicit LazyRows(InitArena& arena)
+      : ready(ArenaAllocator<std::atomic<bool>>(arena))
+      , visited(ArenaAllocator<CurId>(arena))
+      , queue(ArenaAllocator<NextCur>(arena))
+    {}
+    void start(size_t curCount)
+    {
+      ArenaVector<std::atomic<bool>>(curCount, ready.get_allocator()).swap(ready);
+      visited.assign(curCount, CurId(unvisited));
+      queue.resize(curCount);
+    }
+    void release()
+    {
+      ArenaVector<std::atomic<bool>>(ready.get_allocator()).swap(ready);
+      ArenaVector<CurId>(visited.get_allocator()).swap(visited);
+      ArenaVector<NextCur>(queue.get_allocator()).swap(queue);
+      searched.store(0, std::memory_order_relaxed);
+    }
+    // row is finished, empty if not lazy
+    ArenaVector<std::atomic<bool>> ready;
+    ArenaVector<CurId> visited;
+    ArenaVector<NextCur> queue;
+    std::mutex mutex;
+    std::atomic<size_t> searched{0};
+  };
+
+  // makes sure row 'from' is searched, one acquire load once it is
+  void ensureRow(CurId from)
+  {
+    if (mLazyRows.ready.empty() || mLazyRows.ready[from].load(std::memory_order_acquire))
+      return;
+    std::lock_guard<std::mutex> lock(mLazyRows.mutex);
+    if (mLazyRows.ready[from].load(std::memory_order_relaxed))
+      return;
+    searchFrom(from, mConnections, mLazyRows.visited.data(), mLazyRows.queue.data());
+    mLazyRows.searched.fetch_add(1, std::memory_order_relaxed);
+    mLazyRows.ready[from].store(true, std::memory_order_release);
+  }
+
+  // builds the delta index if enabled, all rows must be searched
+  void ensureDependents()
+  {
+    if (!mDeltaUpdates || mDependents.built())
+      return;
+    mDependents.build(mPaths.size(), mRates.size() ? mRates.size() - 1 : 0,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+  }
+
+  void ensureAllRows()
+  {
+    if (mLazyRows.searched.load(std::memory_order_relaxed) == mLazyRows.ready.size())
+      return;
+    for (CurId from = 0; from < mLazyRows.ready.size(); ++from)
+      ensureRow(from);
+  }
+
+  // BFS from 'from' filling its mPaths row, visitedNodes[cur] == from marks
+  // currencies already visited by this search. 'nextToVisitCurs' is
+  // the queue, every currency gets there at most once so N entries suffice
+  void searchFrom(CurId from, const Connections& connections,
+                  CurId* visitedNodes, NextCur* nextToVisitCurs)
+  {
+    visitedNodes[from] = from;
+    size_t tail = 0;
+    for (const CurId* nextCur = connections.begin(from); nextCur != connections.end(from); ++nextCur)
+    {
+      if (visitedNodes[*nextCur] == from)
+        continue;
+      nextToVisitCurs[tail++] = NextCur(*nextCur, *nextCur);
+      visitedNodes[*nextCur] = from;
+    }
+    for (size_t head = 0; head < tail; ++head)
+    {
+      const NextCur visiting = nextToVisitCurs[head];
+      const CurId* end = connections.end(visiting.first);
+      for (const CurId* nextCur = connections.begin(visiting.first); nextCur != end; ++nextCur)
+      {
+        if (visitedNodes[*nextCur] != from)
+        {
+          visitedNodes[*nextCur] = from;
+          nextToVisitCurs[tail++] = NextCur(*nextCur, visiting.second);
+          mPaths.set(from, *nextCur, Cell(visiting.second, Cell::norate));
+        }
+      }
+    }
+    mPaths.finishRow(from);
+  }
+
+  // first hop from 'from' to 'to', false if there is no path
+  bool hop(CurId from, CurId to, CurId& nextCur, int32_t& rateId) const
+  {
+    const Cell* cell = mPaths.find(from, to);
+    if (!cell)
+      return false;
+    nextCur = cell->nextCur;
+    rateId = mPaths.find(from, nextCur)->rateId;
+    return true;
+  }
+
+  double cachedPathRate(CurId from, CurId to)
+  {
+    return mCache.rate(from, to, mRates.epoch(), [this](CurId f, CurId t) { return pathRate(f, t); });
+  }
+
+  // product of rates along the path, 0 if there is no path
+  double pathRate(CurId from, CurId to)
+  {
+    if (mUseFlatPaths && mLazyRows.ready.empty())
+      return mFlatPaths.rate(from, to, mRates, mStats);
+    if (from >= mPaths.size() || to >= mPaths.size())
+    {
+      mStats.recordUnreachable();
+      return 0.0d;
+    }
+    ensureRow(from);
+    if (!mPaths.find(from, to))
+    {
+      mStats.recordUnreachable();
+      return 0.0d;
+    }
+    if (from == to)
+    {
+      mStats.recordPath(0, false);
+      return 1.0d;
+    }
+    size_t hops = 0;
+    bool zeroRate = false;
+    double totalRate = 1.0d;
+    CurId prevCur = from;
+    CurId nextCur = from;
+    do
+    {
+      // rest of the path follows rows of intermediate currencies
+      ensureRow(prevCur);
+      nextCur = mPaths.find(prevCur, to)->nextCur;
+      int32_t rateId = mPaths.find(prevCur, nextCur)->rateId;
+      if (rateId > 0)
+      {
+        totalRate *= mRates.get(rateId);
+      }
+      else
+      {
+        double rate = mRates.get(-rateId);
+        if (rate == 0)
+        {
+          totalRate = 0;
+          zeroRate = true;
+        }
+        else
+          totalRate /= rate;
+      }
+      prevCur = nextCur;
+      ++hops;
+    } while (nextCur != to);
+    mStats.recordPath(hops, zeroRate);
+    return totalRate;
+  }
+
+  PathTable mPaths;
+  RateSource mRates;
+  uint64_t mTopology{emptyTopology};
+  InitArena mArena;
+  Connections mConnections{mArena};
+  bool mLazy{false};
+  LazyRows mLazyRows{mArena};
+  unsigned mThreadCount{1};
+  const size_t mMinCurCount;
+  bool mUseFlatPaths{false};
+  FlatPaths mFlatPaths;
+  bool mDeltaUpdates{false};
+  RateDependents mDependents;
+  // rate values the snapshot was composed of
+  std::vector<double> mEdgeRates;
+  RateSnapshot mSnapshot;
+  bool mUseSnapshot{false};
+  ConversionCache mCache;
+  Stats mStats;
+};
+
+using BFSConverter = BasicBFSConverter<AutoPathTable>;
+using SlotBFSConverter = BasicBFSConverter<AutoPathTable, SlotRates>;
+using DenseBFSConverter = BasicBFSConverter<DensePathTable>;
+using SparseBFSConverter = BasicBFSConverter<SparsePathTable>;
+using ComponentBFSConverter = BasicBFSConverter<ComponentPathTable>;
+using StatsBFSConverter = BasicBFSConverter<AutoPathTable, FunctionRates, ConverterStats>;
+
+// Kernels below are also compiled for AVX-512 and AVX2, the best clone
+// for the running CPU is picked at load time
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+#define RATE_CONVERTER_SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define RATE_CONVERTER_SIMD_CLONES
+#endif
+
+// Floyd-Warshall step over one block of the hop count matrix: relaxes
+// pairs (i0.., j0..) through intermediate currencies k0.. . 'next' holds
+// first hop of every pair, rows are 'stride' apart. The inner loop is
+// branch free, so it vectorizes into compare + blend
+RATE_CONVERTER_SIMD_CLONES
+inline void relaxHopBlock(int32_t* hops, int32_t* next, size_t stride,
+                          size_t i0, size_t j0, size_t k0, size_t block, int32_t unreachable)
+{
+  for (size_t k = k0; k < k0 + block; ++k)
+  {
+    for (size_t i = i0; i < i0 + block; ++i)
+    {
+      const int32_t hopsIK = hops[i * stride + k];
+      // row k can't get shorter through k itself, skipping it keeps the rows apart
+      if (hopsIK == unreachable || i == k)
+        continue;
+      const int32_t nextIK = next[i * stride + k];
+      const int32_t* __restrict hopsK = hops + k * stride + j0;
+      int32_t* __restrict hopsI = hops + i * stride + j0;
+      int32_t* __restrict nextI = next + i * stride + j0;
+      for (size_t j = 0; j < block; ++j)
+      {
+        const int32_t candidate = hopsIK + hopsK[j];
+        const bool shorter = candidate < hopsI[j];
+        hopsI[j] = shorter ? candidate : hopsI[j];
+        nextI[j] = shorter ? nextIK : nextI[j];
+      }
+    }
+  }
+}
+
+// This implementation is meant for dense graphs (R close to N^2), where
+// BFS from every currency costs O(N * R) = O(N^3) in random memory access.
+// init() finds fewest-hop paths of all pairs at once by blocked
+// Floyd-Warshall over a padded hop count matrix: O(N^3) too, but in
+// cache-sized tiles and SIMD lanes, and without rate calls.
+// Until refreshRates() convert() walks the paths with live rates, after it
+// convert() is a lookup into the composite rate matrix
+template <class RateSource = FunctionRates>
+class BasicAllPairsConverter : public IConverter
+{
+public:
+  // 'curCount' - minimal universe size, at most 65535
+  explicit BasicAllPairsConverter(size_t curCount = 0)
+    : mMinCurCount(curCount)
+  {
+  }
+
+  void init(const std::vector<ConvertRate>& _rates)
+  {
+    size_t curCount = mMinCurCount;
+    for (const auto& rate : _rates)
+      curCount = std::max<size_t>(curCount, std::max(rate.from, rate.to) + 1);
+    if (curCount > Cell::nocur)
+      throw std::out_of_range("AllPairsConverter: currency id doesn't fit into 16-bit table index");
+    mCurCount = curCount;
+    mUseSnapshot = false;
+    mTopology = topologyHash(_rates);
+
+    // small universes are one tile, rounded up to whole SIMD registers
+    const size_t block = std::min(size_t(maxBlock), (curCount + 15) / 16 * 16);
+    const size_t blockCount = block ? (curCount + block - 1) / block : 0;
+    // one more cache line per row, so that rows a power of two apart don't
+    // compete for the same cache sets
+    const size_t stride = blockCount * block + 64 / sizeof(int32_t);
+    const int32_t unreachable = std::numeric_limits<int32_t>::max() / 2;
+    const size_t paddedCount = blockCount * block;
+    mArena.reset();
+    const ArenaAllocator<int32_t> scratch(mArena);
+    ArenaVector<int32_t> hops(paddedCount * stride, unreachable, scratch);
+    ArenaVector<int32_t> next(paddedCount * stride, int32_t(Cell::nocur), scratch);
+    // direct rate of every pair, a later rate of the same pair replaces an
+    // earlier one as in other engines
+    ArenaVector<int32_t> direct(curCount * curCount, int32_t(Cell::norate), scratch);
+    rates.clear();
+    rates.reserve(_rates.size() + 1);
+    rates.push_back([]() { return 0.0; }); // add dummy fn
+    int32_t rateId = 0;
+    for (const auto& rate : _rates)
+    {
+      rates.push_back(rate.rateFn);
+      ++rateId;
+      if (rate.from == rate.to)
+        continue;
+      direct[rate.from * curCount + rate.to] = rateId;
+      direct[rate.to * curCount + rate.from] = -rateId;
+      hops[rate.from * stride + rate.to] = hops[rate.to * stride + rate.from] = 1;
+      next[rate.from * stride + rate.to] = static_cast<int32_t>(rate.to);
+      next[rate.to * stride + rate.from] = static_cast<int32_t>(rate.from);
+    }
+    for (size_t cur = 0; cur < paddedCount; ++cur)
+      hops[cur * stride + cur] = 0;
+
+    // diagonal block first, then its row and column, then the rest
+    for (size_t kb = 0; kb < blockCount; ++kb)
+    {
+      const size_t k0 = kb * block;
+      relaxHopBlock(hops.data(), next.data(), stride, k0, k0, k0, block, unreachable);
+      for (size_t b = 0; b < blockCount; ++b)
+      {
+        if (b == kb)
+          continue;
+        relaxHopBlock(hops.data(), next.data(), stride, k0, b * block, k0, block, unreachable);
+        relaxHopBlock(hops.data(), next.data(), stride, b * block, k0, k0, block, unreachable);
+      }
+      for (size_t ib = 0; ib < blockCount; ++ib)
+        for (size_t jb = 0; jb < blockCount; ++jb)
+          if (ib != kb && jb != kb)
+            relaxHopBlock(hops.data(), next.data(), stride, ib * block, jb * block, k0, block, unreachable);
+    }
+
+    mTable.assign(curCount * curCount, Cell());
+    for (size_t from = 0; from < curCount; ++from)
+      for (size_t to = 0; to < curCount; ++to)
+      {
+        const int32_t nextCur = next[from * stride + to];
+        if (from == to || nextCur == Cell::nocur)
+          continue;
+        cell(from, to).nextCur = static_cast<uint16_t>(nextCur);
+        cell(from, to).rateId = direct[from * curCount + nextCur];
+      }
+  }
+
+  double convert(double value, CurId from, CurId to)
+  {
+    const double totalRate = mUseSnapshot ? mSnapshot.rate(from, to) : pathRate(from, to);
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+    return finalValue;
+  }
+
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    if (mUseSnapshot)
+      return convertSnapshot(mSnapshot, values, from, to, out, count);
+    convertGrouped(values, from, to, out, count,
+                   [this](CurId f, CurId t) { return pathRate(f, t); });
+  }
+
+  // evaluates rates once and caches composite rates of all pairs, O(N^2)
+  uint64_t refreshRates()
+  {
+    std::vector<double> edgeRates(rates.size());
+    for (size_t id = 1; id < rates.size(); ++id)
+      edgeRates[id] = rates.get(id);
+    composeRates(mSnapshot, mCurCount, edgeRates,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+    mUseSnapshot = true;
+    return ++mSnapshot.epoch;
+  }
+
+  const RateSnapshot& snapshot() const { return mSnapshot; }
+
+  // bytes taken by the path table
+  size_t tableSize() const { return mTable.size() * sizeof(Cell); }
+  // writes computed paths for MappedConverter (see PathFileHeader),
+  // rate functions aren't part of the file
+  void savePaths(const std::string& fileName)
+  {
+    saveToFile(fileName, [this](std::ostream& out) { savePaths(out); });
+  }
+  void savePaths(std::ostream& out)
+  {
+    writePathFile(out, mCurCount, rates.size() ? rates.size() - 1 : 0, mTopology,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+  }
+  // scratch memory kept between inits
+  const InitArena& initArena() const { return mArena; }
+  // rate values, e.g. slots to push prices into for SlotRates
+  RateSource& rateSource() { return rates; }
+
+private:
+  // first hop of the path and its rate
+  struct Cell
+  {
+    int32_t rateId;
+    static const int32_t norate{0};
+    uint16_t nextCur;
+    static const uint16_t nocur{std::numeric_limits<uint16_t>::max()};
+    Cell()
+      : rateId(norate)
+      , nextCur(nocur)
+    {}
+  };
+  // tile side, three tiles of both matrices take 1.5 MB and fit into L2
+  static const size_t maxBlock = 256;
+
+  Cell& cell(size_t from, size_t to) { return mTable[from * mCurCount + to]; }
+
+  bool hop(CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+  {
+    const Cell& pathCell = cell(from, to);
+    if (pathCell.nextCur == Cell::nocur)
+      return false;
+    nextCur = pathCell.nextCur;
+    rateId = pathCell.rateId;
+    return true;
+  }
+
+  // product of rates along the path, 0 if there is no path
+  double pathRate(CurId from, CurId to)
+  {
+    if (from >= mCurCount || to >= mCurCount || cell(from, to).nextCur == Cell::nocur)
+      return 0.0d;
+    double totalRate = 1.0d;
+    for (CurId cur = from; cur != to; )
+    {
+      const Cell& pathCell = cell(cur, to);
+      const int32_t rateId = pathCell.rateId;
+      if (rateId > 0)
+      {
+        totalRate *= rates.get(rateId);
+      }
+      else
+      {
+        double rate = rates.get(-rateId);
+        if (rate == 0)
+          totalRate = 0;
+        else
+          totalRate /= rate;
+      }
+      cur = pathCell.nextCur;
+    }
+    return totalRate;
+  }
+
+  size_t mCurCount{0};
+  const size_t mMinCurCount;
+  std::vector<Cell> mTable;
+  RateSource rates;
+  uint64_t mTopology{emptyTopology};
+  // hop count and first hop matrices of init()
+  InitArena mArena;
+  RateSnapshot mSnapshot;
+  bool mUseSnapshot{false};
+};
+
+using AllPairsConverter = BasicAllPairsConverter<FunctionRates>;
+
+// It's not canonical GOF Factory
+class ConverterFactory
+{
+public:
+  enum class Type { INCREMENTAL, BFS, ALL_PAIRS};
+  void setType(Type type) { mType = type; }
+  // minimal universe size of created engines, 0 - taken from rates only
+  void setCurrencyCount(size_t curCount) { mCurCount = curCount; }
+  std::unique_ptr<IConverter> create() const
+  {
+    switch(mType)
+    {
+      case Type::INCREMENTAL:
+        return std::make_unique<Converter>(mCurCount);
+      case Type::BFS:
+        return std::make_unique<BFSConverter>(mCurCount);
+      case Type::ALL_PAIRS:
+        return std::make_unique<AllPairsConverter>(mCurCount);
+    }
+    return std::make_unique<BFSConverter>(mCurCount);
+  }
+  // calls fn(pricer) with a Pricer of the engine create() would make;
+  // 'fn' is instantiated for every engine type, so loops in it inline
+  // convert() instead of calling through IConverter
+  template <class PricerFn>
+  void withPricer(PricerFn fn) const;
+private:
+  Type mType{Type::BFS};
+  size_t mCurCount{0};
+};
+
+// Engine held by value and called with qualified names, which bypass
+// virtual dispatch: convert() inlines into the caller's loops. Pick the
+// engine once (e.g. ConverterFactory::withPricer()), then run tight loops
+template <class Engine>
+class Pricer
+{
+public:
+  template <class... Args>
+  explicit Pricer(Args&&... args)
+    : mEngine(std::forward<Args>(args)...)
+  {
+  }
+
+  void init(const std::vector<ConvertRate>& rates) { mEngine.Engine::init(rates); }
+  double convert(double value, CurId from, CurId to) { return mEngine.Engine::convert(value, from, to); }
+  // out[i] = convert(values[i], from[i], to[i]) one by one, unlike
+  // convertBatch() which groups repeated pairs
+  void convertEach(const double* values, const CurId* from, const CurId* to, double* out, size_t count)
+  {
+    for (size_t i = 0; i < count; ++i)
+      out[i] = mEngine.Engine::convert(values[i], from[i], to[i]);
+  }
+  uint64_t refreshRates() { return mEngine.Engine::refreshRates(); }
+
+  Engine& engine() { return mEngine; }
+
+private:
+  Engine mEngine;
+};
+
+template <class PricerFn>
+void ConverterFactory::withPricer(PricerFn fn) const
+{
+  switch(mType)
+  {
+    case Type::INCREMENTAL:
+    {
+      Pricer<Converter> pricer(mCurCount);
+      return fn(pricer);
+    }
+    case Type::ALL_PAIRS:
+    {
+      Pricer<AllPairsConverter> pricer(mCurCount);
+      return fn(pricer);
+    }
+    case Type::BFS:
+      break;
+  }
+  Pricer<BFSConverter> pricer(mCurCount);
+  fn(pricer);
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Stats policies for engines: what convert() and init() record.
+// NoStats is the default and every call on it is an empty inline
+// function, so engines built with it carry no instrumentation
+
+// init() phases timed separately: building the rate graph, computing
+// paths and materializing flat path lists
+enum class InitPhase { GRAPH, PATHS, FLAT_PATHS };
+const size_t initPhaseCount = 3;
+
+class NoStats
+{
+public:
+  struct Timer {};
+  Timer start() const { return Timer(); }
+  void recordConvert(const Timer&) {}
+  void recordBatch(size_t) {}
+  void recordPath(size_t, bool) {}
+  void recordUnreachable() {}
+  void recordRateCalls(size_t) {}
+  void recordInitPhase(InitPhase, const Timer&) {}
+  void recordInit(const Timer&) {}
+};
+
+// Log-linear histogram in the HDR style: values below 16 get a bucket
+// each, every further power of two is split into 16 buckets, so any
+// uint64_t value is kept within 1/16 of itself in 976 buckets
+class Histogram
+{
+public:
+  static const size_t subBucketBits{4};
+  static const size_t subBuckets{1u << subBucketBits};
+  static const size_t bucketCount{subBuckets + (64 - subBucketBits) * subBuckets};
+
+  static size_t bucket(uint64_t value)
+  {
+    if (value < subBuckets)
+      return static_cast<size_t>(value);
+    const size_t exponent = 63 - static_cast<size_t>(__builtin_clzll(value));
+    const size_t shift = exponent - subBucketBits;
+    return subBuckets + shift * subBuckets + static_cast<size_t>((value >> shift) & (subBuckets - 1));
+  }
+  // smallest and biggest value counted in 'bucket'
+  static uint64_t lowerBound(size_t bucket)
+  {
+    if (bucket < subBuckets)
+      return bucket;
+    const size_t shift = (bucket - subBuckets) / subBuckets;
+    return static_cast<uint64_t>(subBuckets + (bucket - subBuckets) % subBuckets) << shift;
+  }
+  static uint64_t upperBound(size_t bucket)
+  {
+    if (bucket < subBuckets)
+      return bucket;
+    const size_t shift = (bucket - subBuckets) / subBuckets;
+    return lowerBound(bucket) + ((uint64_t(1) << shift) - 1);
+  }
+
+  void record(uint64_t value, uint64_t count = 1)
+  {
+    mCounts[bucket(value)] += count;
+    mCount += count;
+    mSum += value * count;
+    mMax = std::max(mMax, value);
+  }
+
+  uint64_t count() const { return mCount; }
+  uint64_t sum() const { return mSum; }
+  uint64_t max() const { return mMax; }
+  double mean() const { return mCount ? static_cast<double>(mSum) / mCount : 0.0; }
+  // upper bound of the bucket holding 'fraction' quantile, 0 if empty
+  uint64_t percentile(double fraction) const
+  {
+    const uint64_t rank = static_cast<uint64_t>(fraction * mCount);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucketCount; ++i)
+    {
+      seen += mCounts[i];
+      if (mCounts[i] && seen > rank)
+        return std::min(upperBound(i), mMax);
+    }
+    return mMax;
+  }
+  // fn(lowerBound, upperBound, count) for every non-empty bucket, e.g. to
+  // export as cumulative buckets of a metrics pipeline
+  template <class BucketFn>
+  void forEachBucket(BucketFn fn) const
+  {
+    for (size_t i = 0; i < bucketCount; ++i)
+      if (mCounts[i])
+        fn(lowerBound(i), upperBound(i), mCounts[i]);
+  }
+
+  uint64_t bucketValue(size_t bucket) const { return mCounts[bucket]; }
+  // adds counts of a histogram kept as 'Counter's with get()
+  template <class Counter>
+  void add(const std::array<Counter, bucketCount>& counts, uint64_t sum, uint64_t max)
+  {
+    for (size_t i = 0; i < bucketCount; ++i)
+    {
+      const uint64_t count = counts[i].get();
+      mCounts[i] += count;
+      mCount += count;
+    }
+    mSum += sum;
+    mMax = std::max(mMax, max);
+  }
+
+private:
+  std::array<uint64_t, bucketCount> mCounts{};
+  uint64_t mCount{0};
+  uint64_t mSum{0};
+  uint64_t mMax{0};
+};
+
+// What ConverterStats collected so far, merged over all threads
+struct ConverterStatsSnapshot
+{
+  // convert() calls, their latency is 'convertNanos'
+  uint64_t conversions{0};
+  // pairs converted by convertBatch()
+  uint64_t batchConversions{0};
+  // conversions between currencies with no path
+  uint64_t unreachable{0};
+  // path walks where an inverse rate was 0, giving total 0
+  uint64_t zeroRates{0};
+  // rate values read: one per hop of a walk, one per rate in refreshRates()
+  uint64_t rateCalls{0};
+  // convert() latency, ns
+  Histogram convertNanos;
+  // hops of path walks; snapshot and cached conversions don't walk
+  Histogram hops;
+  // init() latency, ns
+  Histogram initNanos;
+  // phases of the last init(), ns, indexed by InitPhase
+  std::array<uint64_t, initPhaseCount> lastInitPhaseNanos{};
+};
+
+// Stats policy collecting ConverterStatsSnapshot. Every thread touching an
+// engine writes counters of its own shard, a plain load and store, no
+// lock-prefixed instruction; snapshot() merges the shards. Costs two
+// clock reads per convert(). Shards stay until the stats are destroyed
+class ConverterStats
+{
+public:
+  struct Timer
+  {
+    std::chrono::steady_clock::time_point start;
+  };
+
+  ConverterStats()
+    : mId(nextId().fetch_add(1, std::memory_order_relaxed))
+  {}
+  ConverterStats(const ConverterStats&) = delete;
+  ConverterStats& operator=(const ConverterStats&) = delete;
+
+  Timer start() const { return Timer{std::chrono::steady_clock::now()}; }
+
+  void recordConvert(const Timer& timer)
+  {
+    Shard& own = shard();
+    own.conversions.add(1);
+    own.convertNanos.record(elapsed(timer));
+  }
+  void recordBatch(size_t count) { shard().batchConversions.add(count); }
+  void recordPath(size_t hops, bool zeroRate)
+  {
+    Shard& own = shard();
+    own.hops.record(hops);
+    own.rateCalls.add(hops);
+    if (zeroRate)
+      own.zeroRates.add(1);
+  }
+  void recordUnreachable() { shard().unreachable.add(1); }
+  void recordRateCalls(size_t count) { shard().rateCalls.add(count); }
+  void recordInitPhase(InitPhase phase, const Timer& timer)
+  {
+    mLastInitPhase[static_cast<size_t>(phase)].store(elapsed(timer), std::memory_order_relaxed);
+  }
+  void recordInit(const Timer& timer) { shard().initNanos.record(elapsed(timer)); }
+
+  ConverterStatsSnapshot snapshot() const
+  {
+    ConverterStatsSnapshot result;
+    std::lock_guard<std::mutex> lock(mShardsMutex);
+    for (const auto& owned : mShards)
+    {
+      const Shard& shard = *owned.second;
+      result.conversions += shard.conversions.get();
+      result.batchConversions += shard.batchConversions.get();
+      result.unreachable += shard.unreachable.get();
+      result.zeroRates += shard.zeroRates.get();
+      result.rateCalls += shard.rateCalls.get();
+      shard.convertNanos.addTo(result.convertNanos);
+      shard.hops.addTo(result.hops);
+      shard.initNanos.addTo(result.initNanos);
+    }
+    for (size_t phase = 0; phase < initPhaseCount; ++phase)
+      result.lastInitPhaseNanos[phase] = mLastInitPhase[phase].load(std::memory_order_relaxed);
+    return result;
+  }
+
+private:
+  // written by the owner thread only, read by snapshot()
+  class Counter
+  {
+  public:
+    void add(uint64_t count)
+    {
+      mValue.store(mValue.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+    void raise(uint64_t value)
+    {
+      if (value > mValue.load(std::memory_order_relaxed))
+        mValue.store(value, std::memory_order_relaxed);
+    }
+    uint64_t get() const { return mValue.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> mValue{0};
+  };
+
+  struct ShardHistogram
+  {
+    std::array<Counter, Histogram::bucketCount> counts;
+    Counter sum;
+    Counter max;
+    void record(uint64_t value)
+    {
+      counts[Histogram::bucket(value)].add(1);
+      sum.add(value);
+      max.raise(value);
+    }
+    void addTo(Histogram& histogram) const { histogram.add(counts, sum.get(), max.get()); }
+  };
+
+  struct Shard
+  {
+    Counter conversions;
+    Counter batchConversions;
+    Counter unreachable;
+    Counter zeroRates;
+    Counter rateCalls;
+    ShardHistogram convertNanos;
+    ShardHistogram hops;
+    ShardHistogram initNanos;
+  };
+
+  static std::atomic<uint64_t>& nextId()
+  {
+    static std::atomic<uint64_t> id{1};
+    return id;
+  }
+
+  static uint64_t elapsed(const Timer& timer)
+  {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - timer.start).count());
+  }
+
+  // shard of the calling thread; each thread remembers the last stats it
+  // wrote to, others are looked up by thread id under the mutex
+  Shard& shard()
+  {
+    struct LastShard
+    {
+      uint64_t owner{0};
+      Shard* shard{nullptr};
+    };
+    thread_local LastShard last;
+    if (last.owner == mId)
+      return *last.shard;
+    const std::thread::id thread = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(mShardsMutex);
+    Shard* found = nullptr;
+    for (const auto& owned : mShards)
+      if (owned.first == thread)
+        found = owned.second.get();
+    if (!found)
+    {
+      mShards.emplace_back(thread, std::unique_ptr<Shard>(new Shard()));
+      found = mShards.back().second.get();
+    }
+    last.owner = mId;
+    last.shard = found;
+    return *found;
+  }
+
+  // ids aren't reused, unlike addresses, so a thread can't mistake new
+  // stats for destroyed ones it wrote to
+  const uint64_t mId;
+  mutable std::mutex mShardsMutex;
+  std::vector<std::pair<std::thread::id, std::unique_ptr<Shard>>> mShards;
+  std::array<std::atomic<uint64_t>, initPhaseCount> mLastInitPhase{};
+};
@@ -0,0 +1,358 @@
+#pragma once
+
+#include "converter.h"
+
+// Two-level routing for universes too big for N x N path tables: init()
+// keeps the direct rates of every currency plus, for each of a few hubs, a
+// BFS tree of fewest-hop paths from every currency to that hub, O(N * H)
+// memory and O(H * (N + R)) time. convert() takes a direct rate if there
+// is one, otherwise the shortest of the paths from -> hub -> to, with the
+// part both legs share cut off, if it is at most max hops long.
+// Paths aren't always the fewest-hop ones: a pair whose shortest path
+// avoids every hub goes the longer way through the best hub, and a pair
+// with no hub within max hops of both sides, e.g. in a component without
+// hubs, converts only over a direct rate. hops() reports path lengths,
+// e.g. to measure the stretch on a given rate graph. refreshRates() takes
+// the values of all rates at one moment, O(R), and convert() composes pairs
+// from them on demand. Pair rates are never stored, so this isn't an
+// IConverter: it has no RateSnapshot of all pairs to give
+template <class RateSource = FunctionRates>
+class BasicHubConverter
+{
+public:
+  // longest path convert() can take
+  static const size_t maxHopLimit{64};
+
+  // 'curCount' - minimal universe size
+  explicit BasicHubConverter(size_t curCount = 0)
+    : mMinCurCount(curCount)
+  {
+  }
+
+  // hubs for next init(), ids outside the rate set are skipped. Empty
+  // (default) - 'hubCount' most quoted currencies
+  void setHubs(const std::vector<CurId>& hubs) { mHubIds = hubs; }
+  void setHubCount(size_t hubCount) { mHubCount = hubCount; }
+  // longest path convert() takes, 1..maxHopLimit
+  void setMaxHops(size_t maxHops)
+  {
+    if (maxHops == 0 || maxHops > maxHopLimit)
+      throw std::invalid_argument("HubConverter: max hops must be 1.." + std::to_string(maxHopLimit));
+    mMaxHops = maxHops;
+  }
+
+  void init(const std::vector<ConvertRate>& rates)
+  {
+    size_t curCount = mMinCurCount;
+    for (const auto& rate : rates)
+      curCount = std::max<size_t>(curCount, std::max(rate.from, rate.to) + 1);
+    if (curCount >= nocur)
+      throw std::out_of_range("HubConverter: currency id doesn't fit into 32-bit index");
+    mCurCount = curCount;
+    mUseSnapshot = false;
+
+    mRates.clear();
+    mRates.reserve(rates.size() + 1);
+    mRates.push_back([]() { return 0.0; }); // add dummy fn
+    // direct rates of every currency sorted by neighbour, as compressed
+    // sparse row; a repeated rate between same currencies overrides
+    // previous one
+    mOffsets.assign(curCount + 1, 0);
+    for (const auto& rate : rates)
+    {
+      mRates.push_back(rate.rateFn);
+      ++mOffsets[rate.from + 1];
+      ++mOffsets[rate.to + 1];
+    }
+    for (size_t cur = 0; cur < curCount; ++cur)
+      mOffsets[cur + 1] += mOffsets[cur];
+    mEdges.resize(mOffsets[curCount]);
+    {
+      std::vector<size_t> filled(mOffsets.begin(), mOffsets.end() - 1);
+      int32_t rateId = 0;
+      for (const auto& rate : rates)
+      {
+        ++rateId;
+        mEdges[filled[rate.from]++] = Edge{static_cast<uint32_t>(rate.to), rateId};
+        mEdges[filled[rate.to]++] = Edge{static_cast<uint32_t>(rate.from), -rateId};
+      }
+    }
+    size_t kept = 0;
+    for (size_t cur = 0; cur < curCount; ++cur)
+    {
+      const auto begin = mEdges.begin() + mOffsets[cur];
+      const auto end = mEdges.begin() + mOffsets[cur + 1];
+      std::sort(begin, end, [](const Edge& a, const Edge& b)
+      {
+        return a.cur != b.cur ? a.cur < b.cur : std::abs(a.rateId) < std::abs(b.rateId);
+      });
+      mOffsets[cur] = kept;
+      for (auto it = begin; it != end; ++it)
+        if (it + 1 == end || (it + 1)->cur != it->cur)
+          mEdges[kept++] = *it;
+    }
+    mOffsets[curCount] = kept;
+    mEdges.resize(kept);
+
+    chooseHubs(curCount);
+    computeHubPaths(curCount);
+  }
+
+  // exchanges 'value' amount of currency 'from' to currency 'to' in
+  // O(log D + H * L) time, D - direct rates of 'from', L - max hops
+  double convert(double value, CurId from, CurId to)
+  {
+    const double totalRate = mUseSnapshot ? pathRate(from, to, snapshotRates()) : pathRate(from, to, liveRates());
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+    return finalValue;
+  }
+
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    if (mUseSnapshot)
+      return convertRuns(values, from, to, out, count, snapshotRates());
+    convertRuns(values, from, to, out, count, liveRates());
+  }
+
+  // takes every rate once, convert() composes pairs from these values until
+  // next init() or refreshRates(); O(R), no N x N table
+  uint64_t refreshRates()
+  {
+    mSnapshotRates.resize(mRates.size());
+    for (size_t rateId = 1; rateId < mRates.size(); ++rateId)
+      mSnapshotRates[rateId] = mRates.get(static_cast<int32_t>(rateId));
+    mUseSnapshot = true;
+    return ++mEpoch;
+  }
+
+  // refreshRates() calls so far, 0 - none yet
+  uint64_t epoch() const { return mEpoch; }
+
+  // hops of the path convert() takes, 0 if it can't convert
+  size_t hops(CurId from, CurId to) const
+  {
+    const Route route = findRoute(from, to);
+    return route.hops == noroute ? 0 : route.hops;
+  }
+  // hubs of the last init()
+  std::vector<CurId> hubs() const { return std::vector<CurId>(mHubs.begin(), mHubs.end()); }
+
+  // bytes taken by direct rates and hub paths
+  size_t tableSize() const
+  {
+    return mOffsets.capacity() * sizeof(size_t) + mEdges.capacity() * sizeof(Edge)
+           + mHubHops.capacity() * sizeof(HubHop) + mSnapshotRates.capacity() * sizeof(double);
+  }
+  // rate values, e.g. slots to push prices into for SlotRates
+  RateSource& rateSource() { return mRates; }
+
+private:
+  static const uint32_t nocur{std::numeric_limits<uint32_t>::max()};
+  static const uint32_t noroute{std::numeric_limits<uint32_t>::max()};
+
+  // direct rate to 'cur', negative id - inverse rate
+  struct Edge
+  {
+    uint32_t cur;
+    int32_t rateId;
+  };
+  // step of a currency towards a hub: next currency, the rate of the step
+  // (negative id - inverse), remaining hops; hub itself has 0 hops
+  struct HubHop
+  {
+    uint32_t nextCur{nocur};
+    int32_t rateId{0};
+    uint32_t hops{noroute};
+  };
+  // direct rate (hub == nocur) or a path through hub 'hub' meeting at 'join'
+  struct Route
+  {
+    uint32_t hops{noroute};
+    uint32_t hub{nocur};
+    uint32_t join{nocur};
+    int32_t rateId{0};
+  };
+
+  void chooseHubs(size_t curCount)
+  {
+    mHubs.clear();
+    for (const CurId hub : mHubIds)
+      if (hub < curCount && std::find(mHubs.begin(), mHubs.end(), hub) == mHubs.end())
+        mHubs.push_back(static_cast<uint32_t>(hub));
+    if (!mHubIds.empty())
+      return;
+    std::vector<uint32_t> byDegree(curCount);
+    for (size_t cur = 0; cur < curCount; ++cur)
+      byDegree[cur] = static_cast<uint32_t>(cur);
+    const size_t hubCount = std::min(mHubCount, curCount);
+    std::partial_sort(byDegree.begin(), byDegree.begin() + hubCount, byDegree.end(),
+      [this](uint32_t a, uint32_t b)
+      {
+        const size_t degreeA = mOffsets[a + 1] - mOffsets[a];
+        const size_t degreeB = mOffsets[b + 1] - mOffsets[b];
+        return degreeA != degreeB ? degreeA > degreeB : a < b;
+      });
+    for (size_t i = 0; i < hubCount; ++i)
+      if (mOffsets[byDegree[i] + 1] != mOffsets[byDegree[i]])
+        mHubs.push_back(byDegree[i]);
+  }
+
+  // BFS from every hub up to max hops deep, a currency steps towards the
+  // hub through the currency it was found from
+  void computeHubPaths(size_t curCount)
+  {
+    const size_t hubCount = mHubs.size();
+    mHubHops.assign(curCount * hubCount, HubHop());
+    std::vector<uint32_t> queue(curCount);
+    for (size_t h = 0; h < hubCount; ++h)
+    {
+      const uint32_t hub = mHubs[h];
+      mHubHops[hub * hubCount + h].hops = 0;
+      size_t tail = 0;
+      queue[tail++] = hub;
+      for (size_t head = 0; head < tail; ++head)
+      {
+        const uint32_t cur = queue[head];
+        const uint32_t hops = mHubHops[cur * hubCount + h].hops;
+        if (hops == mMaxHops)
+          continue;
+        for (size_t i = mOffsets[cur]; i < mOffsets[cur + 1]; ++i)
+        {
+          HubHop& next = mHubHops[mEdges[i].cur * hubCount + h];
+          if (next.hops != noroute)
+            continue;
+          // edge cur -> next reversed
+          next = HubHop{cur, -mEdges[i].rateId, hops + 1};
+          queue[tail++] = mEdges[i].cur;
+        }
+      }
+    }
+  }
+
+  // direct rate id from 'from' to 'to', 0 if none
+  int32_t directRate(CurId from, CurId to) const
+  {
+    const Edge* begin = mEdges.data() + mOffsets[from];
+    const Edge* end = mEdges.data() + mOffsets[from + 1];
+    const Edge* it = std::lower_bound(begin, end, to, [](const Edge& edge, CurId cur) { return edge.cur < cur; });
+    return it == end || it->cur != to ? 0 : it->rateId;
+  }
+
+  const HubHop& hubHop(uint32_t cur, size_t hub) const { return mHubHops[cur * mHubs.size() + hub]; }
+
+  Route findRoute(CurId from, CurId to) const
+  {
+    Route best;
+    if (from >= mCurCount || to >= mCurCount)
+      return best;
+    const int32_t direct = directRate(from, to);
+    if (direct)
+      return Route{from == to ? 0u : 1u, nocur, nocur, direct};
+    if (from == to)
+      return best;
+    for (size_t h = 0; h < mHubs.size(); ++h)
+    {
+      uint32_t a = static_cast<uint32_t>(from);
+      uint32_t b = static_cast<uint32_t>(to);
+      if (hubHop(a, h).hops == noroute || hubHop(b, h).hops == noroute)
+        continue;
+      const uint32_t length = hubHop(a, h).hops + hubHop(b, h).hops;
+      // both legs climb the same tree, they meet where they first share
+      // a currency
+      while (hubHop(a, h).hops > hubHop(b, h).hops)
+        a = hubHop(a, h).nextCur;
+      while (hubHop(b, h).hops > hubHop(a, h).hops)
+        b = hubHop(b, h).nextCur;
+      while (a != b)
+      {
+        a = hubHop(a, h).nextCur;
+        b = hubHop(b, h).nextCur;
+      }
+      const uint32_t hops = length - 2 * hubHop(a, h).hops;
+      if (hops <= mMaxHops && (best.hops == noroute || hops < best.hops))
+        best = Route{hops, static_cast<uint32_t>(h), a, 0};
+    }
+    return best;
+  }
+
+  // rate values by positive id: asked from the source or taken by the
+  // last refreshRates()
+  struct LiveRates
+  {
+    const RateSource& rates;
+    double operator()(int32_t rateId) const { return rates.get(rateId); }
+  };
+  struct SnapshotRates
+  {
+    const double* values;
+    double operator()(int32_t rateId) const { return values[rateId]; }
+  };
+  LiveRates liveRates() const { return LiveRates{mRates}; }
+  SnapshotRates snapshotRates() const { return SnapshotRates{mSnapshotRates.data()}; }
+
+  template <class RateOf>
+  static double edgeRate(int32_t rateId, double totalRate, const RateOf& rateOf)
+  {
+    if (rateId > 0)
+      return totalRate * rateOf(rateId);
+    const double rate = rateOf(-rateId);
+    return rate == 0 ? 0.0 : totalRate / rate;
+  }
+
+  // amounts usually come in runs of the same pair, a run takes one path
+  template <class RateOf>
+  void convertRuns(const double* values, const CurId* from, const CurId* to,
+                   double* out, size_t count, const RateOf& rateOf) const
+  {
+    double totalRate = 0.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (i == 0 || from[i] != from[i - 1] || to[i] != to[i - 1])
+        totalRate = pathRate(from[i], to[i], rateOf);
+      out[i] = values[i] * totalRate;
+    }
+  }
+
+  // product of rates along the route in path order, 0 if there is none
+  template <class RateOf>
+  double pathRate(CurId from, CurId to, const RateOf& rateOf) const
+  {
+    const Route route = findRoute(from, to);
+    if (route.hops == noroute)
+      return 0.0d;
+    if (route.hub == nocur)
+      return from == to ? 1.0d : edgeRate(route.rateId, 1.0d, rateOf);
+    double totalRate = 1.0d;
+    // up from 'from' to the join follows steps towards the hub
+    for (uint32_t cur = static_cast<uint32_t>(from); cur != route.join; cur = hubHop(cur, route.hub).nextCur)
+      totalRate = edgeRate(hubHop(cur, route.hub).rateId, totalRate, rateOf);
+    // down from the join to 'to' takes the steps of 'to' back, in reverse
+    int32_t down[maxHopLimit];
+    size_t downHops = 0;
+    for (uint32_t cur = static_cast<uint32_t>(to); cur != route.join; cur = hubHop(cur, route.hub).nextCur)
+      down[downHops++] = -hubHop(cur, route.hub).rateId;
+    while (downHops)
+      totalRate = edgeRate(down[--downHops], totalRate, rateOf);
+    return totalRate;
+  }
+
+  const size_t mMinCurCount;
+  size_t mCurCount{0};
+  std::vector<CurId> mHubIds;
+  size_t mHubCount{4};
+  size_t mMaxHops{8};
+  RateSource mRates;
+  std::vector<size_t> mOffsets;
+  std::vector<Edge> mEdges;
+  std::vector<uint32_t> mHubs;
+  // currency-major: steps of currency 'cur' towards all hubs are together
+  std::vector<HubHop> mHubHops;
+  // values of all rates taken by refreshRates(), by rate id
+  std::vector<double> mSnapshotRates;
+  uint64_t mEpoch{0};
+  bool mUseSnapshot{false};
+};
+
+using HubConverter = BasicHubConverter<FunctionRates>;
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "converter.h"
+
+// Dense index of a currency interned by InterningConverter::handle()
+struct CurHandle
+{
+  uint16_t index;
+  static const uint16_t none{std::numeric_limits<uint16_t>::max()};
+  bool valid() const { return index != none; }
+};
+
+// Orders of dense indices CurrencyIndex gives to currencies:
+// ID - ascending external ids;
+// HUB_FIRST - most quoted currencies first, rows and columns of hubs most
+// paths go through share the first lines and pages of path tables;
+// RCM - reverse Cuthill-McKee, currencies quoted against each other get
+// close indices, so hops of a path stay within a band of rows
+enum class CurOrder { ID, HUB_FIRST, RCM };
+
+// Sorted flat table of external currency ids, lookup is a binary search
+// over contiguous ids, O(log N), then the dense index of that position
+class CurrencyIndex
+{
+public:
+  void assign(const std::vector<ConvertRate>& rates, CurOrder order = CurOrder::ID)
+  {
+    mIds.clear();
+    mIds.reserve(2 * rates.size());
+    for (const auto& rate : rates)
+    {
+      mIds.push_back(rate.from);
+      mIds.push_back(rate.to);
+    }
+    std::sort(mIds.begin(), mIds.end());
+    mIds.erase(std::unique(mIds.begin(), mIds.end()), mIds.end());
+    if (mIds.size() >= CurHandle::none)
+      throw std::out_of_range("CurrencyIndex: more currencies than 16-bit handles");
+    // dense index of every position, ID order unless relabelled below
+    mIndices.resize(mIds.size());
+    for (size_t i = 0; i < mIds.size(); ++i)
+      mIndices[i] = static_cast<uint16_t>(i);
+    if (order == CurOrder::HUB_FIRST)
+      orderHubsFirst(rates);
+    else if (order == CurOrder::RCM)
+      orderCuthillMcKee(rates);
+    mIdsByIndex.resize(mIds.size());
+    for (size_t i = 0; i < mIds.size(); ++i)
+      mIdsByIndex[mIndices[i]] = mIds[i];
+  }
+
+  CurHandle find(CurId id) const
+  {
+    auto it = std::lower_bound(mIds.begin(), mIds.end(), id);
+    if (it == mIds.end() || *it != id)
+      return CurHandle{CurHandle::none};
+    return CurHandle{mIndices[it - mIds.begin()]};
+  }
+
+  // external id of 'handle', which must be valid
+  CurId id(CurHandle handle) const { return mIdsByIndex[handle.index]; }
+  size_t size() const { return mIds.size(); }
+
+private:
+  // position of the currency in mIds
+  size_t position(CurId id) const { return std::lower_bound(mIds.begin(), mIds.end(), id) - mIds.begin(); }
+
+  std::vector<size_t> degrees(const std::vector<ConvertRate>& rates) const
+  {
+    std::vector<size_t> degree(mIds.size(), 0);
+    for (const auto& rate : rates)
+    {
+      ++degree[position(rate.from)];
+      ++degree[position(rate.to)];
+    }
+    return degree;
+  }
+
+  // by degree descending, ties by id
+  void orderHubsFirst(const std::vector<ConvertRate>& rates)
+  {
+    const std::vector<size_t> degree = degrees(rates);
+    std::vector<uint16_t> order(mIndices);
+    std::stable_sort(order.begin(), order.end(),
+                     [&degree](uint16_t a, uint16_t b) { return degree[a] > degree[b]; });
+    for (size_t i = 0; i < order.size(); ++i)
+      mIndices[order[i]] = static_cast<uint16_t>(i);
+  }
+
+  // BFS of every component from its least quoted currency, neighbours by
+  // degree ascending, then the whole order reversed. O(R log R)
+  void orderCuthillMcKee(const std::vector<ConvertRate>& rates)
+  {
+    const size_t count = mIds.size();
+    const std::vector<size_t> degree = degrees(rates);
+    std::vector<size_t> offsets(count + 1, 0);
+    for (size_t cur = 0; cur < count; ++cur)
+      offsets[cur + 1] = offsets[cur] + degree[cur];
+    std::vector<uint16_t> neighbours(offsets[count]);
+    std::vector<size_t> filled(offsets.begin(), offsets.end() - 1);
+    for (const auto& rate : rates)
+    {
+      const size_t from = position(rate.from);
+      const size_t to = position(rate.to);
+      neighbours[filled[from]++] = static_cast<uint16_t>(to);
+      neighbours[filled[to]++] = static_cast<uint16_t>(from);
+    }
+    auto byDegree = [&degree](uint16_t a, uint16_t b)
+    {
+      return degree[a] != degree[b] ? degree[a] < degree[b] : a < b;
+    };
+    for (size_t cur = 0; cur < count; ++cur)
+      std::sort(neighbours.begin() + offsets[cur], neighbours.begin() + offsets[cur + 1], byDegree);
+    std::vector<uint16_t> starts(mIndices);
+    std::sort(starts.begin(), starts.end(), byDegree);
+
+    std::vector<bool> visited(count, false);
+    std::vector<uint16_t> order;
+    order.reserve(count);
+    for (const uint16_t start : starts)
+    {
+      if (visited[start])
+        continue;
+      visited[start] = true;
+      order.push_back(start);
+      for (size_t head = order.size() - 1; head < order.size(); ++head)
+      {
+        const uint16_t cur = order[head];
+        for (size_t i = offsets[cur]; i < offsets[cur + 1]; ++i)
+        {
+          if (visited[neighbours[i]])
+            continue;
+          visited[neighbours[i]] = true;
+          order.push_back(neighbours[i]);
+        }
+      }
+    }
+    for (size_t i = 0; i < count; ++i)
+      mIndices[order[i]] = static_cast<uint16_t>(count - 1 - i);
+  }
+
+  std::vector<CurId> mIds;
+  // dense index of mIds[i]
+  std::vector<uint16_t> mIndices;
+  std::vector<CurId> mIdsByIndex;
+};
+
+// Lets engines work with large sparse currency ids (e.g. from a symbol
+// master): init() interns all ids of the rate set into dense 16-bit
+// handles and 'Engine' only ever sees those. convert() takes either
+// external ids, looked up per call, or pre-interned handles, which go
+// straight to the engine. Snapshot is indexed by handles
+template <class Engine>
+class InterningConverter : public IConverter
+{
+public:
+  // order of handles given by next init() (see CurOrder), ID by default.
+  // Callers see no difference but speed: conversions between the same
+  // external ids give the same results in any order
+  void setOrder(CurOrder order) { mOrder = order; }
+
+  void init(const std::vector<ConvertRate>& rates)
+  {
+    mIndex.assign(rates, mOrder);
+    std::vector<ConvertRate> denseRates;
+    denseRates.reserve(rates.size());
+    for (const auto& rate : rates)
+      denseRates.push_back({mIndex.find(rate.from).index, mIndex.find(rate.to).index, rate.rateFn});
+    mEngine.init(denseRates);
+  }
+
+  double convert(double value, CurId from, CurId to)
+  {
+    return convert(value, handle(from), handle(to));
+  }
+
+  // fast path, no lookups
+  double convert(double value, CurHandle from, CurHandle to)
+  {
+    if (!from.valid() || !to.valid())
+      return 0.0;
+    return mEngine.convert(value, from.index, to.index);
+  }
+
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    // invalid handles are out of engine's universe and convert to 0
+    std::vector<CurId> denseIds(2 * count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      denseIds[i] = handle(from[i]).index;
+      denseIds[count + i] = handle(to[i]).index;
+    }
+    mEngine.convertBatch(values, denseIds.data(), denseIds.data() + count, out, count);
+  }
+
+  uint64_t refreshRates() { return mEngine.refreshRates(); }
+  const RateSnapshot& snapshot() const { return mEngine.snapshot(); }
+
+  // interns external id, invalid handle if the id isn't in the rate set
+  CurHandle handle(CurId id) const { return mIndex.find(id); }
+  const CurrencyIndex& currencies() const { return mIndex; }
+  Engine& engine() { return mEngine; }
+
+private:
+  CurOrder mOrder{CurOrder::ID};
+  CurrencyIndex mIndex;
+  Engine mEngine;
+};
@@ -1,279 +1,25 @@
-#include <iostream>
 #include <cassert>
-#include <functional>
-#include <limits>
-#include <list>
-#include <memory>
-#include <unordered_map>
-#include <vector>
-
-const uint32_t MAX_CUR_NUMBER = 5;
-using CurId = uint64_t; // 1..2000
-using RateFn = std::function<double()>; // Return 0 if rate is not available;
-
-struct ConvertRate
-{
-  CurId  from;
-  CurId  to;
-  RateFn rateFn;
-};
-
-class IConverter
-{
-public:
-  // precomputes all optimal pathes to calculate conversion rate between
-  // any currency pair, if such conversion possible
-  virtual void init(const std::vector<ConvertRate>& _rates) =0;
-  virtual double convert(double value, CurId from, CurId to) =0;
-  virtual ~IConverter() {}
-};
-
-// This implementation is faster on sparse graphs
-class Converter : public IConverter
-{
-public:
-  Converter()
-  {
-  }
-
-  // Takes O(R * N^2) time and O(N^2) memory, where N - number of currencies
-  // and R - number of currency rates
-  // In worst case R = N^2, so overall complexity O(N^4)
-  void init(const std::vector<ConvertRate>& _rates)
-  {
-    Cell defaultCell;
-    for (size_t i = 0; i < MAX_CUR_NUMBER; ++i)
-      for (size_t j = 0; j < MAX_CUR_NUMBER; ++j)
-        rate_table[i][j] = defaultCell;
-
-    rates.reserve(_rates.size() + 1);
-    rates.push_back([]() { return 0.0; }); // add dummy fn
-
-    using Distance = uint32_t;
-    // minimal conversion distance between two currencies
-    std::vector<std::vector<Distance>> distance(MAX_CUR_NUMBER);
-    // max distance meaning that two currencies can't be converted
-    const Distance unreachable = std::numeric_limits<Distance>::max();
-    for (size_t i = 0; i < MAX_CUR_NUMBER; ++i)
-    {
-      distance[i].assign(MAX_CUR_NUMBER, unreachable);
-      distance[i][i] = 0;
-    }
-    for (const auto& rate : _rates)
-    {
-      const CurId from = rate.from;
-      const CurId to = rate.to;
-      int32_t newRateId = static_cast<int32_t>(rates.size());
-      rates.push_back(rate.rateFn);
-      rate_table[from][to].rateId = newRateId;
-      rate_table[to][from].rateId = -newRateId;
-
-      for (size_t i = 0; i < MAX_CUR_NUMBER; ++i)
-      {
-        for (size_t j = 0; j < MAX_CUR_NUMBER; ++j)
-        {
-          if (distance[from][i] != unreachable && distance[to][j] != unreachable)
-          {
-            Distance new_distance = distance[from][i] + distance[to][j] + 1;
-            if (new_distance >= distance[i][j])
-              continue;
-            distance[i][j] = distance[j][i] = new_distance;
-            rate_table[i][j].nextCur = i != from ? rate_table[i][from].nextCur : to;
-            rate_table[j][i].nextCur = j != to ? rate_table[j][to].nextCur : from;
-          }
-        }
-      }
-    }
-  }
-
-  // exchanges 'value' amount of currency 'from' to currency 'to' in O(N) time,
-  // where N is minimal possible number of intermediate conversions
-  double convert(double value, CurId from, CurId to)
-  {
-    if (rate_table[from][to].nextCur == MAX_CUR_NUMBER)
-      return 0.0d;
-    double totalRate = 1.0d;
-    CurId prevCur = from;
-    CurId nextCur = from;
-    do
-    {
-      nextCur = rate_table[prevCur][to].nextCur;
-      int32_t rateId = rate_table[prevCur][nextCur].rateId;
-      if (rateId > 0)
-      {
-        totalRate *= rates[rateId]();
-      }
-      else
-      {
-        double rate = rates[-rateId]();
-        if (rate == 0)
-          totalRate = 0;
-        else
-          totalRate /= rates[-rateId]();
-      }
-      prevCur = nextCur;
-    } while (nextCur != to);
-
-	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
-	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
-    return finalValue;
-  }
-
-private:
-  struct Cell
-  {
-    int32_t rateId;
-    static const int32_t norate{0};
-    CurId nextCur;
-    Cell()
-      : rateId(norate)
-      , nextCur(MAX_CUR_NUMBER)
-    {}
-  };
-  Cell rate_table[2000][2000];
-  std::vector<RateFn> rates;
-};
-
-class BFSConverter : public IConverter
-{
-public:
-  BFSConverter()
-  {
-  }
-
-  void init(const std::vector<ConvertRate>& rates)
-  {
-    mRates.clear();
-    mPaths.clear();
-    // add to mPaths all direct convert rates
-    // and init mRates
-    // complexity is O(R), worst case O(N^2)
-    std::vector<std::list<CurId>> connections; // sparce matrix
-    mRates.reserve(rates.size() + 1);
-    mRates.push_back([]() { return 0.0; }); // add dummy fn
-    mPaths.resize(MAX_CUR_NUMBER);
-    connections.resize(MAX_CUR_NUMBER);
-    for (const auto& rate : rates)
-    {
-      int32_t newRateId = static_cast<int32_t>(mRates.size());
-      mRates.push_back(rate.rateFn);
-
-      const CurId from = rate.from;
-      const CurId to = rate.to;
-      mPaths[from][to] = Cell(to, newRateId);
-      mPaths[to][from] = Cell(from, -newRateId);
-      connections[from].emplace_back(to);
-      connections[to].emplace_back(from);
-    }
-
-    // Do BFS from each node to find all shortest paths
-    // thus complexity is O(N(N + R)) = O(N^3)
-    std::vector<CurId> visitedNodes(MAX_CUR_NUMBER, MAX_CUR_NUMBER);
-    for (CurId from = 0; from < connections.size(); ++from)
-    {
-      visitedNodes[from] = from;
-      using NextCur = std::pair<CurId, CurId>;
-      std::list<NextCur> nextToVisitCurs;
-      for (const auto& nextCur : connections[from])
-      {
-        nextToVisitCurs.push_back(NextCur(nextCur, nextCur));
-        visitedNodes[nextCur] = from;
-      }
-      auto nextIt = nextToVisitCurs.begin();
-      while (nextIt != nextToVisitCurs.end())
-      {
-        const CurId visitingId = nextIt->first;
-        visitedNodes[visitingId] = from;
-        for(const auto& nextCur : connections[visitingId])
-        {
-          if (visitedNodes[nextCur] != from)
-          {
-            visitedNodes[nextCur] = from;
-            nextToVisitCurs.emplace_back(nextCur, nextIt->second);
-            mPaths[from][nextCur] = Cell(nextIt->second, Cell::norate);
-          }
-        }
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
 
-        ++nextIt;
-        nextToVisitCurs.pop_front();
-      }
-    }
-  }
+#include <atomic>
+#include <thread>
 
-  // exchanges 'value' amount of currency 'from' to currency 'to' in O(N) time,
-  // where N is minimal possible number of intermediate conversions
-  double convert(double value, CurId from, CurId to)
-  {
-    if (mPaths[from].count(to) == 0)
-      return 0.0d;
-    if (from == to)
-      return value;
-    double totalRate = 1.0d;
-    CurId prevCur = from;
-    CurId nextCur = from;
-    do
-    {
-      nextCur = mPaths[prevCur][to].nextCur;
-      int32_t rateId = mPaths[prevCur][nextCur].rateId;
-      if (rateId > 0)
-      {
-        totalRate *= mRates[rateId]();
-      }
-      else
-      {
-        double rate = mRates[-rateId]();
-        if (rate == 0)
-          totalRate = 0;
-        else
-          totalRate /= mRates[-rateId]();
-      }
-      prevCur = nextCur;
-    } while (nextCur != to);
-
-	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
-	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
-    return finalValue;
-  }
-
-private:
-  struct Cell
-  {
-    int32_t rateId;
-    static const int32_t norate{0};
-    CurId nextCur;
-    Cell()
-      : rateId(norate)
-      , nextCur(MAX_CUR_NUMBER)
-    {}
-    Cell(CurId _nextCur, int32_t _rateId)
-      : rateId(_rateId)
-      , nextCur(_nextCur)
-    {}
-  };
-  std::vector<std::unordered_map<CurId, Cell>> mPaths;
-  std::vector<RateFn> mRates;
-};
+#include "async_converter.h"
+#include "best_rate_converter.h"
+#include "concurrent_converter.h"
+#include "conversion_pipeline.h"
+#include "converter.h"
+#include "hub_converter.h"
+#include "interning_converter.h"
+#include "mapped_converter.h"
+#include "quote_converter.h"
+#include "shared_converter.h"
+#include "static_converter.h"
 
-// It's not canonical GOF Factory
-class ConverterFactory
-{
-public:
-  enum class Type { INCREMENTAL, BFS};
-  void setType(Type type) { mType = type; }
-  std::unique_ptr<IConverter> create() const
-  {
-    switch(mType)
-    {
-      case Type::INCREMENTAL:
-        return std::make_unique<Converter>();
-      case Type::BFS:
-        return std::make_unique<BFSConverter>();
-    }
-    return std::make_unique<BFSConverter>();
-  }
-private:
-  Type mType;
-};
+#include <sys/wait.h>
 
 void runTests(const ConverterFactory& factory)
 {
@@ -352,24 +98,1656 @@ void runTests(const ConverterFactory& factory)
   }
   {
     cout << "Test 6 max N smoke";
+    const CurId curCount = 5;
     vector<ConvertRate> rates;
-    for(CurId i = 0; i < MAX_CUR_NUMBER - 1; ++i)
+    for(CurId i = 0; i < curCount - 1; ++i)
     {
       rates.push_back({i, i+1, [](){return 2.0;}});
     };
-    rates.push_back({ MAX_CUR_NUMBER - 1, 0, [](){return 2.0;}});
+    rates.push_back({ curCount - 1, 0, [](){return 2.0;}});
     auto cvt = factory.create();
     cvt->init(rates);
     assert(cvt->convert(100.0, 0, 1)  == 200.0);
-    assert(cvt->convert(100.0, MAX_CUR_NUMBER - 2, 0)  == 400.0);
+    assert(cvt->convert(100.0, curCount - 2, 0)  == 400.0);
     cout << " end" << endl;
   }
+  {
+    cout << "Test 7 batch conversion";
+    vector<ConvertRate> rates{
+      {0,1,[](){return 2.0;}},
+      {1,2,[](){return 3.0;}},
+      {3,4,[](){return 4.0;}}
+    };
+    auto cvt = factory.create();
+    cvt->init(rates);
+    const vector<double> values{100.0, 10.0, 100.0, 600.0, 100.0, 1.0};
+    const vector<CurId>  from  {    0,    0,     1,     2,     0,   3};
+    const vector<CurId>  to    {    1,    1,     0,     0,     3,   4};
+    vector<double> out(values.size());
+    cvt->convertBatch(values.data(), from.data(), to.data(), out.data(), values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+      assert(out[i] == cvt->convert(values[i], from[i], to[i]));
+    assert(out[3] == 100.0);
+    assert(out[4] == 0.0);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Test 8 rate snapshot";
+    double rate01 = 2.0;
+    int calls = 0;
+    vector<ConvertRate> rates{
+      {0,1,[&](){++calls; return rate01;}},
+      {1,2,[&](){++calls; return 3.0;}},
+      {3,2,[&](){++calls; return 4.0;}}
+    };
+    auto cvt = factory.create();
+    cvt->init(rates);
+    assert(cvt->snapshot().epoch == 0);
+    const uint64_t epoch = cvt->refreshRates();
+    assert(epoch == 1 && cvt->snapshot().epoch == epoch);
+    assert(calls == 3);
+    rate01 = 4.0;
+    assert(cvt->convert(100.0, 0, 1) == 200.0);
+    assert(cvt->convert(600.0, 2, 0) == 100.0);
+    assert(cvt->convert( 10.0, 0, 3) == 15.0);
+    assert(cvt->convert( 15.0, 3, 0) == 10.0);
+    assert(cvt->convert(100.0, 0, 4) == 0.0);
+    assert(calls == 3);
+    assert(cvt->refreshRates() == epoch + 1);
+    assert(cvt->convert(100.0, 0, 1) == 400.0);
+    cvt->init(rates);
+    rate01 = 8.0;
+    assert(cvt->convert(100.0, 0, 1) == 800.0);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Test 9 concurrent refresh";
+    std::atomic<double> tick{1.0};
+    vector<ConvertRate> rates{
+      {0,1,[&](){return tick.load();}},
+      {1,2,[&](){return tick.load();}}
+    };
+    ConcurrentConverter cvt(factory);
+    assert(cvt.convert(100.0, 0, 1) == 0.0);
+    assert(cvt.init(rates) == 1);
+    std::atomic<bool> done{false};
+    std::thread writer([&]()
+    {
+      for (int i = 2; i <= 200; ++i)
+      {
+        tick = i;
+        cvt.refreshRates();
+      }
+      done = true;
+    });
+    do
+    {
+      // all hops of one generation come from the same tick
+      const double values[]{1.0, 1.0};
+      const CurId from[]{0, 0};
+      const CurId to[]{1, 2};
+      double out[2];
+      const uint64_t epoch = cvt.convertBatch(values, from, to, out, 2);
+      assert(epoch >= 1 && out[1] == out[0] * out[0]);
+    } while (!done);
+    writer.join();
+    assert(cvt.epoch() == 200);
+    assert(cvt.convert(1.0, 0, 2) == 200.0 * 200.0);
+    assert(cvt.convert(200.0 * 200.0, 2, 0) == 1.0);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Test 10 duplicate rates, the last one wins";
+    vector<ConvertRate> rates{
+      {0,1,[](){return 2.0;}},
+      {1,2,[](){return 5.0;}},
+      {0,1,[](){return 3.0;}}
+    };
+    auto cvt = factory.create();
+    cvt->init(rates);
+    assert(cvt->convert(100.0, 0, 1) == 300.0);
+    assert(cvt->convert(300.0, 1, 0) == 100.0);
+    assert(cvt->convert(100.0, 0, 2) == 1500.0);
+    // a reversed duplicate replaces both directions
+    rates.push_back({1,0,[](){return 0.25;}});
+    cvt->init(rates);
+    assert(cvt->convert(100.0, 0, 1) == 400.0);
+    assert(cvt->convert(100.0, 1, 0) == 25.0);
+    ConverterFactory other;
+    for (auto type : {ConverterFactory::Type::INCREMENTAL, ConverterFactory::Type::BFS,
+                      ConverterFactory::Type::ALL_PAIRS})
+    {
+      other.setType(type);
+      auto otherCvt = other.create();
+      otherCvt->init(rates);
+      for (CurId from = 0; from < 3; ++from)
+        for (CurId to = 0; to < 3; ++to)
+          assert(otherCvt->convert(100.0, from, to) == cvt->convert(100.0, from, to));
+    }
+    cout << " end" << endl;
+  }
+}
+
+// checks that 'cvt' converts every pair of 'curCount' currencies exactly as
+// converter freshly initialized with 'rates'
+void assertSameAsInit(Converter& cvt, const std::vector<ConvertRate>& rates, CurId curCount)
+{
+  Converter fresh;
+  fresh.init(rates);
+  for (CurId from = 0; from < curCount; ++from)
+    for (CurId to = 0; to < curCount; ++to)
+      assert(cvt.convert(100.0, from, to) == fresh.convert(100.0, from, to));
 }
 
-int main()
+void runIncrementalTests()
 {
+  using namespace std;
+  {
+    cout << "Incremental test 1 add rates";
+    vector<ConvertRate> rates{
+      {0,1,[](){return 2.0;}},
+      {1,2,[](){return 3.0;}}
+    };
+    Converter cvt;
+    cvt.init(rates);
+    cvt.addRate({2,3,[](){return 4.0;}});
+    assert(cvt.convert( 10.0, 0, 3) == 240.0);
+    assert(cvt.convert(240.0, 3, 0) == 10.0);
+    cvt.addRate({0,3,[](){return 5.0;}});
+    assert(cvt.convert( 10.0, 0, 3) == 50.0);
+    cvt.addRate({6,3,[](){return 2.0;}});
+    assert(cvt.convert( 10.0, 0, 6) == 25.0);
+    assert(cvt.convert( 10.0, 0, 5) == 0.0);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Incremental test 2 remove rates";
+    vector<ConvertRate> rates{
+      {0,1,[](){return 2.0;}},
+      {1,2,[](){return 3.0;}},
+      {2,3,[](){return 4.0;}},
+      {4,3,[](){return 5.0;}},
+      {0,4,[](){return 6.0;}},
+      {5,6,[](){return 7.0;}},
+    };
+    Converter cvt;
+    cvt.init(rates);
+    assert(cvt.convert(100.0, 0, 3) == 3000.0);
+    assert(!cvt.removeRate(0, 2));
+    assert(cvt.removeRate(3, 4));
+    rates.erase(rates.begin() + 3);
+    assert(cvt.convert(100.0, 0, 3) == 2400.0);
+    assertSameAsInit(cvt, rates, 7);
+    assert(cvt.removeRate(1, 2));
+    rates.erase(rates.begin() + 1);
+    assert(cvt.convert(100.0, 0, 3) == 0.0);
+    assertSameAsInit(cvt, rates, 7);
+    rates.push_back({3,6,[](){return 0.5;}});
+    rates.push_back({6,4,[](){return 0.5;}});
+    cvt.addRate(rates[rates.size() - 2]);
+    cvt.addRate(rates.back());
+    assert(cvt.convert(100.0, 0, 3) == 2400.0);
+    assertSameAsInit(cvt, rates, 7);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Incremental test 3 update flat paths";
+    vector<ConvertRate> rates{
+      {0,1,[](){return 2.0;}},
+      {1,2,[](){return 3.0;}}
+    };
+    Converter cvt;
+    cvt.setFlatPaths(true);
+    cvt.init(rates);
+    cvt.addRate({0,2,[](){return 5.0;}});
+    assert(cvt.convert(10.0, 0, 2) == 50.0);
+    cvt.addRate({2,3,[](){return 4.0;}});
+    assert(cvt.convert(10.0, 3, 0) == 0.5);
+    assert(cvt.removeRate(2, 0));
+    assert(cvt.convert(10.0, 0, 3) == 240.0);
+    cout << " end" << endl;
+  }
+}
+
+void runBFSTests()
+{
+  using namespace std;
+  {
+    cout << "BFS test 1 parallel init";
+    vector<ConvertRate> rates;
+    const CurId curCount = 200;
+    for (CurId i = 1; i < curCount; ++i)
+      rates.push_back({(i * 7919) % i, i, [i](){return 1.0 + i % 5;}});
+    for (CurId i = 0; i < curCount; ++i)
+      rates.push_back({i, (i * i + 3) % curCount, [i](){return 1.0 + i % 3;}});
+    BFSConverter single;
+    single.init(rates);
+    BFSConverter parallel;
+    parallel.setThreadCount(4);
+    parallel.init(rates);
+    for (CurId from = 0; from < curCount; ++from)
+      for (CurId to = 0; to < curCount; ++to)
+        assert(single.convert(100.0, from, to) == parallel.convert(100.0, from, to));
+    assert(parallel.convert(100.0, 0, curCount) == 0.0);
+    cout << " end" << endl;
+  }
+  {
+    cout << "BFS test 2 path storage";
+    // 50 disjoint pairs with repeated rate, then the same pairs chained
+    vector<ConvertRate> rates;
+    for (CurId i = 0; i < 100; i += 2)
+    {
+      rates.push_back({i, i + 1, [](){return 3.0;}});
+      rates.push_back({i + 1, i, [](){return 0.5;}});
+    }
+    for (int connected = 0; connected < 2; ++connected)
+    {
+      if (connected)
+        for (CurId i = 1; i + 1 < 100; i += 2)
+          rates.push_back({i, i + 1, [](){return 4.0;}});
+      BFSConverter autoCvt;
+      DenseBFSConverter dense;
+      SparseBFSConverter sparse;
+      ComponentBFSConverter components;
+      components.setThreadCount(4);
+      autoCvt.init(rates);
+      dense.init(rates);
+      sparse.init(rates);
+      components.init(rates);
+      assert(autoCvt.pathTable().isDense() == (connected != 0));
+      assert(sparse.tableSize() < dense.tableSize() || connected);
+      assert(components.pathTable().componentCount() == (connected ? 1 : 50));
+      assert(components.pathTable().component(99) == (connected ? 0 : 49));
+      assert(components.tableSize() < sparse.tableSize() || connected);
+      for (CurId from = 0; from < 100; ++from)
+        for (CurId to = 0; to < 100; ++to)
+        {
+          const double value = dense.convert(100.0, from, to);
+          assert(sparse.convert(100.0, from, to) == value);
+          assert(components.convert(100.0, from, to) == value);
+          assert(autoCvt.convert(100.0, from, to) == value);
+        }
+      assert(dense.convert(100.0, 0, 1) == 200.0);
+      assert(sparse.convert(100.0, 1, 0) == 50.0);
+      assert(sparse.convert(100.0, 0, 3) == (connected ? 1600.0 : 0.0));
+    }
+    cout << " end" << endl;
+  }
+}
+
+template <class Engine>
+void runSlotRatesTest(const char* name)
+{
+  using namespace std;
+  cout << "Slot rates test " << name;
+  vector<ConvertRate> rates{
+    {0,1,[](){return 2.0;}},
+    {1,2,nullptr},
+    {2,3,[](){return 4.0;}}
+  };
+  Engine cvt;
+  cvt.init(rates);
+  assert(cvt.convert(100.0, 0, 1) == 200.0);
+  assert(cvt.convert(100.0, 0, 3) == 0.0);
+  cvt.rateSource().set(1, 3.0);
+  assert(cvt.convert( 10.0, 0, 3) == 240.0);
+  assert(cvt.convert(240.0, 3, 0) == 10.0);
+  cvt.rateSource().slot(0) = 1.0;
+  cvt.rateSource().set(2, 0.0);
+  assert(cvt.convert( 10.0, 0, 2) == 30.0);
+  assert(cvt.convert( 10.0, 3, 0) == 0.0);
+  cvt.refreshRates();
+  cvt.rateSource().set(0, 5.0);
+  assert(cvt.convert( 10.0, 0, 2) == 30.0);
+  cout << " end" << endl;
+}
+
+void runUniverseTests(ConverterFactory factory)
+{
+  using namespace std;
+  cout << "Universe test sizes";
+  // 30-currency desk sized by its rates
+  vector<ConvertRate> desk;
+  for (CurId i = 1; i < 30; ++i)
+    desk.push_back({0, i, [](){return 2.0;}});
+  auto cvt = factory.create();
+  cvt->init(desk);
+  assert(cvt->convert(100.0, 29, 1) == 100.0);
+  assert(cvt->convert(100.0, 0, 30) == 0.0);
+  assert(cvt->convert(100.0, 5000, 0) == 0.0);
+  // book with 2000 tokens known upfront and only a few of them quoted
+  factory.setCurrencyCount(2000);
+  vector<ConvertRate> book{
+    {1999, 0, [](){return 4.0;}},
+    {0, 1, [](){return 2.0;}}
+  };
+  cvt = factory.create();
+  cvt->init(book);
+  assert(cvt->convert(100.0, 1999, 1) == 800.0);
+  assert(cvt->convert(100.0, 1998, 1) == 0.0);
+  cvt->refreshRates();
+  assert(cvt->snapshot().curCount == 2000);
+  assert(cvt->convert(800.0, 1, 1999) == 100.0);
+  cout << " end" << endl;
+}
+
+void runPricerTests(const ConverterFactory& factory)
+{
+  using namespace std;
+  cout << "Pricer test";
+  vector<ConvertRate> rates{
+    {0, 1, [](){return 2.0;}},
+    {1, 2, [](){return 1.5;}},
+    {3, 2, [](){return 0.25;}},
+    {5, 6, [](){return 8.0;}}
+  };
+  auto cvt = factory.create();
+  cvt->init(rates);
+  vector<double> values;
+  vector<CurId> from, to;
+  for (CurId a = 0; a < 8; ++a)
+    for (CurId b = 0; b < 8; ++b)
+    {
+      values.push_back(10.0 + a);
+      from.push_back(a);
+      to.push_back(b);
+    }
+  factory.withPricer([&](auto& pricer)
+  {
+    pricer.init(rates);
+    vector<double> out(values.size());
+    pricer.convertEach(values.data(), from.data(), to.data(), out.data(), out.size());
+    for (size_t i = 0; i < out.size(); ++i)
+    {
+      assert(out[i] == cvt->convert(values[i], from[i], to[i]));
+      assert(pricer.convert(values[i], from[i], to[i]) == out[i]);
+    }
+    cvt->refreshRates();
+    pricer.refreshRates();
+    for (size_t i = 0; i < out.size(); ++i)
+      assert(pricer.convert(values[i], from[i], to[i]) == cvt->convert(values[i], from[i], to[i]));
+  });
+  cout << " end" << endl;
+}
+
+template <class Engine>
+void runInterningTest(const char* name)
+{
+  using namespace std;
+  cout << "Interning test " << name;
+  const CurId usd = 840000000017;
+  const CurId eur = 978000000003;
+  const CurId jpy = 392000000999;
+  const CurId brl = 986;
+  vector<ConvertRate> rates{
+    {usd, eur, [](){return 0.5;}},
+    {usd, jpy, [](){return 100.0;}},
+    {brl, usd, [](){return 0.25;}}
+  };
+  InterningConverter<Engine> cvt;
+  cvt.init(rates);
+  assert(cvt.currencies().size() == 4);
+  assert(cvt.convert(100.0, usd, eur) == 50.0);
+  assert(cvt.convert(100.0, brl, jpy) == 2500.0);
+  assert(cvt.convert(100.0, usd, 840000000018) == 0.0);
+  const CurHandle jpyHandle = cvt.handle(jpy);
+  const CurHandle brlHandle = cvt.handle(brl);
+  assert(cvt.currencies().id(jpyHandle) == jpy);
+  assert(cvt.convert(2500.0, jpyHandle, brlHandle) == 100.0);
+  assert(cvt.convert(1.0, cvt.handle(1), brlHandle) == 0.0);
+  const vector<double> values{100.0, 2500.0, 1.0};
+  const vector<CurId>  from  {  usd,    jpy,  7};
+  const vector<CurId>  to    {  eur,    brl, usd};
+  vector<double> out(values.size());
+  cvt.convertBatch(values.data(), from.data(), to.data(), out.data(), values.size());
+  assert(out[0] == 50.0 && out[1] == 100.0 && out[2] == 0.0);
+  cout << " end" << endl;
+}
+
+template <class Engine>
+void runCurOrderTest(const char* name)
+{
+  using namespace std;
+  cout << "Currency order test " << name;
+  // two hubs, spokes quoted against one or both, sparse external ids
+  vector<ConvertRate> rates;
+  const CurId usd = 840000000017, eur = 978000000003;
+  rates.push_back({eur, usd, [](){return 1.25;}});
+  for (CurId i = 1; i <= 60; ++i)
+  {
+    const CurId spoke = i * 1000003;
+    rates.push_back({spoke, i % 3 ? usd : eur, [i](){return 0.5 + i % 7;}});
+    if (i % 4 == 0)
+      rates.push_back({eur, spoke, [i](){return 2.0 + i % 5;}});
+  }
+  rates.push_back({5, 6, [](){return 3.0;}});
+  InterningConverter<Engine> byId;
+  byId.init(rates);
+  for (const CurOrder order : {CurOrder::HUB_FIRST, CurOrder::RCM})
+  {
+    InterningConverter<Engine> cvt;
+    cvt.setOrder(order);
+    cvt.init(rates);
+    assert(cvt.currencies().size() == byId.currencies().size());
+    if (order == CurOrder::HUB_FIRST)
+      assert(cvt.handle(usd).index == 0 && cvt.handle(eur).index == 1);
+    vector<bool> seen(cvt.currencies().size(), false);
+    for (const auto& rate : rates)
+      for (const CurId id : {rate.from, rate.to})
+      {
+        assert(cvt.currencies().id(cvt.handle(id)) == id);
+        seen[cvt.handle(id).index] = true;
+      }
+    assert(find(seen.begin(), seen.end(), false) == seen.end());
+    for (const auto& a : rates)
+      for (const auto& b : rates)
+        assert(cvt.convert(100.0, a.from, b.to) == byId.convert(100.0, a.from, b.to));
+    assert(cvt.convert(100.0, usd, 7) == 0.0 && cvt.convert(100.0, 6, 5) == byId.convert(100.0, 6, 5));
+  }
+  cout << " end" << endl;
+}
+
+// 'curCount' currencies linked by a deterministic pseudo-random set of rates
+std::vector<ConvertRate> scatteredRates(CurId curCount)
+{
+  std::vector<ConvertRate> rates;
+  for (CurId i = 1; i < curCount; ++i)
+    rates.push_back({(i * 7919) % i, i, [i](){return 1.0 + i % 5;}});
+  for (CurId i = 0; i < curCount; i += 3)
+    rates.push_back({i, (i * i + 3) % curCount, [i](){return 1.0 + i % 3;}});
+  // separate component
+  rates.push_back({curCount + 1, curCount + 2, [](){return 2.0;}});
+  return rates;
+}
+
+// scatteredRates() with every currency priced 2^k, so any path between
+// two currencies gives exactly the same product
+std::vector<ConvertRate> consistentRates(CurId curCount)
+{
+  auto rates = scatteredRates(curCount);
+  for (auto& rate : rates)
+  {
+    const double ratio = std::ldexp(1.0, int(rate.to % 7) - int(rate.from % 7));
+    rate.rateFn = [ratio](){return ratio;};
+  }
+  return rates;
+}
+
+template <class EngineA, class EngineB>
+void assertSameConversions(EngineA& a, EngineB& b, CurId curCount)
+{
+  for (CurId from = 0; from < curCount; ++from)
+    for (CurId to = 0; to < curCount; ++to)
+      assert(a.convert(100.0, from, to) == b.convert(100.0, from, to));
+}
+
+template <class Engine>
+void runFlatPathsTest(const char* name)
+{
+  using namespace std;
+  cout << "Flat paths test " << name;
+  const CurId curCount = 60;
+  const auto rates = scatteredRates(curCount);
+  Engine walk;
+  Engine flat;
+  flat.setFlatPaths(true);
+  walk.init(rates);
+  flat.init(rates);
+  assert(flat.tableSize() > walk.tableSize());
+  assertSameConversions(walk, flat, curCount + 4);
+  assert(flat.convert(100.0, curCount + 2, curCount + 1) == 50.0);
+  assert(flat.convert(100.0, 0, curCount + 1) == 0.0);
+  flat.setFlatPaths(false);
+  flat.init(rates);
+  assert(flat.tableSize() == walk.tableSize());
+  cout << " end" << endl;
+}
+
+template <class Engine>
+void runLazyBFSTest(const char* name)
+{
+  using namespace std;
+  cout << "Lazy BFS test " << name;
+  const CurId curCount = 60;
+  const auto rates = scatteredRates(curCount);
+  Engine eager;
+  eager.init(rates);
+  assert(eager.searchedRows() == curCount + 3);
+  Engine lazy;
+  lazy.setLazy(true);
+  lazy.init(rates);
+  assert(lazy.searchedRows() == 0);
+  assert(lazy.convert(100.0, 0, 1) == eager.convert(100.0, 0, 1));
+  const size_t afterOne = lazy.searchedRows();
+  assert(afterOne > 0 && afterOne < curCount);
+  lazy.warmup({0, 5, 7, curCount + 10});
+  assert(lazy.searchedRows() <= afterOne + 2);
+  assertSameConversions(eager, lazy, curCount + 4);
+  assert(lazy.searchedRows() == curCount + 3);
+  // concurrent first conversions search each row once
+  lazy.init(rates);
+  assert(lazy.searchedRows() == 0);
+  vector<double> expected(curCount * curCount);
+  for (CurId from = 0; from < curCount; ++from)
+    for (CurId to = 0; to < curCount; ++to)
+      expected[from * curCount + to] = eager.convert(100.0, from, to);
+  atomic<bool> mismatch{false};
+  vector<thread> threads;
+  for (unsigned t = 0; t < 4; ++t)
+    threads.emplace_back([&, t]()
+    {
+      for (CurId i = 0; i < curCount * curCount; ++i)
+      {
+        const CurId pair = (i * (2 * t + 1) + 17 * t) % (curCount * curCount);
+        if (lazy.convert(100.0, pair / curCount, pair % curCount) != expected[pair])
+          mismatch = true;
+      }
+    });
+  for (auto& thread : threads)
+    thread.join();
+  assert(!mismatch && lazy.searchedRows() == curCount);
+  // snapshot needs every row
+  lazy.warmup({curCount + 2});
+  lazy.refreshRates();
+  eager.refreshRates();
+  assert(lazy.searchedRows() == curCount + 3 && lazy.snapshot().rates == eager.snapshot().rates);
+  cout << " end" << endl;
+}
+
+template <class Engine>
+void runDeltaUpdateTest(const char* name, bool lazy)
+{
+  using namespace std;
+  cout << "Delta update test " << name;
+  const CurId curCount = 80;
+  vector<ConvertRate> rates;
+  srand(23);
+  for (size_t i = 0; i < 150; ++i)
+  {
+    const double value = 0.5 + (rand() % 1000) / 300.0;
+    rates.push_back({CurId(rand() % curCount), CurId(rand() % curCount), [value]() { return value; }});
+  }
+  Engine full;
+  full.init(rates);
+  Engine delta;
+  delta.setLazy(lazy);
+  delta.setDeltaUpdates(true);
+  delta.init(rates);
+  const size_t plainSize = full.tableSize();
+  // no snapshot yet: full refresh
+  assert(delta.updateRates({3}) == 1);
+  assert(delta.tableSize() > plainSize);
+  full.refreshRates();
+  assert(delta.snapshot().rates == full.snapshot().rates);
+  for (size_t round = 0; round < 40; ++round)
+  {
+    vector<size_t> changed{size_t(rand()) % rates.size()};
+    if (round % 5 == 0)
+      changed.push_back(size_t(rand()) % rates.size());
+    for (const size_t index : changed)
+    {
+      const double value = round % 7 == 0 ? 0.0 : 0.5 + (rand() % 1000) / 300.0;
+      full.rateSource().set(index, value);
+      delta.rateSource().set(index, value);
+    }
+    const uint64_t epoch = delta.updateRates(changed);
+    assert(epoch == delta.snapshot().epoch);
+    full.refreshRates();
+    assert(delta.snapshot().rates == full.snapshot().rates);
+  }
+  bool outOfRange = false;
+  try { delta.updateRates({rates.size()}); } catch (const out_of_range&) { outOfRange = true; }
+  assert(outOfRange);
+  // init() drops the snapshot and the index
+  delta.init(rates);
+  delta.refreshRates();
+  full.init(rates);
+  full.refreshRates();
+  assert(delta.snapshot().rates == full.snapshot().rates);
+  cout << " end" << endl;
+}
+
+template <class Engine>
+void runStatsTest(const char* name)
+{
+  using namespace std;
+  cout << "Stats test " << name;
+  vector<ConvertRate> rates{
+    {0,1,[](){return 2.0;}},
+    {1,2,[](){return 0.0;}},
+    {5,6,[](){return 4.0;}}
+  };
+  Engine cvt;
+  cvt.init(rates);
+  ConverterStatsSnapshot stats = cvt.stats().snapshot();
+  assert(stats.initNanos.count() == 1 && stats.conversions == 0);
+  assert(cvt.convert(100.0, 0, 1) == 200.0);
+  assert(cvt.convert(100.0, 2, 0) == 0.0);
+  assert(cvt.convert(100.0, 0, 5) == 0.0);
+  assert(cvt.convert(100.0, 0, 70) == 0.0);
+  // counters of other threads are merged on read
+  vector<thread> threads;
+  for (int t = 0; t < 3; ++t)
+    threads.emplace_back([&cvt]()
+    {
+      for (int i = 0; i < 1000; ++i)
+        cvt.convert(1.0, 6, 5);
+    });
+  for (auto& thread : threads)
+    thread.join();
+  const double values[]{1.0, 2.0};
+  const CurId from[]{0, 5};
+  const CurId to[]{1, 6};
+  double out[2];
+  cvt.convertBatch(values, from, to, out, 2);
+  stats = cvt.stats().snapshot();
+  assert(stats.conversions == 3004 && stats.convertNanos.count() == 3004);
+  assert(stats.batchConversions == 2);
+  assert(stats.unreachable == 2 && stats.zeroRates == 1);
+  assert(stats.hops.count() == 3004 && stats.hops.max() == 2);
+  assert(stats.rateCalls == 1 + 2 + 3000 + 2);
+  assert(stats.hops.percentile(0.5) == 1 && stats.hops.percentile(1.0) == 2);
+  cvt.refreshRates();
+  assert(cvt.stats().snapshot().rateCalls == stats.rateCalls + 3);
+  cout << " end" << endl;
+}
+
+void runHistogramTest()
+{
+  using namespace std;
+  cout << "Histogram test";
+  for (uint64_t value : {uint64_t(0), uint64_t(15), uint64_t(16), uint64_t(17), uint64_t(1000),
+                         uint64_t(123456789), numeric_limits<uint64_t>::max()})
+  {
+    const size_t bucket = Histogram::bucket(value);
+    assert(bucket < Histogram::bucketCount);
+    assert(Histogram::lowerBound(bucket) <= value && value <= Histogram::upperBound(bucket));
+    assert(Histogram::upperBound(bucket) - Histogram::lowerBound(bucket) <= value / Histogram::subBuckets);
+  }
+  for (size_t bucket = 0; bucket + 1 < Histogram::bucketCount; ++bucket)
+    assert(Histogram::upperBound(bucket) + 1 == Histogram::lowerBound(bucket + 1));
+  Histogram histogram;
+  for (uint64_t value = 1; value <= 1000; ++value)
+    histogram.record(value);
+  assert(histogram.count() == 1000 && histogram.max() == 1000 && histogram.mean() == 500.5);
+  const uint64_t median = histogram.percentile(0.5);
+  assert(median >= 500 && median <= 500 + 500 / Histogram::subBuckets);
+  assert(histogram.percentile(0.999) == 1000);
+  uint64_t counted = 0;
+  histogram.forEachBucket([&counted](uint64_t, uint64_t, uint64_t count) { counted += count; });
+  assert(counted == 1000);
+  cout << " end" << endl;
+}
+
+template <class Engine>
+void runConversionCacheTest(const char* name)
+{
+  using namespace std;
+  cout << "Conversion cache test " << name;
+  vector<ConvertRate> rates{
+    {0,1,[](){return 2.0;}},
+    {1,2,[](){return 4.0;}}
+  };
+  Engine cvt;
+  cvt.setCacheSize(6);
+  cvt.init(rates);
+  assert(cvt.convert(100.0, 0, 2) == 800.0);
+  assert(cvt.convert(10.0, 0, 2) == 80.0);
+  assert(cvt.convert(800.0, 2, 0) == 100.0);
+  assert(cvt.cacheStats().hits == 1 && cvt.cacheStats().misses == 2);
+  // every set() moves the epoch
+  cvt.rateSource().set(0, 3.0);
+  assert(cvt.convert(100.0, 0, 2) == 1200.0 && cvt.convert(100.0, 0, 2) == 1200.0);
+  assert(cvt.cacheStats().hits == 2 && cvt.cacheStats().misses == 3);
+  // stores through slot() don't, the engine must be told
+  cvt.rateSource().slot(0).store(5.0);
+  assert(cvt.convert(100.0, 0, 2) == 1200.0);
+  cvt.advanceRateEpoch();
+  assert(cvt.convert(100.0, 0, 2) == 2000.0);
+  // snapshot conversions bypass the cache
+  cvt.refreshRates();
+  cvt.resetCacheStats();
+  assert(cvt.convert(100.0, 0, 2) == 2000.0);
+  assert(cvt.cacheStats().hits + cvt.cacheStats().misses == 0);
+  // re-init drops entries, tiny cache still converts like no cache
+  const CurId curCount = 60;
+  const auto scattered = scatteredRates(curCount);
+  Engine reference;
+  reference.init(scattered);
+  cvt.init(scattered);
+  assertSameConversions(reference, cvt, curCount + 4);
+  assertSameConversions(reference, cvt, curCount + 4);
+  const uint64_t hits = cvt.cacheStats().hits;
+  assert(cvt.convert(100.0, 3, 4) == cvt.convert(100.0, 3, 4) && cvt.cacheStats().hits == hits + 1);
+  cout << " end" << endl;
+}
+
+void runBestRateTests()
+{
+  using namespace std;
+  {
+    cout << "Best rate test 1 unavailable rates";
+    vector<ConvertRate> rates{
+      {0,1,[](){return 0.0;}},
+      {0,2,[](){return 2.0;}},
+      {2,1,[](){return 1.5;}},
+      {3,4,[](){return 2.0;}}
+    };
+    BFSConverter fewestHops;
+    fewestHops.init(rates);
+    BestRateConverter cvt;
+    cvt.init(rates);
+    assert(!cvt.hasArbitrage());
+    assert(fewestHops.convert(100.0, 0, 1) == 0.0);
+    assert(cvt.convert(100.0, 0, 1) == 300.0);
+    assert(cvt.convert(300.0, 1, 0) == 100.0);
+    assert(cvt.convert(100.0, 4, 3) == 50.0);
+    assert(cvt.convert(100.0, 0, 3) == 0.0);
+    assert(cvt.convert(100.0, 0, 0) == fewestHops.convert(100.0, 0, 0));
+    assert(cvt.convert(100.0, 0, 5) == 0.0);
+    cvt.refreshRates();
+    assert(cvt.convert(300.0, 1, 0) == 100.0);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Best rate test 2 consistent quotes";
+    const CurId curCount = 90;
+    const auto rates = consistentRates(curCount);
+    BFSConverter fewestHops;
+    fewestHops.init(rates);
+    BestRateConverter single;
+    single.init(rates);
+    BestRateConverter parallel;
+    parallel.setThreadCount(4);
+    parallel.init(rates);
+    assert(!single.hasArbitrage() && !parallel.hasArbitrage());
+    assertSameConversions(single, parallel, curCount + 4);
+    assertSameConversions(single, fewestHops, curCount + 4);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Best rate test 3 arbitrage";
+    vector<ConvertRate> rates{
+      {0,1,[](){return 2.0;}},
+      {1,2,[](){return 2.0;}},
+      {3,0,[](){return 1.0;}},
+      {2,0,nullptr}
+    };
+    BasicBestRateConverter<SlotRates> cvt;
+    cvt.init(rates);
+    cvt.rateSource().set(3, 0.5);
+    cvt.refreshRates();
+    assert(cvt.hasArbitrage());
+    const auto cycle = cvt.arbitrageCycle();
+    assert(cycle.size() == 3);
+    double product = 1.0;
+    for (size_t i = 0; i < cycle.size(); ++i)
+      product *= cvt.convert(1.0, cycle[i], cycle[(i + 1) % cycle.size()]);
+    assert(product == 2.0);
+    // fewest-hop paths meanwhile
+    assert(cvt.convert(100.0, 0, 2) == 200.0);
+    assert(cvt.convert(100.0, 3, 1) == 200.0);
+    cvt.rateSource().set(3, 0.25);
+    cvt.refreshRates();
+    assert(!cvt.hasArbitrage());
+    assert(cvt.convert(100.0, 2, 3) == 25.0);
+    cout << " end" << endl;
+  }
+}
+
+void runAllPairsTest()
+{
+  using namespace std;
+  cout << "All pairs test blocks";
+  // three 256-currency tiles, last one padded
+  const CurId curCount = 600;
+  auto rates = consistentRates(curCount);
+  for (CurId i = 0; i + 42 < curCount; i += 5)
+    rates.push_back({i, i + 42, [](){return 1.0;}});
+  BFSConverter bfs;
+  AllPairsConverter allPairs;
+  bfs.init(rates);
+  allPairs.init(rates);
+  // ties between paths differ, but every path of these rates gives the same product
+  assertSameConversions(bfs, allPairs, curCount + 4);
+  allPairs.refreshRates();
+  assertSameConversions(bfs, allPairs, curCount + 4);
+  assert(allPairs.snapshot().curCount == curCount + 3);
+  assert(allPairs.convert(100.0, 0, curCount + 1) == 0.0);
+  assert(allPairs.convert(100.0, 0, 0) == 0.0);
+  cout << " end" << endl;
+}
+
+void runInitArenaTest()
+{
+  using namespace std;
+  cout << "Init arena test reuse";
+  InitArena arena;
+  char* bytes = static_cast<char*>(arena.allocate(3, 1));
+  double* values = static_cast<double*>(arena.allocate(10 * sizeof(double), alignof(double)));
+  assert(reinterpret_cast<uintptr_t>(values) % alignof(double) == 0);
+  assert(bytes + 3 <= reinterpret_cast<char*>(values));
+  {
+    // bigger than a chunk
+    ArenaVector<uint32_t> big(1 << 20, 7, ArenaAllocator<uint32_t>(arena));
+    assert(big[12345] == 7);
+  }
+  const size_t capacity = arena.capacity();
+  arena.reset();
+  assert(static_cast<char*>(arena.allocate(3, 1)) == bytes);
+  ArenaVector<uint32_t> big(1 << 20, 7, ArenaAllocator<uint32_t>(arena));
+  assert(arena.capacity() == capacity);
+
+  const auto rates = scatteredRates(80);
+  SparseBFSConverter reference;
+  reference.init(rates);
+  SparseBFSConverter cvt;
+  cvt.init(scatteredRates(30));
+  cvt.init(rates);
+  const size_t initCapacity = cvt.initArena().capacity();
+  const size_t tableSize = cvt.tableSize();
+  cvt.init(rates);
+  assert(cvt.initArena().capacity() == initCapacity && cvt.tableSize() == tableSize);
+  assertSameConversions(reference, cvt, 84);
+  cout << " end" << endl;
+}
+
+template <class Engine>
+void runPathFileTest(const char* name)
+{
+  using namespace std;
+  cout << "Path file test " << name;
+  const char* fileName = "path_file_test.bin";
+  const CurId curCount = 60;
+  const auto rates = scatteredRates(curCount);
+  Engine cvt;
+  cvt.init(rates);
+  cvt.savePaths(fileName);
+  {
+    MappedConverter mapped(fileName);
+    assert(mapped.curCount() == curCount + 3);
+    assert(mapped.convert(100.0, 0, 1) == 0.0);
+    mapped.init(rates);
+    assertSameConversions(cvt, mapped, curCount + 4);
+    cvt.refreshRates();
+    mapped.refreshRates();
+    assert(mapped.snapshot().rates == cvt.snapshot().rates);
+    auto otherRates = rates;
+    swap(otherRates[0], otherRates[1]);
+    bool mismatch = false;
+    try { mapped.init(otherRates); } catch (const invalid_argument&) { mismatch = true; }
+    assert(mismatch);
+  }
+  {
+    // file with other signature is refused
+    ofstream(fileName, ios::binary | ios::in | ios::out).write("!RCPATHX", 8);
+    bool refused = false;
+    try { MappedConverter mapped(fileName); } catch (const runtime_error&) { refused = true; }
+    assert(refused);
+  }
+  remove(fileName);
+  cout << " end" << endl;
+}
+
+void runPathFileIncrementalTest()
+{
+  using namespace std;
+  cout << "Path file test incremental updates";
+  const char* fileName = "path_file_test.bin";
+  auto rates = scatteredRates(40);
+  Converter cvt;
+  cvt.init(rates);
+  const ConvertRate added{3, 44, [](){return 8.0;}};
+  cvt.addRate(added);
+  assert(cvt.removeRate(rates[5].from, rates[5].to));
+  cvt.savePaths(fileName);
+  MappedConverter mapped(fileName);
+  bool mismatch = false;
+  try { mapped.init(rates); } catch (const invalid_argument&) { mismatch = true; }
+  assert(mismatch);
+  rates.push_back(added);
+  mapped.init(rates);
+  assertSameConversions(cvt, mapped, 46);
+  assert(mapped.convert(100.0, 44, 3) == 12.5);
+  remove(fileName);
+  cout << " end" << endl;
+}
+
+void runSharedConverterTests()
+{
+  using namespace std;
+  const string name = "/rate_converter_test_" + to_string(::getpid());
+  {
+    cout << "Shared test 1 attached readers convert like the engine";
+    const CurId curCount = 50;
+    const auto rates = scatteredRates(curCount);
+    BFSConverter engine;
+    engine.init(rates);
+    SharedConverterPublisher publisher(name, engine, rates);
+    SharedConverter shared(name);
+    shared.init(rates);
+    assert(shared.curCount() == curCount + 3 && shared.publications() == 1);
+    assertSameConversions(engine, shared, curCount + 4);
+    engine.refreshRates();
+    shared.refreshRates();
+    assert(shared.snapshot().rates == engine.snapshot().rates);
+    // other process attaches by name
+    const pid_t child = fork();
+    if (child == 0)
+    {
+      SharedConverter other(name);
+      _exit(other.convert(1.0, 0, 1) == engine.convert(1.0, 0, 1) ? 0 : 1);
+    }
+    int status = 0;
+    assert(child > 0 && waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    auto otherRates = rates;
+    swap(otherRates[0], otherRates[1]);
+    bool mismatch = false;
+    try { shared.init(otherRates); } catch (const invalid_argument&) { mismatch = true; }
+    assert(mismatch);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Shared test 2 pushed values";
+    vector<ConvertRate> rates{{0,1,[](){return 2.0;}}, {1,2,[](){return 3.0;}}};
+    Converter engine;
+    engine.init(rates);
+    SharedConverterPublisher publisher(name, engine, rates);
+    SharedConverter shared(name);
+    assert(shared.convert(10.0, 0, 2) == 60.0);
+    assert(publisher.set(1, 0.0) == 2);
+    assert(shared.convert(10.0, 0, 2) == 0.0 && shared.convert(10.0, 2, 0) == 0.0);
+    assert(publisher.set(1, 5.0) == 3);
+    assert(shared.convert(10.0, 2, 0) == 1.0);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Shared test 3 conversions see one publication";
+    atomic<int> tick{1};
+    auto tickFn = [&tick]() { return double(tick.load()); };
+    vector<ConvertRate> rates{{0,1,tickFn}, {1,2,tickFn}};
+    Converter engine;
+    engine.init(rates);
+    SharedConverterPublisher publisher(name, engine, rates);
+    SharedConverter shared(name);
+    atomic<bool> done{false};
+    thread writer([&]()
+    {
+      for (int i = 2; i <= 20000; ++i)
+      {
+        tick = i;
+        publisher.publish();
+      }
+      done = true;
+    });
+    size_t reads = 0;
+    while (!done || reads == 0)
+    {
+      // both hops of the path must come from the same tick
+      const double total = shared.convert(1.0, 0, 2);
+      const double root = std::round(std::sqrt(total));
+      assert(root >= 1 && root * root == total);
+      ++reads;
+    }
+    writer.join();
+    assert(shared.convert(1.0, 0, 2) == 20000.0 * 20000.0 && shared.publications() == 20000);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Shared test 4 segments go away with publisher";
+    {
+      vector<ConvertRate> rates{{0,1,[](){return 2.0;}}};
+      Converter engine;
+      engine.init(rates);
+      SharedConverterPublisher publisher(name, engine, rates);
+    }
+    bool missing = false;
+    try { SharedConverter shared(name); } catch (const system_error&) { missing = true; }
+    assert(missing);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Shared test 5 live segments aren't taken over";
+    vector<ConvertRate> rates{{0,1,[](){return 2.0;}}};
+    Converter engine;
+    engine.init(rates);
+    {
+      SharedConverterPublisher publisher(name, engine, rates);
+      int error = 0;
+      try { SharedConverterPublisher second(name, engine, rates); }
+      catch (const system_error& e) { error = e.code().value(); }
+      assert(error == EEXIST);
+      // the failed publisher left the live segments alone
+      SharedConverter shared(name);
+      assert(shared.convert(10.0, 0, 1) == 20.0 && publisher.set(0, 3.0) == 2);
+      assert(shared.convert(10.0, 0, 1) == 30.0);
+    }
+    // an owner that crashed leaves its segments behind
+    const pid_t child = fork();
+    if (child == 0)
+    {
+      new SharedConverterPublisher(name, engine, rates);
+      _exit(0);
+    }
+    int status = 0;
+    assert(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status));
+    int error = 0;
+    try { SharedConverterPublisher stale(name, engine, rates); }
+    catch (const system_error& e) { error = e.code().value(); }
+    assert(error == EEXIST);
+    {
+      SharedConverterPublisher publisher(name, engine, rates, SharedConverterPublisher::Existing::REPLACE);
+      SharedConverter shared(name);
+      assert(shared.convert(10.0, 0, 1) == 20.0 && shared.publications() == 1);
+    }
+    cout << " end" << endl;
+  }
+  {
+    cout << "Shared test 6 readers don't attach to half-built segments";
+    // the first publish() runs inside the constructor, once both segments
+    // exist under their names
+    bool constructing = true;
+    size_t refused = 0;
+    const string fnName = name;
+    vector<ConvertRate> rates{{0,1,[&]()
+    {
+      if (constructing)
+      {
+        try { SharedConverter early(fnName); } catch (const runtime_error&) { ++refused; }
+      }
+      return 2.0;
+    }}};
+    Converter engine;
+    engine.init(rates);
+    {
+      SharedConverterPublisher publisher(name, engine, rates);
+      constructing = false;
+      assert(refused == 1);
+      SharedConverter shared(name);
+      assert(shared.convert(10.0, 0, 1) == 20.0);
+    }
+    // a reader racing the constructor either fails or sees a full publication
+    const auto bigRates = scatteredRates(300);
+    BFSConverter bigEngine;
+    bigEngine.init(bigRates);
+    const double expected = bigEngine.convert(1.0, 0, 299);
+    assert(expected != 0.0);
+    for (int round = 0; round < 20; ++round)
+    {
+      atomic<bool> done{false};
+      thread reader([&]()
+      {
+        while (!done)
+        {
+          try
+          {
+            SharedConverter racing(name);
+            assert(racing.convert(1.0, 0, 299) == expected);
+          }
+          catch (const runtime_error&) {}
+        }
+      });
+      {
+        SharedConverterPublisher publisher(name, bigEngine, bigRates);
+        SharedConverter shared(name);
+        assert(shared.convert(1.0, 0, 299) == expected);
+      }
+      done = true;
+      reader.join();
+    }
+    cout << " end" << endl;
+  }
+}
+
+// duplicate 2-3, zero rate 3, self-loop 7-7, separate 8-9
+constexpr StaticRate deskRates[] = {
+  {0,1}, {1,2}, {2,3}, {0,4}, {4,5}, {5,6}, {1,6}, {3,7}, {8,9}, {2,3}, {6,10}, {10,11}, {11,3}, {7,7}
+};
+constexpr StaticTopology<12, 14> desk(deskRates);
+static_assert(desk.hops(0, 3) == 3 && desk.hops(3, 0) == 3 && desk.hops(9, 8) == 1, "static paths");
+static_assert(!desk.convertible(0, 8) && !desk.convertible(0, 0) && desk.convertible(7, 7), "static paths");
+constexpr StaticTopology<12, 14, desk.maxHops()> tightDesk(deskRates);
+
+void runStaticConverterTest()
+{
+  using namespace std;
+  cout << "Static converter test";
+  vector<ConvertRate> rates;
+  for (size_t i = 0; i < 14; ++i)
+  {
+    const double value = i == 3 ? 0.0 : 1.1 + 0.37 * i;
+    rates.push_back({deskRates[i].from, deskRates[i].to, [value]() { return value; }});
+  }
+  SlotBFSConverter reference;
+  reference.init(rates);
+  StaticConverter<12, 14, desk.maxHops()> cvt(tightDesk);
+  cvt.init(rates);
+  assertSameConversions(reference, cvt, 14);
+  reference.rateSource().set(5, 2.5);
+  cvt.set(5, 2.5);
+  reference.rateSource().set(3, 4.0);
+  cvt.set(3, 4.0);
+  assertSameConversions(reference, cvt, 14);
+  assert(cvt.convert(100.0, 7, 7) == 100.0 && cvt.convert(100.0, 8, 0) == 0.0);
+  vector<double> before;
+  for (CurId from = 0; from < 12; ++from)
+    for (CurId to = 0; to < 12; ++to)
+      before.push_back(cvt.convert(1.0, from, to));
+  cvt.refreshRates();
+  assert(cvt.snapshot().rates == before);
+  // default MaxHops gives the same paths
+  StaticConverter<12, 14> loose(desk);
+  loose.init(rates);
+  loose.set(5, 2.5);
+  loose.set(3, 4.0);
+  assertSameConversions(reference, loose, 14);
+  auto otherRates = rates;
+  swap(otherRates[0], otherRates[1]);
+  bool mismatch = false;
+  try { cvt.init(otherRates); } catch (const invalid_argument&) { mismatch = true; }
+  assert(mismatch);
+  cout << " end" << endl;
+}
+
+void runQuoteConverterTest()
+{
+  using namespace std;
+  cout << "Quote converter test";
+  // mids of random rates, spread growing with rate id
+  const size_t curCount = 40;
+  vector<ConvertRate> mids;
+  vector<QuoteRate> quotes;
+  srand(17);
+  for (size_t i = 0; i < 70; ++i)
+  {
+    const CurId from = rand() % curCount, to = rand() % curCount;
+    const double mid = 0.5 + (rand() % 1000) / 250.0;
+    const double spread = 0.001 * (i % 7);
+    mids.push_back({from, to, [mid]() { return mid; }});
+    quotes.push_back({from, to, [mid, spread]() { return Quote{mid * (1 - spread), mid * (1 + spread), mid}; }});
+  }
+  SlotBFSConverter reference;
+  reference.init(mids);
+  QuoteConverter cvt;
+  cvt.init(quotes);
+  auto check = [&]()
+  {
+    for (CurId from = 0; from < curCount + 1; ++from)
+      for (CurId to = 0; to < curCount + 1; ++to)
+      {
+        const Quote quote = cvt.convert(100.0, from, to);
+        assert(quote.mid == reference.convert(100.0, from, to));
+        assert(quote.bid <= quote.mid && quote.mid <= quote.ask);
+        assert((quote.bid == 0) == (quote.mid == 0));
+      }
+  };
+  check();
+  reference.rateSource().set(4, 0.0);
+  cvt.set(4, Quote{0.0, 0.0, 0.0});
+  check();
+
+  // 2 -> 0 multiplies the quotes, 0 -> 2 divides by them with bid and ask swapped
+  QuoteConverter chain;
+  chain.init({{1, 0, []() { return Quote{2.0, 2.5, 2.25}; }},
+              {2, 1, []() { return Quote{4.0, 5.0, 4.5}; }}});
+  Quote quote = chain.convert(10.0, 2, 0);
+  assert(quote.bid == 80.0 && quote.ask == 125.0);
+  quote = chain.convert(125.0, 0, 2);
+  assert(quote.bid == (1.0 / 2.5 / 5.0) * 125.0 && quote.ask == (1.0 / 2.0 / 4.0) * 125.0);
+  chain.set(1, Quote{4.0, 0.0, 4.5});
+  quote = chain.convert(1.0, 0, 2);
+  assert(quote.bid == 0.0 && quote.ask == 1.0 / 2.0 / 4.0);
+  assert(chain.convert(1.0, 0, 0).mid == 0.0 && chain.convert(1.0, 0, 3).ask == 0.0);
+
+  vector<Quote> before;
+  for (CurId from = 0; from < curCount; ++from)
+    for (CurId to = 0; to < curCount; ++to)
+      before.push_back(cvt.convert(1.0, from, to));
+  cvt.refreshRates();
+  for (CurId from = 0; from < curCount; ++from)
+    for (CurId to = 0; to < curCount; ++to)
+    {
+      const Quote& walked = before[from * curCount + to];
+      const Quote snapshot = cvt.convert(1.0, from, to);
+      assert(walked.bid == snapshot.bid && walked.ask == snapshot.ask && walked.mid == snapshot.mid);
+    }
+  cout << " end" << endl;
+}
+
+void runHubConverterTest()
+{
+  using namespace std;
+  cout << "Hub converter test";
+  // any path between two currencies gives the same product, so every route
+  // must match BFS exactly
+  const CurId curCount = 120;
+  const auto rates = consistentRates(curCount);
+  BFSConverter reference;
+  reference.init(rates);
+  HubConverter cvt;
+  cvt.setMaxHops(HubConverter::maxHopLimit);
+  cvt.init(rates);
+  assert(cvt.hubs().size() == 4);
+  for (CurId from = 0; from < curCount + 4; ++from)
+    for (CurId to = 0; to < curCount + 4; ++to)
+    {
+      assert(cvt.convert(100.0, from, to) == reference.convert(100.0, from, to));
+      assert((cvt.hops(from, to) != 0) == (from != to && reference.convert(1.0, from, to) != 0));
+    }
+  // the hubless component converts over its direct rate only
+  assert(cvt.hops(curCount + 1, curCount + 2) == 1);
+
+  // too short a bound leaves far pairs out, a direct rate always counts
+  HubConverter bounded;
+  bounded.setMaxHops(1);
+  bounded.init(rates);
+  size_t dropped = 0;
+  for (CurId from = 0; from < curCount; ++from)
+    for (CurId to = 0; to < curCount; ++to)
+    {
+      const double value = bounded.convert(100.0, from, to);
+      assert(value == 0.0 || value == reference.convert(100.0, from, to));
+      assert(bounded.hops(from, to) <= 1);
+      dropped += value == 0.0 && reference.convert(100.0, from, to) != 0.0;
+    }
+  assert(dropped > 0);
+  for (const auto& rate : rates)
+    assert(rate.from == rate.to || bounded.hops(rate.from, rate.to) == 1);
+
+  // explicit hubs: spokes of a star go through the center
+  double spoke = 2.0;
+  vector<ConvertRate> star;
+  for (CurId i = 1; i < 10; ++i)
+    star.push_back({0, i, [i, &spoke](){return i == 1 ? spoke : 1.0 + i;}});
+  star.push_back({3, 3, [](){return 5.0;}});
+  HubConverter starCvt;
+  starCvt.setHubs({0, 50});
+  starCvt.init(star);
+  BFSConverter starReference;
+  starReference.init(star);
+  assert(starCvt.hubs() == vector<CurId>{0});
+  for (CurId from = 0; from < 10; ++from)
+    for (CurId to = 0; to < 10; ++to)
+      assert(starCvt.convert(10.0, from, to) == starReference.convert(10.0, from, to));
+  assert(starCvt.convert(10.0, 3, 3) == 10.0 && starCvt.hops(2, 7) == 2);
+  vector<double> before;
+  for (CurId from = 0; from < 10; ++from)
+    for (CurId to = 0; to < 10; ++to)
+      before.push_back(starCvt.convert(1.0, from, to));
+  // refreshRates() keeps rate values only, pairs compose from them
+  assert(starCvt.epoch() == 0 && starCvt.refreshRates() == 1 && starCvt.epoch() == 1);
+  static_assert(!is_base_of<IConverter, HubConverter>::value, "no snapshot of all pairs to give");
+  spoke = 7.0;
+  vector<double> after;
+  for (CurId from = 0; from < 10; ++from)
+    for (CurId to = 0; to < 10; ++to)
+      after.push_back(starCvt.convert(1.0, from, to));
+  assert(after == before);
+  const double batchValues[]{10.0, 10.0};
+  const CurId batchFrom[]{1, 4};
+  const CurId batchTo[]{4, 1};
+  double batchOut[2];
+  starCvt.convertBatch(batchValues, batchFrom, batchTo, batchOut, 2);
+  assert(batchOut[0] == starCvt.convert(10.0, 1, 4) && batchOut[1] == starCvt.convert(10.0, 4, 1));
+  starCvt.refreshRates();
+  assert(starCvt.convert(10.0, 0, 1) == 70.0 && starCvt.convert(70.0, 1, 0) == 10.0);
+  bool badBound = false;
+  try { starCvt.setMaxHops(0); } catch (const invalid_argument&) { badBound = true; }
+  assert(badBound);
+  cout << " end" << endl;
+}
+
+void runAsyncConverterTest()
+{
+  using namespace std;
+  cout << "Async converter test";
+  const CurId curCount = 80;
+  const auto rates = scatteredRates(curCount);
+  BFSConverter reference;
+  reference.init(rates);
+  AsyncConverter cvt;
+  cvt.init(asyncRates(rates));
+  for (CurId from = 0; from < curCount + 2; from += 3)
+    for (CurId to = 0; to < curCount + 2; ++to)
+      assert(cvt.convertAsync(100.0, from, to).get() == reference.convert(100.0, from, to));
+  vector<double> values;
+  vector<CurId> from;
+  vector<CurId> to;
+  for (CurId i = 0; i < curCount; ++i)
+  {
+    values.push_back(i + 0.5);
+    from.push_back(i);
+    to.push_back((i * 7 + 3) % (curCount + 2));
+  }
+  const vector<double> batch = cvt.convertBatchAsync(values.data(), from.data(), to.data(), values.size()).get();
+  for (size_t i = 0; i < values.size(); ++i)
+    assert(batch[i] == reference.convert(values[i], from[i], to[i]));
+
+  // fetches of one rate in flight are joined: 1 -> 0 -> 2 and 2 -> 0 -> 1
+  // both wait for the two rates of the star
+  promise<double> first;
+  promise<double> second;
+  const RateFuture firstRate = first.get_future().share();
+  const RateFuture secondRate = second.get_future().share();
+  atomic<int> started{0};
+  AsyncConverter star;
+  star.init({{0, 1, [&]() { ++started; return firstRate; }},
+             {0, 2, [&]() { ++started; return secondRate; }},
+             {0, 3, []() -> RateFuture { throw runtime_error("unreachable"); }}});
+  auto forward = star.convertAsync(10.0, 1, 2);
+  auto backward = star.convertAsync(10.0, 2, 1);
+  assert(started == 2 && star.fetches() == 2 && star.joinedFetches() == 2);
+  assert(forward.wait_for(chrono::seconds(0)) == future_status::deferred);
+  first.set_value(4.0);
+  second.set_value(2.0);
+  assert(forward.get() == 10.0 / 4.0 * 2.0 && backward.get() == 10.0 / 2.0 * 4.0);
+  // done fetches aren't reused
+  assert(star.convertAsync(1.0, 0, 1).get() == 4.0 && started == 3);
+  assert(star.convertAsync(1.0, 1, 1).get() == 0.0 && star.convertAsync(1.0, 9, 1).get() == 0.0);
+  bool failed = false;
+  try { star.convertAsync(1.0, 0, 3).get(); } catch (const runtime_error&) { failed = true; }
+  assert(failed);
+
+  // rates ready at once are still fetched once per batch
+  atomic<int> ready{0};
+  vector<AsyncRate> readyRates;
+  for (CurId i = 1; i <= 5; ++i)
+    readyRates.push_back({0, i, [&ready, i]()
+    {
+      ++ready;
+      promise<double> rate;
+      rate.set_value(1.0 + i);
+      return rate.get_future().share();
+    }});
+  AsyncConverter readyCvt;
+  readyCvt.init(readyRates);
+  vector<double> pairValues;
+  vector<CurId> pairFrom;
+  vector<CurId> pairTo;
+  for (CurId i = 1; i <= 5; ++i)
+    for (CurId j = 1; j <= 5; ++j)
+      if (i != j)
+      {
+        pairValues.push_back(1.0);
+        pairFrom.push_back(i);
+        pairTo.push_back(j);
+      }
+  const vector<double> pairs = readyCvt.convertBatchAsync(pairValues.data(), pairFrom.data(), pairTo.data(),
+                                                          pairValues.size()).get();
+  assert(ready == 5 && readyCvt.fetches() == 5 && readyCvt.joinedFetches() == 0);
+  for (size_t i = 0; i < pairs.size(); ++i)
+    assert(pairs[i] == 1.0 / (1.0 + pairFrom[i]) * (1.0 + pairTo[i]));
+
+  // blocking rates of a path are fetched at once
+  vector<ConvertRate> chain;
+  for (CurId i = 0; i < 4; ++i)
+    chain.push_back({i, i + 1, []() { this_thread::sleep_for(chrono::milliseconds(100)); return 2.0; }});
+  AsyncConverter slow;
+  slow.init(asyncRates(chain));
+  const auto start = chrono::steady_clock::now();
+  assert(slow.convertAsync(1.0, 0, 4).get() == 16.0);
+  assert(chrono::steady_clock::now() - start < chrono::milliseconds(300));
+  cout << " end" << endl;
+}
+
+void runPipelineTests()
+{
+  using namespace std;
+  const auto rates = scatteredRates(60);
+  BFSConverter engine;
+  engine.init(rates);
+  engine.refreshRates();
+  {
+    cout << "Pipeline test 1 binary records keep order";
+    vector<BinaryRecord> records;
+    for (uint32_t i = 0; i < 10000; ++i)
+      records.push_back({double(i % 97), i % 64, (i * 7) % 64});
+    string output;
+    ConversionPipeline pipeline(engine, RecordFormat::BINARY, 4, 100);
+    const size_t bytes = records.size() * sizeof(BinaryRecord);
+    assert(pipeline.run(reinterpret_cast<const char*>(records.data()), bytes, true,
+                        [&output](const char* data, size_t size) { output.append(data, size); }) == bytes);
+    assert(pipeline.records() == records.size() && output.size() == records.size() * sizeof(double));
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+      double value;
+      memcpy(&value, output.data() + i * sizeof(double), sizeof(value));
+      assert(value == engine.convert(records[i].amount, records[i].from, records[i].to));
+    }
+    bool truncated = false;
+    try { pipeline.run(reinterpret_cast<const char*>(records.data()), 20, true, [](const char*, size_t) {}); }
+    catch (const runtime_error&) { truncated = true; }
+    assert(truncated);
+    cout << " end" << endl;
+  }
+  {
+    cout << "Pipeline test 2 csv blocks split inside lines";
+    string input;
+    vector<double> expected;
+    for (uint32_t i = 0; i < 3000; ++i)
+    {
+      const double amount = 0.25 * (i % 41);
+      input += to_string(amount) + "," + to_string(i % 63) + "," + to_string((i * 5) % 63)
+             + (i % 2 ? "\r\n" : "\n");
+      if (i % 500 == 0)
+        input += "\n";
+      expected.push_back(engine.convert(amount, i % 63, (i * 5) % 63));
+    }
+    input.pop_back();
+    string output;
+    ConversionPipeline pipeline(engine, RecordFormat::CSV, 3, 10);
+    auto append = [&output](const char* data, size_t size) { output.append(data, size); };
+    // stream read in odd-sized blocks, leftovers carried to the next one
+    string pending;
+    for (size_t offset = 0; offset < input.size(); offset += 777)
+    {
+      pending += input.substr(offset, 777);
+      const bool last = offset + 777 >= input.size();
+      pending.erase(0, pipeline.run(pending.data(), pending.size(), last, append));
+    }
+    assert(pending.empty() && pipeline.records() == expected.size());
+    istringstream lines(output);
+    for (const double value : expected)
+    {
+      string line;
+      assert(getline(lines, line) && strtod(line.c_str(), nullptr) == value);
+    }
+    cout << " end" << endl;
+  }
+  {
+    cout << "Pipeline test 3 bad csv record";
+    const string input = "1,0,1\n2,0,1\n3,x,1\n";
+    ConversionPipeline pipeline(engine, RecordFormat::CSV, 2, 1);
+    bool refused = false;
+    try { pipeline.run(input.data(), input.size(), true, [](const char*, size_t) {}); }
+    catch (const runtime_error& error) { refused = string(error.what()).find("byte 12") != string::npos; }
+    assert(refused);
+    cout << " end" << endl;
+  }
+}
+
+// Streaming conversion of records in files or pipes (see ConversionPipeline)
+int runConverterCli(int argc, char** argv)
+{
+  using namespace std;
+  string ratesFile, inputFile = "-", outputFile = "-";
+  RecordFormat format = RecordFormat::CSV;
+  unsigned threadCount = 0;
+  int positional = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    const string arg = argv[i];
+    if (arg.compare(0, 8, "--rates=") == 0)
+      ratesFile = arg.substr(8);
+    else if (arg == "--format=csv" || arg == "--format=binary")
+      format = arg == "--format=csv" ? RecordFormat::CSV : RecordFormat::BINARY;
+    else if (arg.compare(0, 10, "--threads=") == 0)
+      threadCount = static_cast<unsigned>(strtoul(arg.c_str() + 10, nullptr, 10));
+    else if (arg.compare(0, 2, "--") != 0 && positional < 2)
+      (positional++ == 0 ? inputFile : outputFile) = arg;
+    else
+      ratesFile.clear(), i = argc;
+  }
+  if (ratesFile.empty())
+  {
+    fprintf(stderr,
+      "usage: converter --rates=FILE [--format=csv|binary] [--threads=N] [INPUT|- [OUTPUT|-]]\n"
+      "       converter                                  run tests\n"
+      "rates: from,to,rate lines; csv records: amount,from,to lines;\n"
+      "binary records: double amount, uint32 from, uint32 to; output: one amount per record\n");
+    return 1;
+  }
+  try
+  {
+    const auto rates = loadRates(ratesFile);
+    // feeds use sparse ids, e.g. 840000000000: the universe is the
+    // currencies quoted, not the largest id
+    InterningConverter<BFSConverter> engine;
+    engine.init(rates);
+    // composite rates of all pairs while they fit into 128MB
+    if (engine.engine().pathTable().size() <= 4096)
+      engine.refreshRates();
+    const int outFd = outputFile == "-" ? STDOUT_FILENO
+                                        : ::open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0)
+      throw system_error(errno, generic_category(), "can't open " + outputFile);
+    ConversionPipeline pipeline(engine, format, threadCount);
+    auto write = [outFd](const char* data, size_t size) { writeAll(outFd, data, size); };
+    struct stat status;
+    if (inputFile != "-" && ::stat(inputFile.c_str(), &status) == 0 && S_ISREG(status.st_mode))
+    {
+      if (status.st_size != 0)
+      {
+        ReadOnlyMapping input(inputFile, ReadOnlyMapping::Source::FILE);
+        pipeline.run(input.data(), input.size(), true, write);
+      }
+    }
+    else
+    {
+      const int inFd = inputFile == "-" ? STDIN_FILENO : ::open(inputFile.c_str(), O_RDONLY);
+      if (inFd < 0)
+        throw system_error(errno, generic_category(), "can't open " + inputFile);
+      // large blocks, the unconverted tail moves to the front of the next one
+      vector<char> block(64 << 20);
+      size_t filled = 0;
+      for (bool last = false; !last; )
+      {
+        const ssize_t got = ::read(inFd, block.data() + filled, block.size() - filled);
+        if (got < 0 && errno == EINTR)
+          continue;
+        if (got < 0)
+          throw system_error(errno, generic_category(), "can't read " + inputFile);
+        filled += static_cast<size_t>(got);
+        last = got == 0;
+        if (filled < block.size() && !last)
+          continue;
+        const size_t used = pipeline.run(block.data(), filled, last, write);
+        if (used == 0 && filled == block.size())
+          throw runtime_error("record longer than read block");
+        memmove(block.data(), block.data() + used, filled - used);
+        filled -= used;
+      }
+    }
+    if (outFd != STDOUT_FILENO && ::close(outFd) != 0)
+      throw system_error(errno, generic_category(), "can't close " + outputFile);
+    fprintf(stderr, "converted %llu records\n", static_cast<unsigned long long>(pipeline.records()));
+  }
+  catch (const exception& error)
+  {
+    fprintf(stderr, "converter: %s\n", error.what());
+    return 1;
+  }
+  return 0;
+}
+
+void runCliTest()
+{
+  using namespace std;
+  cout << "CLI test sparse large ids";
+  const string ratesFile = "test_cli_rates.csv";
+  const string inputFile = "test_cli_input.csv";
+  const string outputFile = "test_cli_output.csv";
+  {
+    ofstream rates(ratesFile);
+    rates << "# ids as in feeds, far apart\n"
+          << "840000000000,978000000000,2\n978000000000,392000000000,4\n5,840000000000,0.5\n";
+    ofstream input(inputFile);
+    input << "10,840000000000,392000000000\n10,392000000000,5\n1,7,5\n";
+    input << "1,18446744073709551615,5\n";
+  }
+  const pid_t child = fork();
+  if (child == 0)
+  {
+    // quiet about records converted
+    if (!freopen("/dev/null", "w", stderr))
+      _exit(2);
+    const string ratesArg = "--rates=" + ratesFile;
+    const char* args[]{"converter", ratesArg.c_str(), inputFile.c_str(), outputFile.c_str(), nullptr};
+    _exit(runConverterCli(4, const_cast<char**>(args)));
+  }
+  int status = 0;
+  assert(child > 0 && waitpid(child, &status, 0) == child);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  ifstream output(outputFile);
+  vector<double> values;
+  string line;
+  while (getline(output, line))
+    values.push_back(strtod(line.c_str(), nullptr));
+  assert((values == vector<double>{80.0, 2.5, 0.0, 0.0}));
+  remove(ratesFile.c_str());
+  remove(inputFile.c_str());
+  remove(outputFile.c_str());
+  cout << " end" << endl;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc > 1)
+    return runConverterCli(argc, argv);
   ConverterFactory factory;
-  factory.setType(ConverterFactory::Type::BFS);
-  runTests(factory);
+  for (auto type : {ConverterFactory::Type::INCREMENTAL, ConverterFactory::Type::BFS,
+                    ConverterFactory::Type::ALL_PAIRS})
+  {
+    factory.setType(type);
+    runTests(factory);
+    runUniverseTests(factory);
+    runPricerTests(factory);
+  }
+  runIncrementalTests();
+  runBFSTests();
+  runSlotRatesTest<SlotConverter>("incremental");
+  runSlotRatesTest<SlotBFSConverter>("bfs");
+  runInterningTest<Converter>("incremental");
+  runInterningTest<BFSConverter>("bfs");
+  runCurOrderTest<Converter>("incremental");
+  runCurOrderTest<BFSConverter>("bfs");
+  runFlatPathsTest<Converter>("incremental");
+  runFlatPathsTest<BFSConverter>("bfs");
+  runLazyBFSTest<BFSConverter>("auto");
+  runLazyBFSTest<SparseBFSConverter>("sparse");
+  runLazyBFSTest<ComponentBFSConverter>("components");
+  runDeltaUpdateTest<SlotBFSConverter>("auto", false);
+  runDeltaUpdateTest<BasicBFSConverter<SparsePathTable, SlotRates>>("sparse lazy", true);
+  runConversionCacheTest<SlotConverter>("incremental");
+  runConversionCacheTest<SlotBFSConverter>("bfs");
+  runHistogramTest();
+  runStatsTest<StatsConverter>("incremental");
+  runStatsTest<StatsBFSConverter>("bfs");
+  runAllPairsTest();
+  runInitArenaTest();
+  runPathFileTest<Converter>("incremental");
+  runPathFileTest<SparseBFSConverter>("bfs");
+  runPathFileTest<AllPairsConverter>("all pairs");
+  runPathFileTest<BestRateConverter>("best rate");
+  runPathFileIncrementalTest();
+  runBestRateTests();
+  runSharedConverterTests();
+  runPipelineTests();
+  runCliTest();
+  runStaticConverterTest();
+  runQuoteConverterTest();
+  runHubConverterTest();
+  runAsyncConverterTest();
   return 0;
 }
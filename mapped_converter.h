@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "converter.h"
+
+// Whole file or POSIX shared memory object mapped read-only
+class ReadOnlyMapping
+{
+public:
+  enum class Source { FILE, SHARED_MEMORY };
+
+  ReadOnlyMapping(const std::string& name, Source source)
+  {
+    const int fd = source == Source::FILE ? ::open(name.c_str(), O_RDONLY)
+                                          : ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "can't open " + name);
+    struct stat status;
+    if (::fstat(fd, &status) != 0)
+    {
+      const int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "can't stat " + name);
+    }
+    mSize = static_cast<size_t>(status.st_size);
+    void* data = mSize ? ::mmap(nullptr, mSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    const int error = errno;
+    ::close(fd);
+    if (data == MAP_FAILED)
+      throw std::system_error(mSize ? error : EINVAL, std::generic_category(), "can't map " + name);
+    mData = static_cast<const char*>(data);
+  }
+
+  ReadOnlyMapping(const ReadOnlyMapping&) = delete;
+  ReadOnlyMapping& operator=(const ReadOnlyMapping&) = delete;
+
+  ~ReadOnlyMapping()
+  {
+    ::munmap(const_cast<char*>(mData), mSize);
+  }
+
+  const char* data() const { return mData; }
+  size_t size() const { return mSize; }
+
+private:
+  const char* mData{nullptr};
+  size_t mSize{0};
+};
+
+// what's wrong with path file image 'data', nullptr if it can be used;
+// only the header is checked, cells are trusted to come from savePaths()
+inline const char* checkPathFile(const char* data, size_t size)
+{
+  if (size < sizeof(PathFileHeader))
+    return "truncated header";
+  const PathFileHeader& header = *reinterpret_cast<const PathFileHeader*>(data);
+  if (header.signature != PathFileHeader::expectedSignature)
+    return "not a path file or other byte order";
+  if (header.version != PathFileHeader::currentVersion)
+    return "unsupported version";
+  if (header.cellSize != sizeof(PathFileCell) || header.cellsOffset % alignof(PathFileCell)
+      || header.cellsOffset < sizeof(PathFileHeader))
+    return "unsupported layout";
+  if (header.curCount > PathFileCell::nocur
+      || header.rateCount > static_cast<uint64_t>(std::numeric_limits<int32_t>::max()))
+    return "bad sizes";
+  if (size < header.cellsOffset + header.curCount * header.curCount * sizeof(PathFileCell))
+    return "truncated paths";
+  return nullptr;
+}
+
+// Serves paths written by savePaths() of an engine straight from a
+// read-only mapping of the file: constructor costs an open and a header
+// check instead of init()'s path search, convert() page-faults the rows it
+// touches and all processes mapping the same file share those pages.
+// init() only attaches rate functions, they must be the rates the paths
+// were computed for, in the same order. convert() gives 0 before init()
+template <class RateSource = FunctionRates>
+class BasicMappedConverter : public IConverter
+{
+public:
+  // 'source' - whether 'name' is a file path or a shared memory object
+  explicit BasicMappedConverter(const std::string& name,
+                                ReadOnlyMapping::Source source = ReadOnlyMapping::Source::FILE)
+    : mMapping(name, source)
+  {
+    const char* problem = checkPathFile(mMapping.data(), mMapping.size());
+    if (problem)
+      throw std::runtime_error("MappedConverter: " + name + ": " + problem);
+    mCells = reinterpret_cast<const PathFileCell*>(mMapping.data() + header().cellsOffset);
+  }
+
+  // attaches rate functions, throws std::invalid_argument if 'rates'
+  // aren't the rates of the file
+  void init(const std::vector<ConvertRate>& _rates)
+  {
+    if (_rates.size() != header().rateCount || topologyHash(_rates) != header().topology)
+      throw std::invalid_argument("MappedConverter: rates don't match path file");
+    mUseSnapshot = false;
+    rates.clear();
+    rates.reserve(_rates.size() + 1);
+    rates.push_back([]() { return 0.0; }); // add dummy fn
+    for (const auto& rate : _rates)
+      rates.push_back(rate.rateFn);
+  }
+
+  double convert(double value, CurId from, CurId to)
+  {
+    const double totalRate = mUseSnapshot ? mSnapshot.rate(from, to) : pathRate(from, to);
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+    return finalValue;
+  }
+
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    if (mUseSnapshot)
+      return convertSnapshot(mSnapshot, values, from, to, out, count);
+    convertGrouped(values, from, to, out, count,
+                   [this](CurId f, CurId t) { return pathRate(f, t); });
+  }
+
+  // O(R + N^2)
+  uint64_t refreshRates()
+  {
+    std::vector<double> edgeRates(rates.size());
+    for (size_t id = 1; id < rates.size(); ++id)
+      edgeRates[id] = rates.get(id);
+    composeRates(mSnapshot, rates.size() ? curCount() : 0, edgeRates,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+    mUseSnapshot = true;
+    return ++mSnapshot.epoch;
+  }
+
+  const RateSnapshot& snapshot() const { return mSnapshot; }
+
+  size_t curCount() const { return header().curCount; }
+  // bytes of the mapping
+  size_t tableSize() const { return mMapping.size(); }
+  // rate values, e.g. slots to push prices into for SlotRates
+  RateSource& rateSource() { return rates; }
+
+private:
+  const PathFileHeader& header() const { return *reinterpret_cast<const PathFileHeader*>(mMapping.data()); }
+
+  const PathFileCell& cell(CurId from, CurId to) const { return mCells[from * curCount() + to]; }
+
+  bool hop(CurId from, CurId to, CurId& nextCur, int32_t& rateId) const
+  {
+    const PathFileCell& pathCell = cell(from, to);
+    if (pathCell.nextCur == PathFileCell::nocur)
+      return false;
+    nextCur = pathCell.nextCur;
+    rateId = pathCell.rateId;
+    return true;
+  }
+
+  // product of rates along the path, 0 if there is no path
+  double pathRate(CurId from, CurId to)
+  {
+    const size_t count = curCount();
+    if (rates.size() == 0 || from >= count || to >= count || cell(from, to).nextCur == PathFileCell::nocur)
+      return 0.0d;
+    double totalRate = 1.0d;
+    for (CurId cur = from; cur != to; )
+    {
+      const PathFileCell& pathCell = cell(cur, to);
+      const int32_t rateId = pathCell.rateId;
+      if (rateId > 0)
+      {
+        totalRate *= rates.get(rateId);
+      }
+      else
+      {
+        double rate = rates.get(-rateId);
+        if (rate == 0)
+          totalRate = 0;
+        else
+          totalRate /= rate;
+      }
+      cur = pathCell.nextCur;
+    }
+    return totalRate;
+  }
+
+  ReadOnlyMapping mMapping;
+  const PathFileCell* mCells{nullptr};
+  RateSource rates;
+  RateSnapshot mSnapshot;
+  bool mUseSnapshot{false};
+};
+
+using MappedConverter = BasicMappedConverter<FunctionRates>;
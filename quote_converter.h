@@ -0,0 +1,201 @@
+#pragma once
+
+#include "converter.h"
+
+// Two-sided price of a rate from -> to: 'bid' - 'to' got for one 'from'
+// sold, 'ask' - 'to' paid for one 'from' bought, 'mid' between them.
+// 0 on a side - it isn't available
+struct Quote
+{
+  double bid;
+  double ask;
+  double mid;
+};
+using QuoteFn = std::function<Quote()>;
+
+struct QuoteRate
+{
+  CurId   from;
+  CurId   to;
+  QuoteFn quoteFn;
+};
+
+// Composite quotes of all currency pairs taken at one moment, one
+// curCount x curCount row-major matrix per side
+struct QuoteSnapshot
+{
+  uint64_t epoch{0};
+  size_t curCount{0};
+  std::vector<double> bid;
+  std::vector<double> ask;
+  std::vector<double> mid;
+
+  Quote quote(CurId from, CurId to) const
+  {
+    if (from >= curCount || to >= curCount)
+      return Quote{0.0, 0.0, 0.0};
+    const size_t cell = from * curCount + to;
+    return Quote{bid[cell], ask[cell], mid[cell]};
+  }
+};
+
+// Converts bid, ask and mid in one walk over one path table, instead of
+// three engines with a table each. Paths are the fewest-hop ones of
+// BFSConverter, computed by one inside. Every rate keeps its sides in a
+// block of lanes in both orientations: as quoted and swapped for the
+// inverse edge, where bid becomes 1 / ask and ask becomes 1 / bid. A hop is
+// then one multiply or divide over all lanes, which the compiler does with
+// vector instructions. Each side of a result equals the rate
+// BFSConverter gives for that side's values along the same path.
+// QuoteFn of a rate only gives its initial value, producers push quotes
+// with set(), which must not run concurrently with conversions
+template <class PathTable = AutoPathTable>
+class BasicQuoteConverter
+{
+public:
+  // 'curCount' - minimal universe size
+  explicit BasicQuoteConverter(size_t curCount = 0)
+    : mPaths(curCount)
+  {
+  }
+
+  // number of threads computing paths in init(), 0 - one per hardware thread
+  void setThreadCount(unsigned threadCount) { mPaths.setThreadCount(threadCount); }
+
+  void init(const std::vector<QuoteRate>& rates)
+  {
+    std::vector<ConvertRate> topology;
+    topology.reserve(rates.size());
+    for (const auto& rate : rates)
+      topology.push_back({rate.from, rate.to, RateFn()});
+    mPaths.init(topology);
+    mUseSnapshot = false;
+    // block 0 is the dummy rate
+    mQuotes.assign(rates.size() + 1, QuoteLanes());
+    for (size_t i = 0; i < rates.size(); ++i)
+      set(i, rates[i].quoteFn ? rates[i].quoteFn() : Quote{0.0, 0.0, 0.0});
+  }
+
+  // 'rateIndex' - position of the rate among init() rates
+  void set(size_t rateIndex, const Quote& quote)
+  {
+    QuoteLanes& lanes = mQuotes[rateIndex + 1];
+    lanes.forward[bidLane] = quote.bid;
+    lanes.forward[askLane] = quote.ask;
+    lanes.forward[midLane] = quote.mid;
+    lanes.forward[padLane] = 1.0;
+    lanes.inverse[bidLane] = quote.ask;
+    lanes.inverse[askLane] = quote.bid;
+    lanes.inverse[midLane] = quote.mid;
+    lanes.inverse[padLane] = 1.0;
+  }
+
+  // 'value' amount of 'from' sold at bid, bought at ask and at mid,
+  // in units of 'to'; zeros if there is no path
+  Quote convert(double value, CurId from, CurId to) const
+  {
+    const Quote rate = mUseSnapshot ? mSnapshot.quote(from, to) : pathQuote(from, to);
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+    return Quote{
+      static_cast<double>(static_cast<long double>(rate.bid) * static_cast<long double>(value)),
+      static_cast<double>(static_cast<long double>(rate.ask) * static_cast<long double>(value)),
+      static_cast<double>(static_cast<long double>(rate.mid) * static_cast<long double>(value))};
+  }
+
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    Quote* out, size_t count) const
+  {
+    for (size_t i = 0; i < count; ++i)
+      out[i] = convert(values[i], from[i], to[i]);
+  }
+
+  // composes quotes of all pairs, convert() reads them until next init()
+  // or refreshRates(); O(N^2 * L), L - average path length
+  uint64_t refreshRates()
+  {
+    const size_t curCount = mPaths.pathTable().size();
+    mSnapshot.curCount = curCount;
+    mSnapshot.bid.resize(curCount * curCount);
+    mSnapshot.ask.resize(curCount * curCount);
+    mSnapshot.mid.resize(curCount * curCount);
+    for (CurId from = 0; from < curCount; ++from)
+    {
+      for (CurId to = 0; to < curCount; ++to)
+      {
+        const Quote quote = pathQuote(from, to);
+        const size_t cell = from * curCount + to;
+        mSnapshot.bid[cell] = quote.bid;
+        mSnapshot.ask[cell] = quote.ask;
+        mSnapshot.mid[cell] = quote.mid;
+      }
+    }
+    mUseSnapshot = true;
+    return ++mSnapshot.epoch;
+  }
+
+  const QuoteSnapshot& snapshot() const { return mSnapshot; }
+
+  // bytes taken by the path table and quote lanes
+  size_t tableSize() const { return mPaths.tableSize() + mQuotes.capacity() * sizeof(QuoteLanes); }
+
+private:
+  static const size_t bidLane{0};
+  static const size_t askLane{1};
+  static const size_t midLane{2};
+  // keeps a lane block at 4 doubles, always 1.0
+  static const size_t padLane{3};
+  static const size_t laneCount{4};
+
+  // not over-aligned: vector storage of C++14 doesn't honour it
+  struct Lanes
+  {
+    double lane[laneCount];
+    double& operator[](size_t i) { return lane[i]; }
+    double operator[](size_t i) const { return lane[i]; }
+  };
+  struct QuoteLanes
+  {
+    Lanes forward{{0.0, 0.0, 0.0, 1.0}};
+    Lanes inverse{{0.0, 0.0, 0.0, 1.0}};
+  };
+
+  // product of quotes along the path, divisions for inverse edges; a side
+  // becomes 0 once an inverse edge has 0 on it, as in BFSConverter
+  Quote pathQuote(CurId from, CurId to) const
+  {
+    const PathTable& paths = mPaths.pathTable();
+    if (from >= paths.size() || to >= paths.size() || !paths.find(from, to))
+      return Quote{0.0, 0.0, 0.0};
+    Lanes total{{1.0, 1.0, 1.0, 1.0}};
+    for (CurId cur = from, nextCur = from; from != to && nextCur != to; cur = nextCur)
+    {
+      nextCur = paths.find(cur, to)->nextCur;
+      const int32_t rateId = paths.find(cur, nextCur)->rateId;
+      if (rateId > 0)
+      {
+        const Lanes& rate = mQuotes[rateId].forward;
+        for (size_t i = 0; i < laneCount; ++i)
+          total[i] *= rate[i];
+      }
+      else
+      {
+        // branch free, so lanes divide at once and no lane divides by 0
+        const Lanes& rate = mQuotes[-rateId].inverse;
+        for (size_t i = 0; i < laneCount; ++i)
+        {
+          const double quotient = total[i] / (rate[i] == 0 ? 1.0 : rate[i]);
+          total[i] = rate[i] == 0 ? 0.0 : quotient;
+        }
+      }
+    }
+    return Quote{total[bidLane], total[askLane], total[midLane]};
+  }
+
+  // paths only, its rate values stay 0
+  BasicBFSConverter<PathTable, SlotRates> mPaths;
+  std::vector<QuoteLanes> mQuotes;
+  QuoteSnapshot mSnapshot;
+  bool mUseSnapshot{false};
+};
+
+using QuoteConverter = BasicQuoteConverter<AutoPathTable>;
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "mapped_converter.h"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared rate slots need address-free 64-bit atomics");
+
+// Rate values segment of shared tables: this header, then rateCount + 1
+// slots from 'slotsOffset', slot 'id' holds bits of rate 'id' (0 is the
+// dummy rate). One writer, many readers: 'sequence' is odd while the
+// writer updates slots. 'signature' is stored last, once the paths
+// segment, this header and the first publication are complete, so it
+// tells readers that both segments are ready
+struct SharedRatesHeader
+{
+  static const uint64_t expectedSignature{0x5345544152435221ull}; // "!RCRATES"
+  static const uint32_t currentVersion{1};
+  std::atomic<uint64_t> signature;
+  uint32_t version;
+  uint32_t slotSize;
+  uint64_t rateCount;
+  // topologyHash() of the rates, same as of the paths segment
+  uint64_t topology;
+  uint64_t slotsOffset;
+  // on its own cache line, readers check it around every conversion
+  alignas(64) std::atomic<uint64_t> sequence;
+};
+
+using SharedRateSlot = std::atomic<uint64_t>;
+
+// Owner side of tables shared by processes on one host. Takes paths of an
+// engine initialized with 'rates' and publishes them with rate values into
+// POSIX shared memory objects '<name>.paths' (path file image, see
+// PathFileHeader) and '<name>.rates' (see SharedRatesHeader); 'name' is
+// "/something". Objects are removed when the publisher is destroyed,
+// attached SharedConverters keep their mappings
+class SharedConverterPublisher
+{
+public:
+  // what to do with objects of 'name' that already exist
+  enum class Existing
+  {
+    // std::system_error with EEXIST, another publisher may be alive
+    FAIL,
+    // remove them first: objects left by an owner that crashed, must not
+    // be used while another publisher of 'name' is alive
+    REPLACE,
+  };
+
+  template <class Engine>
+  SharedConverterPublisher(const std::string& name, Engine& engine, const std::vector<ConvertRate>& rates,
+                           Existing existing = Existing::FAIL)
+    : mPaths(name + ".paths", pathImage(engine), existing == Existing::REPLACE)
+    , mRates(name + ".rates", slotsOffset() + (rates.size() + 1) * sizeof(SharedRateSlot),
+             existing == Existing::REPLACE)
+  {
+    const auto& paths = *reinterpret_cast<const PathFileHeader*>(mPaths.data());
+    if (paths.rateCount != rates.size() || paths.topology != topologyHash(rates))
+      throw std::invalid_argument("SharedConverterPublisher: engine wasn't initialized with these rates");
+    auto* header = new (mRates.data()) SharedRatesHeader{};
+    header->version = SharedRatesHeader::currentVersion;
+    header->slotSize = sizeof(SharedRateSlot);
+    header->rateCount = rates.size();
+    header->topology = paths.topology;
+    header->slotsOffset = slotsOffset();
+    for (size_t id = 0; id <= rates.size(); ++id)
+      new (&slot(id)) SharedRateSlot(0);
+    mRateFns.reserve(rates.size());
+    for (const auto& rate : rates)
+      mRateFns.push_back(rate.rateFn);
+    publish();
+    // readers attaching before this refuse the segments
+    header->signature.store(SharedRatesHeader::expectedSignature, std::memory_order_release);
+  }
+
+  // evaluates every rate function and publishes all values at once,
+  // returns number of publications so far
+  uint64_t publish()
+  {
+    std::vector<double> values(mRateFns.size());
+    for (size_t i = 0; i < values.size(); ++i)
+      values[i] = mRateFns[i] ? mRateFns[i]() : 0.0;
+    return write([&]()
+    {
+      for (size_t i = 0; i < values.size(); ++i)
+        store(i + 1, values[i]);
+    });
+  }
+
+  // publishes one pushed value, 'rateIndex' - position in rates
+  uint64_t set(size_t rateIndex, double value)
+  {
+    return write([&]() { store(rateIndex + 1, value); });
+  }
+
+private:
+  // read-write mapping of a shared memory object created for it
+  class Segment
+  {
+  public:
+    // 'replace' - remove an existing object of 'name' first
+    Segment(const std::string& name, size_t size, bool replace)
+      : mName(name)
+      , mSize(size)
+    {
+      if (replace)
+        ::shm_unlink(name.c_str());
+      const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+      if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "can't create " + name);
+      void* data = MAP_FAILED;
+      if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+        data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      const int error = errno;
+      ::close(fd);
+      if (data == MAP_FAILED)
+      {
+        ::shm_unlink(name.c_str());
+        throw std::system_error(error, std::generic_category(), "can't map " + name);
+      }
+      mData = static_cast<char*>(data);
+    }
+
+    Segment(const std::string& name, const std::string& image, bool replace)
+      : Segment(name, image.size(), replace)
+    {
+      std::memcpy(mData, image.data(), image.size());
+    }
+
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    ~Segment()
+    {
+      ::munmap(mData, mSize);
+      ::shm_unlink(mName.c_str());
+    }
+
+    char* data() const { return mData; }
+
+  private:
+    std::string mName;
+    size_t mSize;
+    char* mData;
+  };
+
+  template <class Engine>
+  static std::string pathImage(Engine& engine)
+  {
+    std::ostringstream out;
+    engine.savePaths(out);
+    return out.str();
+  }
+
+  static size_t slotsOffset() { return (sizeof(SharedRatesHeader) + 63) / 64 * 64; }
+
+  SharedRatesHeader& header() const { return *reinterpret_cast<SharedRatesHeader*>(mRates.data()); }
+  SharedRateSlot& slot(size_t id) const
+  {
+    return reinterpret_cast<SharedRateSlot*>(mRates.data() + slotsOffset())[id];
+  }
+  void store(size_t id, double value)
+  {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    slot(id).store(bits, std::memory_order_relaxed);
+  }
+
+  // seqlock write section, readers retry conversions overlapping it
+  template <class WriteFn>
+  uint64_t write(WriteFn fn)
+  {
+    std::lock_guard<std::mutex> lock(mWriterMutex);
+    std::atomic<uint64_t>& sequence = header().sequence;
+    const uint64_t before = sequence.load(std::memory_order_relaxed);
+    sequence.store(before + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    fn();
+    sequence.store(before + 2, std::memory_order_release);
+    return (before + 2) / 2;
+  }
+
+  Segment mPaths;
+  Segment mRates;
+  std::vector<RateFn> mRateFns;
+  std::mutex mWriterMutex;
+};
+
+// Reader side of tables published by SharedConverterPublisher, attached
+// read-only: no own copy of paths or rates, convert() walks the shared
+// paths with shared rate values. All hops of one conversion are read in
+// one seqlock section, so they come from the same publication; readers
+// never block the writer or each other, they only retry a conversion a
+// publication overlapped
+class SharedConverter : public IConverter
+{
+public:
+  explicit SharedConverter(const std::string& name)
+    : mPaths(name + ".paths", ReadOnlyMapping::Source::SHARED_MEMORY)
+    , mRates(name + ".rates", ReadOnlyMapping::Source::SHARED_MEMORY)
+  {
+    // paths are only read once the rates segment says both are complete
+    const char* problem = checkPublished();
+    if (!problem)
+      problem = checkPathFile(mPaths.data(), mPaths.size());
+    if (!problem)
+      problem = checkRates();
+    if (problem)
+      throw std::runtime_error("SharedConverter: " + name + ": " + problem);
+    mCells = reinterpret_cast<const PathFileCell*>(mPaths.data() + paths().cellsOffset);
+    mSlots = reinterpret_cast<const SharedRateSlot*>(mRates.data() + rates().slotsOffset);
+  }
+
+  // rate values come from the publisher, this only checks that 'rates'
+  // are the ones tables were published for (std::invalid_argument if not)
+  void init(const std::vector<ConvertRate>& _rates)
+  {
+    if (_rates.size() != paths().rateCount || topologyHash(_rates) != paths().topology)
+      throw std::invalid_argument("SharedConverter: rates don't match shared tables");
+    mUseSnapshot = false;
+  }
+
+  double convert(double value, CurId from, CurId to)
+  {
+    const double totalRate = mUseSnapshot ? mSnapshot.rate(from, to)
+                                          : read([&]() { return pathRate(from, to); });
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+    return finalValue;
+  }
+
+  // every conversion is consistent on its own, the batch may span publications
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    if (mUseSnapshot)
+      return convertSnapshot(mSnapshot, values, from, to, out, count);
+    convertGrouped(values, from, to, out, count,
+                   [this](CurId f, CurId t) { return read([&]() { return pathRate(f, t); }); });
+  }
+
+  // copies rates of one publication and caches composite rates, O(R + N^2)
+  uint64_t refreshRates()
+  {
+    const size_t rateCount = paths().rateCount;
+    std::vector<double> edgeRates(rateCount + 1);
+    read([&]()
+    {
+      for (size_t id = 1; id <= rateCount; ++id)
+        edgeRates[id] = rate(static_cast<int32_t>(id));
+      return 0;
+    });
+    composeRates(mSnapshot, curCount(), edgeRates,
+      [this](CurId from, CurId to, CurId& nextCur, int32_t& rateId)
+      {
+        return hop(from, to, nextCur, rateId);
+      });
+    mUseSnapshot = true;
+    return ++mSnapshot.epoch;
+  }
+
+  const RateSnapshot& snapshot() const { return mSnapshot; }
+
+  size_t curCount() const { return paths().curCount; }
+  // publications made so far
+  uint64_t publications() const { return rates().sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+  const PathFileHeader& paths() const { return *reinterpret_cast<const PathFileHeader*>(mPaths.data()); }
+  const SharedRatesHeader& rates() const
+  {
+    return *reinterpret_cast<const SharedRatesHeader*>(mRates.data());
+  }
+
+  const char* checkPublished() const
+  {
+    if (mRates.size() < sizeof(SharedRatesHeader))
+      return "truncated rates header";
+    const SharedRatesHeader& header = rates();
+    if (header.signature.load(std::memory_order_acquire) != SharedRatesHeader::expectedSignature)
+      return "not a rates segment, other byte order or not published yet";
+    if (header.sequence.load(std::memory_order_relaxed) == 0)
+      return "not published yet";
+    return nullptr;
+  }
+
+  const char* checkRates() const
+  {
+    const SharedRatesHeader& header = rates();
+    if (header.version != SharedRatesHeader::currentVersion || header.slotSize != sizeof(SharedRateSlot)
+        || header.slotsOffset % alignof(SharedRateSlot) || header.slotsOffset < sizeof(SharedRatesHeader))
+      return "unsupported rates layout";
+    if (header.rateCount != paths().rateCount || header.topology != paths().topology)
+      return "rates segment of other paths";
+    if (mRates.size() < header.slotsOffset + (header.rateCount + 1) * sizeof(SharedRateSlot))
+      return "truncated rates";
+    return nullptr;
+  }
+
+  // seqlock read section: runs 'fn' until no publication overlapped it
+  template <class ReadFn>
+  auto read(ReadFn fn) const -> decltype(fn())
+  {
+    const std::atomic<uint64_t>& sequence = rates().sequence;
+    for (;;)
+    {
+      const uint64_t before = sequence.load(std::memory_order_acquire);
+      if (before & 1)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+      const auto result = fn();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == before)
+        return result;
+    }
+  }
+
+  double rate(int32_t id) const
+  {
+    const uint64_t bits = mSlots[id].load(std::memory_order_relaxed);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  const PathFileCell& cell(CurId from, CurId to) const { return mCells[from * curCount() + to]; }
+
+  bool hop(CurId from, CurId to, CurId& nextCur, int32_t& rateId) const
+  {
+    const PathFileCell& pathCell = cell(from, to);
+    if (pathCell.nextCur == PathFileCell::nocur)
+      return false;
+    nextCur = pathCell.nextCur;
+    rateId = pathCell.rateId;
+    return true;
+  }
+
+  // product of rates along the path, 0 if there is no path
+  double pathRate(CurId from, CurId to) const
+  {
+    const size_t count = curCount();
+    if (from >= count || to >= count || cell(from, to).nextCur == PathFileCell::nocur)
+      return 0.0d;
+    double totalRate = 1.0d;
+    for (CurId cur = from; cur != to; )
+    {
+      const PathFileCell& pathCell = cell(cur, to);
+      const int32_t rateId = pathCell.rateId;
+      if (rateId > 0)
+      {
+        totalRate *= rate(rateId);
+      }
+      else
+      {
+        double value = rate(-rateId);
+        if (value == 0)
+          totalRate = 0;
+        else
+          totalRate /= value;
+      }
+      cur = pathCell.nextCur;
+    }
+    return totalRate;
+  }
+
+  ReadOnlyMapping mPaths;
+  ReadOnlyMapping mRates;
+  const PathFileCell* mCells{nullptr};
+  const SharedRateSlot* mSlots{nullptr};
+  RateSnapshot mSnapshot;
+  bool mUseSnapshot{false};
+};
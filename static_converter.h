@@ -0,0 +1,234 @@
+#pragma once
+
+#include <array>
+
+#include "converter.h"
+
+// Rate of a compile-time currency set, its value comes at run time
+struct StaticRate
+{
+  CurId from;
+  CurId to;
+};
+
+// Paths of a fixed rate list of N currencies computed at compile time:
+// constexpr StaticTopology<N, R> desk(deskRates) runs the same BFS as
+// BFSConverter and picks the same paths. Every pair gets its path as
+// exactly MaxHops signed rate slots (negative - inverse rate), padded
+// with slot 0, which holds 1.0. MaxHops defaults to N - 1, enough for any
+// graph; a smaller one that some path doesn't fit fails compilation.
+// Tables are built in C arrays: std::array can't be written in constexpr
+// functions before C++17
+template <size_t N, size_t R, size_t MaxHops = (N > 1 ? N - 1 : 1)>
+class StaticTopology
+{
+  static_assert(N > 0 && R > 0, "static topology needs currencies and rates");
+  static_assert(N <= 255 && R + 1 < static_cast<size_t>(std::numeric_limits<int32_t>::max()),
+                "static topology is for small fixed currency sets");
+
+public:
+  // slot of a value always 0, first slot of paths of unconvertible pairs
+  static const int32_t zeroSlot{static_cast<int32_t>(R + 1)};
+
+  constexpr explicit StaticTopology(const StaticRate (&rates)[R])
+    : mRates{}
+    , mPaths{}
+    , mHops{}
+    , mMaxHops(0)
+  {
+    // last rate between two currencies wins, as in BFSConverter
+    int32_t direct[N * N]{};
+    size_t offsets[N + 1]{};
+    for (size_t i = 0; i < R; ++i)
+    {
+      if (rates[i].from >= N || rates[i].to >= N)
+        throw std::out_of_range("StaticTopology: currency id out of N");
+      mRates[i] = rates[i];
+      direct[rates[i].from * N + rates[i].to] = static_cast<int32_t>(i + 1);
+      direct[rates[i].to * N + rates[i].from] = -static_cast<int32_t>(i + 1);
+      ++offsets[rates[i].from + 1];
+      ++offsets[rates[i].to + 1];
+    }
+    for (size_t cur = 0; cur < N; ++cur)
+      offsets[cur + 1] += offsets[cur];
+    CurId neighbours[2 * R]{};
+    size_t filled[N]{};
+    for (size_t cur = 0; cur < N; ++cur)
+      filled[cur] = offsets[cur];
+    for (size_t i = 0; i < R; ++i)
+    {
+      neighbours[filled[rates[i].from]++] = rates[i].to;
+      neighbours[filled[rates[i].to]++] = rates[i].from;
+    }
+
+    // first hop of every pair, N - no path
+    CurId nextCur[N * N]{};
+    for (size_t i = 0; i < N * N; ++i)
+      nextCur[i] = direct[i] ? i % N : N;
+    for (CurId from = 0; from < N; ++from)
+    {
+      bool visited[N]{};
+      CurId queue[N]{};
+      CurId firstHop[N]{};
+      size_t tail = 0;
+      visited[from] = true;
+      for (size_t i = offsets[from]; i < offsets[from + 1]; ++i)
+      {
+        const CurId next = neighbours[i];
+        if (visited[next])
+          continue;
+        visited[next] = true;
+        queue[tail] = next;
+        firstHop[tail++] = next;
+      }
+      for (size_t head = 0; head < tail; ++head)
+      {
+        for (size_t i = offsets[queue[head]]; i < offsets[queue[head] + 1]; ++i)
+        {
+          const CurId next = neighbours[i];
+          if (visited[next])
+            continue;
+          visited[next] = true;
+          nextCur[from * N + next] = firstHop[head];
+          queue[tail] = next;
+          firstHop[tail++] = firstHop[head];
+        }
+      }
+    }
+
+    for (CurId from = 0; from < N; ++from)
+    {
+      for (CurId to = 0; to < N; ++to)
+      {
+        int32_t* path = mPaths + (from * N + to) * MaxHops;
+        if (nextCur[from * N + to] == N)
+        {
+          path[0] = zeroSlot;
+          continue;
+        }
+        // a self-loop rate makes x -> x convertible at 1, as in BFSConverter
+        size_t hops = 0;
+        for (CurId cur = from; cur != to; cur = nextCur[cur * N + to])
+        {
+          if (hops == MaxHops)
+            throw std::length_error("StaticTopology: path longer than MaxHops");
+          path[hops++] = direct[cur * N + nextCur[cur * N + to]];
+        }
+        mHops[from * N + to] = static_cast<uint8_t>(hops);
+        mMaxHops = hops > mMaxHops ? hops : mMaxHops;
+      }
+    }
+  }
+
+  // MaxHops slots of the path
+  constexpr const int32_t* path(CurId from, CurId to) const { return mPaths + (from * N + to) * MaxHops; }
+  constexpr size_t hops(CurId from, CurId to) const { return mHops[from * N + to]; }
+  constexpr bool convertible(CurId from, CurId to) const { return mPaths[(from * N + to) * MaxHops] != zeroSlot; }
+  // the longest path, e.g. as MaxHops of a tighter topology
+  constexpr size_t maxHops() const { return mMaxHops; }
+  constexpr StaticRate rate(size_t index) const { return mRates[index]; }
+
+private:
+  StaticRate mRates[R];
+  int32_t mPaths[N * N * MaxHops];
+  uint8_t mHops[N * N];
+  size_t mMaxHops;
+};
+
+// Engine over a StaticTopology: a copy of its tables and an array of rate
+// values pushed with set(), like SlotRates. convert() walks exactly
+// MaxHops slots in a loop of constant length the compiler unrolls, no
+// virtual call when called on the concrete type. Results equal the ones
+// of BFSConverter over the same rates
+template <size_t N, size_t R, size_t MaxHops = (N > 1 ? N - 1 : 1)>
+class StaticConverter final : public IConverter
+{
+public:
+  using Topology = StaticTopology<N, R, MaxHops>;
+
+  explicit StaticConverter(const Topology& topology)
+    : mTopology(topology)
+  {
+    mRates[0].store(1.0, std::memory_order_relaxed);
+    for (size_t id = 1; id <= R; ++id)
+      mRates[id].store(0.0, std::memory_order_relaxed);
+    mRates[Topology::zeroSlot].store(0.0, std::memory_order_relaxed);
+  }
+
+  // takes initial values of 'rates', which must list the topology's rates
+  // in the same order (std::invalid_argument if not)
+  void init(const std::vector<ConvertRate>& rates)
+  {
+    if (rates.size() != R)
+      throw std::invalid_argument("StaticConverter: rates don't match static topology");
+    for (size_t i = 0; i < R; ++i)
+      if (rates[i].from != mTopology.rate(i).from || rates[i].to != mTopology.rate(i).to)
+        throw std::invalid_argument("StaticConverter: rates don't match static topology");
+    for (size_t i = 0; i < R; ++i)
+      set(i, rates[i].rateFn ? rates[i].rateFn() : 0.0);
+    mUseSnapshot = false;
+  }
+
+  // 'rateIndex' - position of the rate in the topology's list
+  void set(size_t rateIndex, double value) { mRates[rateIndex + 1].store(value, std::memory_order_relaxed); }
+
+  double convert(double value, CurId from, CurId to)
+  {
+    const double totalRate = mUseSnapshot ? mSnapshot.rate(from, to) : pathRate(from, to);
+	// weird compiler behavior, when multiplication result is 0 (seems casts to int)
+	double finalValue = static_cast<long double>(totalRate) * static_cast<long double>(value);
+    return finalValue;
+  }
+
+  void convertBatch(const double* values, const CurId* from, const CurId* to,
+                    double* out, size_t count)
+  {
+    if (mUseSnapshot)
+      return convertSnapshot(mSnapshot, values, from, to, out, count);
+    for (size_t i = 0; i < count; ++i)
+      out[i] = convert(values[i], from[i], to[i]);
+  }
+
+  // O(N^2 * MaxHops)
+  uint64_t refreshRates()
+  {
+    mSnapshot.curCount = N;
+    mSnapshot.rates.resize(N * N);
+    for (CurId from = 0; from < N; ++from)
+      for (CurId to = 0; to < N; ++to)
+        mSnapshot.rates[from * N + to] = pathRate(from, to);
+    mUseSnapshot = true;
+    return ++mSnapshot.epoch;
+  }
+
+  const RateSnapshot& snapshot() const { return mSnapshot; }
+
+  const Topology& topology() const { return mTopology; }
+
+private:
+  // product of rates along the path, 0 if there is no path; padding
+  // slots multiply by 1.0, which keeps the product exact
+  double pathRate(CurId from, CurId to) const
+  {
+    if (from >= N || to >= N)
+      return 0.0d;
+    const int32_t* path = mTopology.path(from, to);
+    double totalRate = 1.0d;
+    for (size_t hop = 0; hop < MaxHops; ++hop)
+    {
+      const int32_t slot = path[hop];
+      const double rate = mRates[slot < 0 ? -slot : slot].load(std::memory_order_relaxed);
+      if (slot >= 0)
+        totalRate *= rate;
+      else
+        totalRate = rate == 0 ? 0.0 : totalRate / rate;
+    }
+    return totalRate;
+  }
+
+  const Topology mTopology;
+  // slot 0 - 1.0 for padding, 1..R - rate values, R + 1 - always 0
+  std::array<std::atomic<double>, R + 2> mRates;
+  RateSnapshot mSnapshot;
+  bool mUseSnapshot{false};
+};